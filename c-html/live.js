@@ -0,0 +1,78 @@
+<style>
+.live td
+{
+  font-size: 150%;
+  padding-right: 1em;
+}
+.stale
+{
+  color: #c04433;
+}
+</style>
+<table class="live">
+<tr><td>Total</td><td id="t_total">-</td></tr>
+<tr><td>Leg</td><td id="t_leg">-</td></tr>
+<tr><td>Split</td><td id="t_split">-</td></tr>
+<tr><td>Distance</td><td id="dist">-</td></tr>
+<tr><td>Pace</td><td id="pace">-</td></tr>
+<tr><td>Signal</td><td id="conf">-</td></tr>
+<tr><td>Last fix</td><td id="fix">-</td></tr>
+</table>
+<p id="status">Connecting</p>
+<script>
+
+// same order as DistInfo.ConfidenceLevel
+var conf_names = ['Good signal','Initial guess','Bad signal','Suspect signal','Signal lost',
+                  'Searching for signal','Lost signal recovery','Signal restored',
+                  'Signal disabled'];
+
+function fmt_time(ms)
+{
+  var s = Math.floor(ms / 1000);
+  var h = Math.floor(s / 3600);
+  var m = Math.floor(s / 60) % 60;
+
+  s %= 60;
+  return (h ? h + ':' + (m < 10 ? '0' : '') : '') + m + ':' + (s < 10 ? '0' : '') + s;
+}
+
+function set_text(id,text)
+{
+  document.getElementById(id).innerHTML = text;
+}
+
+function show_run(r)
+{
+  set_text('t_total',fmt_time(r.t_total));
+  set_text('t_leg',fmt_time(r.t_leg));
+  set_text('t_split',fmt_time(r.t_split));
+  set_text('dist',r.dist.toFixed(2) + ' mi, leg ' + (r.dist - r.d_last_leg).toFixed(2) +
+           ', split ' + (r.dist - r.d_last_split).toFixed(2));
+  set_text('pace',r.pace_t > 0 ? fmt_time(r.pace_t) + ' /mi' : '-');
+  set_text('conf',conf_names[r.conf] || 'Unknown');
+
+  if (r.fix)
+    set_text('fix',r.fix.lat.toFixed(5) + ', ' + r.fix.lon.toFixed(5) + ' &plusmn;' +
+             r.fix.accuracy.toFixed(0) + ' m at ' + fmt_time(r.fix.ts));
+}
+
+if (window.EventSource)
+{
+  var live = new EventSource('/live/events');
+
+  live.onmessage = function(e)
+  {
+    show_run(JSON.parse(e.data));
+    set_text('status','Updated ' + new Date().toLocaleTimeString());
+    document.getElementById('status').className = '';
+  };
+
+  live.onerror = function()
+  {
+    set_text('status','Disconnected, retrying');
+    document.getElementById('status').className = 'stale';
+  };
+}
+else
+  set_text('status','This browser does not support Server-Sent Events');
+</script>
@@ -37,10 +37,11 @@ include $(BUILD_STATIC_LIBRARY)
 include $(CLEAR_VARS)
 LOCAL_MODULE    := fast_running_friend 
 LOCAL_SRC_FILES := fast_running_friend.c http_daemon.c timer.c timer_jni.c mem_pool.c url.c frb.c config_vars.c \
-  sirf_gps.c
+  config_vars_gen.c sirf_gps.c log.c trace.c metrics.c kalman.c geodesy.c track.c export.c archive.c \
+  purge.c pack.c sync.c fusion.c fix_queue.c live.c autolap.c
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/libmicrohttpd $(LOCAL_PATH)/libcurl
 LOCAL_STATIC_LIBRARIES := microhttpd libcurl
-LOCAL_LDLIBS    := -lm -llog 
+LOCAL_LDLIBS    := -lm -llog -lz
 LOCAL_CFLAGS := -DHAVE_CONFIG_H 
 
  
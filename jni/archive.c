@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "archive.h"
+#include "timer.h"
+#include "track.h"
+#include "pack.h"
+#include "fusion.h"
+#include "trace.h"
+#include "log.h"
+
+#define TAR_BLOCK 512
+#define TAR_RECORD 10240
+
+typedef enum {ARCHIVE_HEADER,ARCHIVE_DATA,ARCHIVE_PAD,ARCHIVE_END,ARCHIVE_DONE} Archive_phase;
+
+typedef struct
+{
+  char* name;
+  int binary;
+  char* data; /* contents when they are not in a file */
+  uint size;
+} Archive_entry;
+
+struct st_archive_stream
+{
+  char dir[PATH_MAX+1];
+  Archive_entry* entries;
+  uint n_entries,size_entries,cur;
+  Archive_phase phase;
+  int fd,entry_open;
+  struct stat st;
+  off_t left;
+  char hdr[TAR_BLOCK];
+  uint hdr_pos,pad_left;
+  unsigned long long total;
+  int gzip,z_level,z_done;
+  z_stream z;
+  char* raw;
+};
+
+static const char* data_file_prefixes[] =
+{
+  TIMER_DATA_PREFIX, META_DATA_PREFIX, GPS_DATA_PREFIX, POD_DATA_PREFIX, TRACE_FILE_PREFIX,
+  LOG_FILE_PREFIX, PACK_FILE, 0
+};
+
+static int entry_compare(const void* a, const void* b)
+{
+  return strcmp(((const Archive_entry*)a)->name,((const Archive_entry*)b)->name);
+}
+
+const char* archive_name_ts(const char* name)
+{
+  const char** p;
+
+  for (p = data_file_prefixes; *p; p++)
+    if (!strncmp(name,*p,strlen(*p)))
+      return name + strlen(*p);
+
+  return 0;
+}
+
+int archive_is_data_file(const char* name)
+{
+  if (strchr(name,'/') || *name == '.')
+    return 0;
+
+  return archive_name_ts(name) != 0;
+}
+
+/* newer than since by the timestamp in the name, or changed since then */
+static int is_newer(const char* name, const struct stat* st, const char* since, time_t since_t)
+{
+  const char* ts = archive_name_ts(name);
+
+  if (ts && strlen(ts) >= TRACK_TS_LEN && strncmp(ts,since,TRACK_TS_LEN) >= 0)
+    return 1;
+
+  return st->st_mtime >= since_t;
+}
+
+/* takes over data, which is freed with the stream */
+static int add_entry(Archive_stream* s, const char* name, char* data, uint size)
+{
+  Archive_entry* e;
+
+  if (s->n_entries == s->size_entries)
+  {
+    uint new_size = s->size_entries ? s->size_entries * 2 : 64;
+
+    if (!(e = (Archive_entry*)realloc(s->entries,new_size * sizeof(*e))))
+      goto err;
+
+    s->entries = e;
+    s->size_entries = new_size;
+  }
+
+  e = s->entries + s->n_entries;
+
+  if (!(e->name = strdup(name)))
+    goto err;
+
+  e->binary = !strncmp(name,TRACE_FILE_PREFIX,strlen(TRACE_FILE_PREFIX));
+  e->data = data;
+  e->size = size;
+  s->n_entries++;
+  return 0;
+err:
+  LOGE("OOM adding %s to archive", name);
+  free(data);
+  return 1;
+}
+
+static int list_files(Archive_stream* s, const char* since)
+{
+  DIR* d;
+  struct dirent* d_ent;
+  time_t since_t = 0;
+
+  if (since && track_parse_ts(since,&since_t))
+  {
+    LOGE("Invalid archive timestamp %s", since);
+    return 1;
+  }
+
+  if (!(d = opendir(s->dir)))
+  {
+    LOGE("Could not open directory %s (%d)", s->dir, errno);
+    return 1;
+  }
+
+  while ((d_ent = readdir(d)))
+  {
+    char fname[PATH_MAX+1];
+    struct stat st;
+
+    if (!archive_is_data_file(d_ent->d_name))
+      continue;
+
+    snprintf(fname,sizeof(fname),"%s%s",s->dir,d_ent->d_name);
+
+    if (stat(fname,&st) || !S_ISREG(st.st_mode))
+      continue;
+
+    if (since && !is_newer(d_ent->d_name,&st,since,since_t))
+      continue;
+
+    if (add_entry(s,d_ent->d_name,0,0))
+    {
+      closedir(d);
+      return 1;
+    }
+  }
+
+  closedir(d);
+  return 0;
+}
+
+Archive_stream* archive_new(const char* dir)
+{
+  Archive_stream* s;
+  uint len = strlen(dir);
+
+  if (len + 2 > sizeof(s->dir))
+    return 0;
+
+  if (!(s = (Archive_stream*)calloc(1,sizeof(*s))))
+    return 0;
+
+  s->fd = -1;
+  memcpy(s->dir,dir,len + 1);
+
+  if (len && dir[len - 1] != '/')
+    strcat(s->dir,"/");
+
+  return s;
+}
+
+int archive_add_file(Archive_stream* s, const char* name)
+{
+  return add_entry(s,name,0,0);
+}
+
+int archive_add_data(Archive_stream* s, const char* name, char* data, uint size)
+{
+  return add_entry(s,name,data,size);
+}
+
+int archive_start(Archive_stream* s, int gzip)
+{
+  if (s->n_entries)
+    qsort(s->entries,s->n_entries,sizeof(*s->entries),entry_compare);
+
+  if (gzip)
+  {
+    if (!(s->raw = (char*)malloc(ARCHIVE_BLOCK_SIZE)))
+      return 1;
+
+    // window bits + 16 asks zlib for a gzip header and trailer
+    if (deflateInit2(&s->z,ARCHIVE_GZIP_LEVEL,Z_DEFLATED,15 + 16,8,Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      LOGE("deflateInit2() failed");
+      free(s->raw);
+      s->raw = 0;
+      return 1;
+    }
+
+    s->gzip = 1;
+    s->z_level = ARCHIVE_GZIP_LEVEL;
+  }
+
+  LOGI("Archiving %u files%s", s->n_entries, gzip ? " with gzip" : "");
+  return 0;
+}
+
+Archive_stream* archive_open(const char* dir, const char* since, int gzip)
+{
+  Archive_stream* s;
+
+  if (!(s = archive_new(dir)))
+    return 0;
+
+  if (list_files(s,since) || archive_start(s,gzip))
+  {
+    archive_close(s);
+    return 0;
+  }
+
+  return s;
+}
+
+void archive_close(Archive_stream* s)
+{
+  uint i;
+
+  if (!s)
+    return;
+
+  if (s->fd >= 0)
+    close(s->fd);
+
+  for (i = 0; i < s->n_entries; i++)
+  {
+    free(s->entries[i].name);
+    free(s->entries[i].data);
+  }
+
+  if (s->gzip)
+    deflateEnd(&s->z);
+
+  free(s->entries);
+  free(s->raw);
+  free(s);
+}
+
+static void tar_octal(char* field, uint size, unsigned long long val)
+{
+  // size - 1 digits and a NUL
+  field[--size] = 0;
+
+  while (size--)
+  {
+    field[size] = '0' + (val & 7);
+    val >>= 3;
+  }
+}
+
+static void build_header(Archive_stream* s, const char* name)
+{
+  char* h = s->hdr;
+  uint i, sum = 0;
+
+  memset(h,0,TAR_BLOCK);
+  snprintf(h,100,ARCHIVE_DIR_NAME "%s",name);
+  tar_octal(h + 100,8,0644);
+  tar_octal(h + 108,8,0);
+  tar_octal(h + 116,8,0);
+  tar_octal(h + 124,12,s->st.st_size);
+  tar_octal(h + 136,12,s->st.st_mtime);
+  memset(h + 148,' ',8);
+  h[156] = '0';
+  memcpy(h + 257,"ustar",6);
+  memcpy(h + 263,"00",2);
+
+  for (i = 0; i < TAR_BLOCK; i++)
+    sum += (unsigned char)h[i];
+
+  tar_octal(h + 148,7,sum);
+  s->hdr_pos = 0;
+}
+
+/* opens the next file that can be opened and builds its header, 0 when there are none */
+static int next_file(Archive_stream* s)
+{
+  for (; s->cur < s->n_entries; s->cur++)
+  {
+    Archive_entry* e = s->entries + s->cur;
+    char fname[PATH_MAX+1];
+
+    if (strlen(e->name) + strlen(ARCHIVE_DIR_NAME) >= 100)
+      continue;
+
+    if (e->data)
+    {
+      memset(&s->st,0,sizeof(s->st));
+      s->st.st_size = e->size;
+      s->st.st_mtime = time(0);
+      build_header(s,e->name);
+      s->left = e->size;
+      s->entry_open = 1;
+      return 1;
+    }
+
+    snprintf(fname,sizeof(fname),"%s%s",s->dir,e->name);
+
+    if ((s->fd = open(fname,O_RDONLY)) < 0)
+      continue;
+
+    if (fstat(s->fd,&s->st))
+    {
+      close(s->fd);
+      s->fd = -1;
+      continue;
+    }
+
+    build_header(s,e->name);
+    s->left = s->st.st_size;
+    s->entry_open = 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Up to max bytes of the tar stream, never crossing from one phase into the next, so the
+  caller sees the start of every file's data in a call of its own.
+*/
+static ssize_t produce(Archive_stream* s, char* buf, size_t max)
+{
+  ssize_t n = 0;
+
+  for (;;)
+  {
+    switch (s->phase)
+    {
+      case ARCHIVE_HEADER:
+        if (!s->entry_open && !next_file(s))
+        {
+          s->phase = ARCHIVE_END;
+          // at least two zero blocks, then up to a full record
+          s->pad_left = 2 * TAR_BLOCK;
+          s->pad_left += (TAR_RECORD - (s->total + s->pad_left) % TAR_RECORD) % TAR_RECORD;
+          continue;
+        }
+
+        n = TAR_BLOCK - s->hdr_pos;
+
+        if (n > max)
+          n = max;
+
+        memcpy(buf,s->hdr + s->hdr_pos,n);
+
+        if ((s->hdr_pos += n) == TAR_BLOCK)
+          s->phase = ARCHIVE_DATA;
+
+        break;
+      case ARCHIVE_DATA:
+        if (!s->left)
+        {
+          if (s->fd >= 0)
+            close(s->fd);
+
+          s->fd = -1;
+          s->entry_open = 0;
+          s->phase = ARCHIVE_PAD;
+          s->pad_left = (TAR_BLOCK - s->st.st_size % TAR_BLOCK) % TAR_BLOCK;
+          continue;
+        }
+
+        n = (s->left < (off_t)max) ? s->left : (off_t)max;
+
+        if (s->entries[s->cur].data)
+        {
+          memcpy(buf,s->entries[s->cur].data + (s->st.st_size - s->left),n);
+          s->left -= n;
+          break;
+        }
+
+        if ((n = read(s->fd,buf,n)) < 0)
+        {
+          LOGE("Error reading %s (%d)", s->entries[s->cur].name, errno);
+          return -2;
+        }
+
+        // the file shrank since we wrote its size into the header, keep the size
+        if (!n)
+        {
+          n = (s->left < (off_t)max) ? s->left : (off_t)max;
+          memset(buf,0,n);
+        }
+
+        s->left -= n;
+        break;
+      case ARCHIVE_PAD:
+      case ARCHIVE_END:
+        if (!s->pad_left)
+        {
+          if (s->phase == ARCHIVE_END)
+          {
+            s->phase = ARCHIVE_DONE;
+            return -1;
+          }
+
+          s->cur++;
+          s->phase = ARCHIVE_HEADER;
+          continue;
+        }
+
+        n = (s->pad_left < max) ? s->pad_left : max;
+        memset(buf,0,n);
+        s->pad_left -= n;
+        break;
+      case ARCHIVE_DONE:
+        return -1;
+    }
+
+    s->total += n;
+    return n;
+  }
+}
+
+static ssize_t read_gzip(Archive_stream* s, char* buf, size_t max)
+{
+  s->z.next_out = (Bytef*)buf;
+  s->z.avail_out = max;
+
+  while (s->z.avail_out && !s->z_done)
+  {
+    int flush = Z_NO_FLUSH, ret;
+
+    if (!s->z.avail_in)
+    {
+      ssize_t n;
+
+      // only switch levels with nothing buffered, deflateParams() flushes what it has
+      if (s->phase == ARCHIVE_DATA && s->left)
+      {
+        int level = s->entries[s->cur].binary ? Z_NO_COMPRESSION : ARCHIVE_GZIP_LEVEL;
+
+        if (level != s->z_level)
+        {
+          if (deflateParams(&s->z,level,Z_DEFAULT_STRATEGY) == Z_BUF_ERROR)
+            break;
+
+          s->z_level = level;
+        }
+      }
+
+      if ((n = produce(s,s->raw,ARCHIVE_BLOCK_SIZE)) == -2)
+        return -2;
+
+      if (n == -1)
+        flush = Z_FINISH;
+      else
+      {
+        s->z.next_in = (Bytef*)s->raw;
+        s->z.avail_in = n;
+      }
+    }
+    else if (s->phase == ARCHIVE_DONE)
+      flush = Z_FINISH;
+
+    ret = deflate(&s->z,flush);
+
+    if (ret == Z_STREAM_END)
+      s->z_done = 1;
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      LOGE("deflate() failed (%d)", ret);
+      return -2;
+    }
+  }
+
+  if (s->z_done && s->z.avail_out == max)
+    return -1;
+
+  return max - s->z.avail_out;
+}
+
+ssize_t archive_read(Archive_stream* s, char* buf, size_t max)
+{
+  size_t n = 0;
+
+  if (s->gzip)
+    return read_gzip(s,buf,max);
+
+  while (n < max)
+  {
+    ssize_t len = produce(s,buf + n,max - n);
+
+    if (len == -2)
+      return -2;
+
+    if (len == -1)
+      break;
+
+    n += len;
+  }
+
+  return (n || s->phase != ARCHIVE_DONE) ? (ssize_t)n : -1;
+}
@@ -0,0 +1,34 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <sys/types.h>
+
+/*
+  ustar archive of the data files, produced on the fly for /archive.tar. Files are read
+  in ARCHIVE_BLOCK_SIZE blocks straight into the output, nothing is staged on the card.
+  With gzip the whole stream is deflated, the binary debug traces stored rather than
+  compressed since they do not shrink enough to be worth the CPU.
+*/
+
+#define ARCHIVE_BLOCK_SIZE 32768
+#define ARCHIVE_DIR_NAME "FastRunningFriend/"
+#define ARCHIVE_GZIP_LEVEL 1 /* most of the gain on CSV for a fraction of the CPU */
+
+typedef struct st_archive_stream Archive_stream;
+
+int archive_is_data_file(const char* name);
+/* the timestamp after the prefix of a data file name, 0 if it is not one */
+const char* archive_name_ts(const char* name);
+/* since is a file name timestamp, 0 for everything */
+Archive_stream* archive_open(const char* dir, const char* since, int gzip);
+/* a stream of chosen entries, added before archive_start() */
+Archive_stream* archive_new(const char* dir);
+int archive_add_file(Archive_stream* s, const char* name);
+/* data is malloc()ed and freed with the stream */
+int archive_add_data(Archive_stream* s, const char* name, char* data, uint size);
+int archive_start(Archive_stream* s, int gzip);
+/* same contract as MHD_ContentReaderCallback, -1 at the end and -2 on error */
+ssize_t archive_read(Archive_stream* s, char* buf, size_t max);
+void archive_close(Archive_stream* s);
+
+#endif
@@ -0,0 +1,70 @@
+#include "autolap.h"
+
+void autolap_reset(Autolap* a)
+{
+  a->t_prev = 0;
+  a->d_prev = 0.0;
+  a->have_prev = 0;
+  a->n_laps = 0;
+}
+
+void autolap_note(Autolap* a, unsigned long long ts, double d)
+{
+  a->t_prev = ts;
+  a->d_prev = d;
+  a->have_prev = 1;
+}
+
+int autolap_crossing(Autolap* a, double every_d, unsigned long long every_t,
+                     unsigned long long split_t, double split_d, unsigned long long ts,
+                     double d, unsigned long long* lap_t, double* lap_d)
+{
+  unsigned long long p_t = split_t, dt;
+  double p_d = split_d;
+  int found = 0;
+
+  // a split started after the previous sample is the better start of the interval
+  if (a->have_prev && a->t_prev > split_t)
+  {
+    p_t = a->t_prev;
+    p_d = a->d_prev;
+  }
+
+  if (ts <= p_t)
+    return 0;
+
+  dt = ts - p_t;
+
+  if (every_d > 0.0 && d > p_d && d >= split_d + every_d)
+  {
+    double d_b = split_d + every_d, f = (d_b - p_d) / (d - p_d);
+
+    if (f < 0.0)
+      f = 0.0;
+
+    *lap_t = p_t + (unsigned long long)(f * dt + 0.5);
+    *lap_d = d_b;
+    found = 1;
+  }
+
+  if (every_t && ts >= split_t + every_t)
+  {
+    unsigned long long t_b = split_t + every_t;
+
+    if (t_b < p_t)
+      t_b = p_t;
+
+    if (!found || t_b < *lap_t)
+    {
+      *lap_t = t_b;
+      *lap_d = p_d + (d - p_d) * (double)(t_b - p_t) / dt;
+      found = 1;
+    }
+  }
+
+  // never start a lap at or before the split it ends
+  if (found && *lap_t <= split_t)
+    *lap_t = split_t + 1;
+
+  return found;
+}
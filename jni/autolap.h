@@ -0,0 +1,33 @@
+#ifndef AUTOLAP_H
+#define AUTOLAP_H
+
+/*
+  Auto-lap boundaries over the cumulative distance stream. The caller hands in each new
+  (running time, distance) sample together with where the current split started, and
+  gets back the first lap boundary crossed since the previous sample. The crossing time
+  (or distance for time laps) is interpolated linearly between the two samples, so a lap
+  is not late by however long the fix took to come. Nothing is allocated, nothing waits.
+*/
+
+#define AUTOLAP_MAX_PER_SAMPLE 8 /* laps taken out of one sample, after a long signal gap */
+
+typedef struct
+{
+  unsigned long long t_prev; /* ms of running time */
+  double d_prev; /* miles */
+  int have_prev;
+  unsigned int n_laps;
+} Autolap;
+
+void autolap_reset(Autolap* a);
+/*
+  every_d in miles, every_t in ms, 0 turns either off. 1 and the lap start in lap_t and
+  lap_d if (ts,d) is past a boundary of the split that started at (split_t,split_d)
+*/
+int autolap_crossing(Autolap* a, double every_d, unsigned long long every_t,
+                     unsigned long long split_t, double split_d, unsigned long long ts,
+                     double d, unsigned long long* lap_t, double* lap_d);
+/* remember the sample as the start of the next interpolation interval */
+void autolap_note(Autolap* a, unsigned long long ts, double d);
+
+#endif
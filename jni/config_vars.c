@@ -2,14 +2,30 @@
 #include "utstring.h"
 #include "log.h"
 #include <jni.h>
+#include <string.h>
+#include <pthread.h>
 
-JNIEnv* jni_env = 0;
+static JNIEnv* jni_env = 0;
+static pthread_t jni_owner;
 jobject* jni_cfg = 0;
 
+/*
+  Readers copy the snapshot lock-free and retry if the sequence number was odd
+  (update in progress) or changed while they were copying. Writers are serialized
+  by snap_write_lock.
+*/
+static Config_snapshot config_snap;
+static volatile uint config_snap_seq = 0;
+static pthread_mutex_t snap_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void cfg_jni_init(JNIEnv* env, jobject* obj)
 {
   jni_env = env;
   jni_cfg = obj;
+  jni_owner = pthread_self();
+
+  if (config_snapshot_refresh(env,(jobject)obj))
+    LOGE("Error refreshing config snapshot on daemon start");
 }
 
 void cfg_jni_reset()
@@ -18,29 +34,109 @@ void cfg_jni_reset()
   jni_cfg = 0;
 }
 
-int get_config_var_str(const char* var_name, char* buf, size_t buf_size)
+JNIEnv* cfg_jni_env()
 {
-  UT_string* res = 0;
-  Config_var* cfg_v, *frb_pw_v;
-  HASH_FIND_STR(config_h,var_name,cfg_v);
+  if (!jni_env)
+    return 0;
 
-  if (!cfg_v)
+  if (!pthread_equal(jni_owner,pthread_self()))
   {
-    LOGE("Did not find '%s' variable object",var_name);
-    return 1;
+    LOGE("BUG: JNI environment requested outside of its owning thread");
+    return 0;
   }
 
-  if (!jni_env || !jni_cfg)
+  return jni_env;
+}
+
+static int read_snap_str(JNIEnv* env, jobject cfg_obj, Config_var* v, char* buf)
+{
+  jstring str_obj;
+  const char* s;
+
+  if (!(str_obj = (jstring)(*env)->GetObjectField(env,cfg_obj,v->var_id)))
   {
-    LOGE("JNI environment not intialized while fetching '%s'", var_name);
-    return 1;
+    *buf = 0;
+    return 0;
   }
 
-  if ((*cfg_v->printer)(jni_env,jni_cfg,cfg_v,buf,buf_size))
+  if (!(s = (*env)->GetStringUTFChars(env,str_obj,NULL)))
   {
-    LOGE("Error fetching value of variable '%s'", var_name);
+    LOGE("Could not get Java string for ConfigState.%s", v->name);
+    (*env)->DeleteLocalRef(env,str_obj);
+    return 1;
+  }
+
+  strncpy(buf,s,CONFIG_STR_SIZE - 1);
+  buf[CONFIG_STR_SIZE - 1] = 0;
+  (*env)->ReleaseStringUTFChars(env,str_obj,s);
+  (*env)->DeleteLocalRef(env,str_obj);
+  return 0;
+}
+
+int config_snapshot_refresh(JNIEnv* env, jobject cfg_obj)
+{
+  Config_snapshot tmp;
+  Config_var* v;
+
+  if (!env || !cfg_obj)
     return 1;
+
+  // do all the JNI work before entering the write window so readers do not spin on it
+  memset(&tmp,0,sizeof(tmp));
+
+  for (v = config_vars; v->name; v++)
+  {
+    char* dst = (char*)&tmp + v->snap_offset;
+
+    switch (v->kind)
+    {
+      case CFG_KIND_DOUBLE:
+      case CFG_KIND_ANGLE:
+      case CFG_KIND_PACE:
+        *(double*)dst = (*env)->GetDoubleField(env,cfg_obj,v->var_id);
+        break;
+      case CFG_KIND_LONG:
+        *(long long*)dst = (*env)->GetLongField(env,cfg_obj,v->var_id);
+        break;
+      case CFG_KIND_INT:
+        *(int*)dst = (*env)->GetIntField(env,cfg_obj,v->var_id);
+        break;
+      case CFG_KIND_STR:
+        if (read_snap_str(env,cfg_obj,v,dst))
+          return 1;
+        break;
+    }
   }
 
+  pthread_mutex_lock(&snap_write_lock);
+  config_snap_seq++;
+  __sync_synchronize();
+  memcpy(&config_snap,&tmp,sizeof(tmp));
+  __sync_synchronize();
+  config_snap_seq++;
+  pthread_mutex_unlock(&snap_write_lock);
   return 0;
-}
\ No newline at end of file
+}
+
+void config_snapshot_read(void* dst, size_t offset, size_t size)
+{
+  uint seq;
+
+  for (;;)
+  {
+    if ((seq = config_snap_seq) & 1)
+      continue;
+
+    __sync_synchronize();
+    memcpy(dst,(char*)&config_snap + offset,size);
+    __sync_synchronize();
+
+    if (seq == config_snap_seq)
+      break;
+  }
+}
+
+void config_snapshot_get(Config_snapshot* snap)
+{
+  config_snapshot_read(snap,0,sizeof(*snap));
+}
@@ -2,40 +2,60 @@
 #define CONFIG_VARS_H
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <sys/types.h>
 #include "utstring.h"
-#include "uthash.h"
 #include <jni.h>
 
 struct st_config_var;
 typedef struct st_config_var Config_var;
 
-typedef int (*Config_var_reader)(JNIEnv*,void*,Config_var*,const char*);
-typedef int (*Config_var_printer)(JNIEnv*,void*,Config_var*,char*,size_t);
 typedef enum {VAR_TYPE_NORMAL, VAR_TYPE_ANGLE, VAR_TYPE_PACE} Config_var_type;
+typedef enum {CFG_KIND_DOUBLE, CFG_KIND_ANGLE, CFG_KIND_PACE, CFG_KIND_INT, CFG_KIND_LONG,
+  CFG_KIND_STR} Config_var_kind;
+
+#define CONFIG_STR_SIZE 128
+
+/*
+  Config_snapshot, the CFG_VAR_* ids and the typed config_get_*() accessors are generated
+  from config_vars.spec by scripts/mk-config-vars.
+
+  The snapshot is the native copy of the ConfigState values. It is refreshed through JNI
+  on the thread that owns the ConfigState reference whenever the values change 
+  (read_config, config POST), and read by native consumers without touching JNI.
+*/
+#include "config_vars_gen.h"
+
+#define CONFIG_SNAP_OFFSET(name) offsetof(Config_snapshot,name)
 
 struct st_config_var
 {
   const char* name;
   const char* lookup_name;
   const char* java_type;
-  Config_var_printer printer;
-  Config_var_reader reader;
+  Config_var_kind kind;
+  size_t snap_offset;
+  uint name_len,lookup_name_len;
+  int is_pw;
 
-  // these fields are initialized in init_config_vars()
+  // these fields are initialized at run time
   jfieldID var_id;
   UT_string* post_val;
-  uint name_len,lookup_name_len;
-  int is_pw;
-  UT_hash_handle hh;
 } ;
 
 extern Config_var config_vars[];
-extern Config_var* config_h;
-extern JNIEnv* jni_env;
 extern jobject* jni_cfg;
 
+Config_var* config_var_lookup(const char* key, size_t len);
+int config_var_read(JNIEnv* env, jobject config_obj, Config_var* var, const char* val);
+int config_var_print(JNIEnv* env, jobject config_obj, Config_var* var, char* buf, size_t buf_size);
+
 jboolean write_config(JNIEnv* env, jobject this_obj, const char* profile_name_s);
-int get_config_var_str(const char* var_name, char* buf, size_t buf_size);
 void cfg_jni_init(JNIEnv* env, jobject* obj);
+void cfg_jni_reset();
+JNIEnv* cfg_jni_env();
+int config_snapshot_refresh(JNIEnv* env, jobject cfg_obj);
+void config_snapshot_get(Config_snapshot* snap);
+void config_snapshot_read(void* dst, size_t offset, size_t size);
 
 #endif
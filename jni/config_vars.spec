@@ -0,0 +1,50 @@
+# Configuration variable spec. scripts/mk-config-vars generates the native table,
+# the perfect hash lookup, the typed accessors and the Java ConfigVars fields from it.
+#
+# Format: name lookup_name type default
+#   lookup_name - name in the config file and the web form, '-' means same as name
+#   type        - double, angle (stored as cosine), pace (stored in ms), int, long, str
+#   default     - Java initializer, the rest of the line
+#
+min_d_last_trusted       -                   double  0.08
+max_d_last_trusted       -                   double  0.15
+max_pace_diff            -                   double  0.07
+top_pace_t               top_pace            pace    300000.0 /* 5:00 */
+start_pace_t             start_pace          pace    480000.0 /* 8:00 */
+expire_files_days        -                   int     7
+# timer and meta data older than this go into the workout pack instead of expiring, 0 - off
+archive_after_days       -                   int     14
+max_t_no_signal          -                   long    120000
+dist_update_interval     -                   long    500
+split_display_pause      -                   long    10000
+# start a split every this many miles or ms of running time, 0 - off
+auto_lap_dist            -                   double  0.0
+auto_lap_time            -                   long    0
+gps_update_interval      -                   long    1000
+min_cos                  max_angle           angle   Math.cos(10.0 * Math.PI/180.0)
+min_neighbor_cos         max_neighbor_angle  angle   Math.cos(5.0 * Math.PI/180.0)
+wifi_ssid                -                   str     ""
+wifi_key                 -                   str     ""
+frb_login                -                   str     ""
+frb_pw                   -                   str     ""
+gps_disconnect_interval  -                   long    0
+kill_bad_guys            -                   str     ""
+# 0 - angle and pace trust logic in GPSCoordBuffer.update_dist, 1 - native Kalman filter,
+# 2 - Kalman filter with the footpod bridging signal loss
+dist_engine              -                   int     0
+# GPS meters per footpod meter to start a run with, learned again during each run
+footpod_cal              -                   double  1.0
+# 1 - recompute split distances from the smoothed GPS track when a run is reset
+smooth_on_save           -                   int     1
+# SiRF UART reads return after this many bytes or this many tenths of a second of quiet
+sirf_vmin                -                   int     255
+sirf_vtime               -                   int     1
+# 1 - log SiRF reads per second, bytes per read and bytes per message ID every 10 seconds
+sirf_measure             -                   int     0
+# 1 - turn off the SiRF messages the app does not use, 0 - take the default set
+sirf_rate_control        -                   int     1
+# SiRF receiver device and pin files, empty - the MotoACTV ones in sirf_gps.h
+sirf_tty                 -                   str     ""
+sirf_standby             -                   str     ""
+sirf_reset               -                   str     ""
+sirf_sleep_file          -                   str     ""
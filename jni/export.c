@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "export.h"
+#include "track.h"
+#include "geodesy.h"
+#include "kalman.h"
+#include "log.h"
+
+typedef enum {EXPORT_HEADER,EXPORT_POINTS,EXPORT_FOOTER,EXPORT_DONE} Export_state;
+
+struct st_export_stream
+{
+  Export_format format;
+  Export_state state;
+  FILE* fp;
+  time_t t_start;
+  char workout[TRACK_TS_LEN+1];
+  Export_lap* laps;
+  uint n_laps,cur_lap;
+  int lap_open,seg_open;
+  unsigned char* keep; /* Douglas-Peucker result, 0 if not simplifying */
+  uint n_points,point;
+  int have_point;
+  double lat,lon;
+  long long ts;
+  char out[EXPORT_BUF_SIZE];
+  uint out_len,out_pos;
+};
+
+const char* export_mime(Export_format format)
+{
+  return format == EXPORT_TCX ? "application/vnd.garmin.tcx+xml" : "application/gpx+xml";
+}
+
+const char* export_ext(Export_format format)
+{
+  return format == EXPORT_TCX ? "tcx" : "gpx";
+}
+
+static int load_laps(Export_stream* s, const char* dir)
+{
+  Run_timer w;
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+  uint leg = 0, i = 0;
+  int res = 1;
+
+  bzero(&w,sizeof(w));
+
+  if (run_timer_init_from_workout(&w,dir,s->workout,0))
+    goto err;
+
+  if (!w.num_splits)
+  {
+    res = 0;
+    goto err;
+  }
+
+  if (!(s->laps = (Export_lap*)malloc(w.num_splits * sizeof(Export_lap))))
+    goto err;
+
+  LL_FOREACH(w.first_leg,cur_leg)
+  {
+    LL_FOREACH(cur_leg->first_split,cur_split)
+    {
+      Run_split* next = cur_split->next;
+
+      if (!next && cur_leg->next)
+        next = cur_leg->next->first_split;
+
+      // the end marker is not a lap
+      if (!next)
+        continue;
+
+      s->laps[i].t = cur_split->t;
+      s->laps[i].d_t = next->t - cur_split->t;
+      s->laps[i].d_d = next->d - cur_split->d;
+      s->laps[i].leg = leg;
+      i++;
+    }
+
+    leg++;
+  }
+
+  s->n_laps = i;
+  res = 0;
+err:
+  run_timer_deinit(&w);
+  return res;
+}
+
+static int simplify(Export_stream* s, const char* fname, double tol)
+{
+  Track tr;
+  Geo_frame f;
+  float* x = 0,*y = 0;
+  uint* stack = 0;
+  int res = 1;
+
+  track_init(&tr);
+
+  if (track_load(&tr,fname))
+    goto err;
+
+  s->n_points = tr.n;
+
+  if (!tr.n)
+  {
+    res = 0;
+    goto err;
+  }
+
+  x = (float*)malloc(tr.n * sizeof(float));
+  y = (float*)malloc(tr.n * sizeof(float));
+  stack = (uint*)malloc(2 * tr.n * sizeof(uint));
+  s->keep = (unsigned char*)malloc(tr.n);
+
+  if (!x || !y || !stack || !s->keep)
+  {
+    LOGE("OOM simplifying %s", fname);
+    goto err;
+  }
+
+  geo_frame_init(&f,tr.lat[0],tr.lon[0]);
+  geo_project(&f,tr.lat,tr.lon,x,y,tr.n);
+  LOGI("Simplified %s from %u to %u points", fname, tr.n,
+       geo_simplify(x,y,tr.n,tol,s->keep,stack));
+  res = 0;
+err:
+  free(x);
+  free(y);
+  free(stack);
+  track_free(&tr);
+  return res;
+}
+
+Export_stream* export_open(const char* dir, const char* workout, Export_format format,
+                           double simplify_tol)
+{
+  Export_stream* s;
+  char fname[PATH_MAX+1];
+
+  if (strlen(workout) != TRACK_TS_LEN)
+    return 0;
+
+  if (!(s = (Export_stream*)calloc(1,sizeof(*s))))
+    return 0;
+
+  s->format = format;
+  memcpy(s->workout,workout,TRACK_TS_LEN + 1);
+
+  if (track_parse_ts(workout,&s->t_start) ||
+      track_find_gps_file(dir,workout,fname,sizeof(fname)))
+    goto err;
+
+  if (load_laps(s,dir))
+    goto err;
+
+  // TCX needs at least one lap
+  if (format == EXPORT_TCX && !s->n_laps)
+    goto err;
+
+  if (simplify_tol > 0.0)
+  {
+    if (simplify_tol > EXPORT_MAX_SIMPLIFY)
+      simplify_tol = EXPORT_MAX_SIMPLIFY;
+
+    if (simplify(s,fname,simplify_tol))
+      goto err;
+  }
+
+  if (!(s->fp = fopen(fname,"r")))
+    goto err;
+
+  return s;
+err:
+  export_close(s);
+  return 0;
+}
+
+void export_close(Export_stream* s)
+{
+  if (!s)
+    return;
+
+  if (s->fp)
+    fclose(s->fp);
+
+  free(s->laps);
+  free(s->keep);
+  free(s);
+}
+
+static uint print_iso_time(char* buf, uint buf_size, Export_stream* s, long long ts)
+{
+  time_t t = s->t_start + (time_t)(ts / 1000);
+  struct tm tm;
+  uint len;
+
+  if (!gmtime_r(&t,&tm) || !(len = strftime(buf,buf_size,"%Y-%m-%dT%H:%M:%S",&tm)))
+    return 0;
+
+  return len + snprintf(buf + len,buf_size - len,".%03dZ",(int)(ts % 1000));
+}
+
+#define OUT_PRINTF(...) s->out_len += snprintf(s->out + s->out_len, \
+  sizeof(s->out) - s->out_len, __VA_ARGS__)
+
+/* text content or attribute value, truncated rather than overflowing the buffer */
+static void print_xml_escaped(Export_stream* s, const char* str)
+{
+  for (; *str && s->out_len + 6 < sizeof(s->out); str++)
+  {
+    switch (*str)
+    {
+      case '<':
+        OUT_PRINTF("&lt;");
+        break;
+      case '>':
+        OUT_PRINTF("&gt;");
+        break;
+      case '&':
+        OUT_PRINTF("&amp;");
+        break;
+      case '"':
+        OUT_PRINTF("&quot;");
+        break;
+      case '\'':
+        OUT_PRINTF("&apos;");
+        break;
+      default:
+        s->out[s->out_len++] = *str;
+        s->out[s->out_len] = 0;
+        break;
+    }
+  }
+}
+
+static void print_lap_start(Export_stream* s)
+{
+  Export_lap* l = s->laps + s->cur_lap;
+  char ts[32];
+
+  if (s->format == EXPORT_TCX)
+  {
+    print_iso_time(ts,sizeof(ts),s,l->t);
+    OUT_PRINTF("<Lap StartTime=\"%s\"><TotalTimeSeconds>%.1f</TotalTimeSeconds>"
+               "<DistanceMeters>%.1f</DistanceMeters><Calories>0</Calories>"
+               "<Intensity>Active</Intensity>"
+               "<TriggerMethod>Manual</TriggerMethod>\n", ts, l->d_t / 1000.0,
+               l->d_d * METERS_PER_MILE);
+  }
+
+  s->lap_open = 1;
+}
+
+static void print_lap_end(Export_stream* s)
+{
+  if (s->format == EXPORT_TCX)
+  {
+    if (s->seg_open)
+      OUT_PRINTF("</Track>");
+
+    OUT_PRINTF("</Lap>\n");
+    s->seg_open = 0;
+  }
+  else if (s->seg_open && (s->cur_lap + 1 >= s->n_laps ||
+                           s->laps[s->cur_lap + 1].leg != s->laps[s->cur_lap].leg))
+  {
+    OUT_PRINTF("</trkseg>\n");
+    s->seg_open = 0;
+  }
+
+  s->lap_open = 0;
+}
+
+static void print_point(Export_stream* s)
+{
+  char ts[32];
+
+  print_iso_time(ts,sizeof(ts),s,s->ts);
+
+  if (s->format == EXPORT_TCX)
+  {
+    if (!s->seg_open)
+      OUT_PRINTF("<Track>\n");
+
+    OUT_PRINTF("<Trackpoint><Time>%s</Time><Position><LatitudeDegrees>%.7f</LatitudeDegrees>"
+               "<LongitudeDegrees>%.7f</LongitudeDegrees></Position></Trackpoint>\n",
+               ts, s->lat, s->lon);
+  }
+  else
+  {
+    if (!s->seg_open)
+      OUT_PRINTF("<trkseg>\n");
+
+    OUT_PRINTF("<trkpt lat=\"%.7f\" lon=\"%.7f\"><time>%s</time></trkpt>\n",
+               s->lat, s->lon, ts);
+  }
+
+  s->seg_open = 1;
+}
+
+static int read_point(Export_stream* s)
+{
+  char line[TRACK_MAX_LINE];
+
+  while (fgets(line,sizeof(line),s->fp))
+  {
+    double bearing,accuracy,speed;
+
+    if (track_parse_line(line,&s->lat,&s->lon,&s->ts,&bearing,&accuracy,&speed))
+      continue;
+
+    // the file may have grown since it was simplified, keep whatever is new
+    if (s->keep && s->point < s->n_points && !s->keep[s->point++])
+      continue;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/* one element or lap transition into s->out */
+static void next_chunk(Export_stream* s)
+{
+  s->out_len = s->out_pos = 0;
+
+  switch (s->state)
+  {
+    case EXPORT_HEADER:
+      OUT_PRINTF("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+
+      if (s->format == EXPORT_TCX)
+      {
+        char ts[32];
+        print_iso_time(ts,sizeof(ts),s,0);
+        OUT_PRINTF("<TrainingCenterDatabase "
+                   "xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\">\n"
+                   "<Activities><Activity Sport=\"Running\"><Id>%s</Id>\n", ts);
+      }
+      else
+      {
+        OUT_PRINTF("<gpx version=\"1.1\" creator=\"FastRunningFriend\" "
+                   "xmlns=\"http://www.topografix.com/GPX/1/1\">\n<trk><name>");
+        print_xml_escaped(s,s->workout);
+        OUT_PRINTF("</name>\n");
+      }
+
+      if (s->n_laps)
+        print_lap_start(s);
+
+      s->state = EXPORT_POINTS;
+      break;
+    case EXPORT_POINTS:
+      if (!s->have_point && !(s->have_point = read_point(s)))
+      {
+        s->state = EXPORT_FOOTER;
+        break;
+      }
+
+      if (s->cur_lap + 1 < s->n_laps && s->ts >= (long long)s->laps[s->cur_lap + 1].t)
+      {
+        print_lap_end(s);
+        s->cur_lap++;
+        print_lap_start(s);
+        break;
+      }
+
+      print_point(s);
+      s->have_point = 0;
+      break;
+    case EXPORT_FOOTER:
+      // laps the GPS never got to still belong in the file
+      if (s->lap_open)
+      {
+        print_lap_end(s);
+
+        if (s->cur_lap + 1 < s->n_laps)
+        {
+          s->cur_lap++;
+          print_lap_start(s);
+        }
+
+        break;
+      }
+
+      if (s->seg_open)
+        OUT_PRINTF("</trkseg>\n");
+
+      if (s->format == EXPORT_TCX)
+        OUT_PRINTF("</Activity></Activities></TrainingCenterDatabase>\n");
+      else
+        OUT_PRINTF("</trk>\n</gpx>\n");
+
+      s->state = EXPORT_DONE;
+      break;
+    case EXPORT_DONE:
+      break;
+  }
+
+  if (s->out_len > sizeof(s->out))
+  {
+    LOGE("BUG: export chunk truncated");
+    s->out_len = sizeof(s->out);
+  }
+}
+
+#undef OUT_PRINTF
+
+ssize_t export_read(Export_stream* s, char* buf, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max)
+  {
+    size_t len;
+
+    if (s->out_pos == s->out_len)
+    {
+      if (s->state == EXPORT_DONE)
+        break;
+
+      next_chunk(s);
+      continue;
+    }
+
+    len = s->out_len - s->out_pos;
+
+    if (len > max - n)
+      len = max - n;
+
+    memcpy(buf + n,s->out + s->out_pos,len);
+    s->out_pos += len;
+    n += len;
+  }
+
+  if (!n && s->state == EXPORT_DONE)
+    return -1;
+
+  return n;
+}
@@ -0,0 +1,37 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <stdio.h>
+#include "timer.h"
+
+/*
+  GPX and TCX encoders for a workout. The GPS file is read one line at a time and the XML
+  produced one element at a time into a small buffer, so memory does not grow with the
+  length of the run. The splits become TCX laps, the legs GPX track segments.
+*/
+
+typedef enum {EXPORT_GPX,EXPORT_TCX} Export_format;
+
+typedef struct
+{
+  ulonglong t,d_t;
+  double d_d; /* miles */
+  uint leg;
+} Export_lap;
+
+typedef struct st_export_stream Export_stream;
+
+#define EXPORT_BUF_SIZE 512
+#define EXPORT_MAX_SIMPLIFY 100.0 /* m */
+
+Export_stream* export_open(const char* dir, const char* workout, Export_format format,
+                           double simplify_tol);
+/* same contract as MHD_ContentReaderCallback, -1 at the end and -2 on error */
+ssize_t export_read(Export_stream* s, char* buf, size_t max);
+void export_close(Export_stream* s);
+const char* export_mime(Export_format format);
+const char* export_ext(Export_format format);
+
+#endif
@@ -14,6 +14,9 @@
 #include <math.h>
 #include <ctype.h>
 #include <linux/android_alarm.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include "uthash.h"
 #include "utstring.h"
 #include "config_vars.h"
@@ -21,12 +24,25 @@
 #include "log.h"
 #include "timer_jni.h"
 #include "sirf_gps.h"
-
-static FILE* gps_data_fp = 0, *gps_debug_fp = 0;
+#include "trace.h"
+#include "metrics.h"
+#include "kalman.h"
+#include "geodesy.h"
+#include "track.h"
+#include "timer.h"
+#include "purge.h"
+#include "sync.h"
+#include "fusion.h"
+#include "fix_queue.h"
+#include "live.h"
+
+static FILE* gps_data_fp = 0;
 static char gps_data_dir[PATH_MAX+1];
 static unsigned int gps_data_dir_len = 0;
+static char gps_data_ts[TRACK_TS_LEN+1];
 
 #define FNAME_EXTRA_SPACE 32
+#define MAX_CONFIG_FILE_SIZE 8192
 
 typedef struct 
 {
@@ -35,10 +51,14 @@ typedef struct
   jfieldID lon_id,lat_id,dist_to_prev_id,speed_id,
     bearing_id,accuracy_id,ts_id;
   jfieldID buf_end_id,flush_ind_id;  
-  jfieldID expire_files_days_id;
+  jfieldID expire_files_days_id,archive_after_days_id;
 } GPS_buf_fields;
 
 static GPS_buf_fields gps_buf_fields;
+static Kalman_filter kf;
+static Fusion fusion;
+static Fix_writer gps_writer;
+static FILE* pod_data_fp = 0;
 static jclass cfg_class;
 static jfieldID data_dir_id;
 
@@ -49,7 +69,6 @@ Run_info_fields run_info_fields;
 
 static int init_gps_buf_fields(JNIEnv* env, GPS_buf_fields* fields);
 static int remove_expired_files(JNIEnv* env, jobject* this_obj, const char* dir_name);
-static int has_ext(const char* fname, const char* ext);
 static int get_config_path(JNIEnv* env, jobject* cfg_obj, char* path, int max_path, char* fmt, ...);
 
 
@@ -85,33 +104,10 @@ static int print_config_double_low(JNIEnv* env,void* config_obj,Config_var* var,
 static int init_config_vars(JNIEnv *env);
 static int init_run_info_fields(JNIEnv* env, Run_info_fields* ri_fields);
 static int start_config_daemon();
+static jclass find_class_global(JNIEnv* env, const char* name);
 
 
 
-Config_var config_vars[] =
-{
-  {"min_d_last_trusted", 0, "D", print_config_double, read_config_double},
-  {"max_d_last_trusted", 0, "D", print_config_double, read_config_double},
-  {"max_pace_diff", 0, "D", print_config_double, read_config_double},
-  {"top_pace_t", "top_pace", "D", print_config_pace, read_config_pace},
-  {"start_pace_t", "start_pace", "D", print_config_pace, read_config_pace},
-  {"expire_files_days", 0, "I",  print_config_int, read_config_int},
-  {"max_t_no_signal", 0, "J", print_config_long, read_config_long},
-  {"dist_update_interval", 0, "J", print_config_long, read_config_long},
-  {"split_display_pause", 0, "J", print_config_long, read_config_long},
-  {"gps_update_interval", 0, "J", print_config_long, read_config_long},
-  {"min_cos", "max_angle", "D", print_config_angle, read_config_angle},
-  {"min_neighbor_cos", "max_neighbor_angle", "D", print_config_angle, read_config_angle},
-  {"wifi_ssid", 0, "Ljava/lang/String;", print_config_str, read_config_str},
-  {"wifi_key", 0, "Ljava/lang/String;", print_config_str, read_config_str},
-  {"frb_login", 0, "Ljava/lang/String;", print_config_str, read_config_str},
-  {"frb_pw", 0, "Ljava/lang/String;", print_config_str, read_config_str},
-  {"gps_disconnect_interval", 0, "J", print_config_long, read_config_long},
-  {"kill_bad_guys", 0, "Ljava/lang/String;", print_config_str, read_config_str},
-  {0,0,0}
-};   
-
-Config_var* config_h = 0;
 
 jint JNI_OnLoad(JavaVM* vm, void* reserved)
 {
@@ -146,6 +142,22 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
   return JNI_VERSION_1_4;
 }
 
+/* 
+  Class references returned by FindClass() are local and become invalid once JNI_OnLoad()
+  returns, so everything we cache across calls and threads is promoted to a global reference.
+*/
+static jclass find_class_global(JNIEnv* env, const char* name)
+{
+  jclass local_cls, global_cls;
+
+  if (!(local_cls = (*env)->FindClass(env,name)))
+    return 0;
+
+  global_cls = (jclass)(*env)->NewGlobalRef(env,local_cls);
+  (*env)->DeleteLocalRef(env,local_cls);
+  return global_cls;
+}
+
 #define GET_RUN_INFO_FIELD(name,type) if (!(fields->name## _id = (*env)->GetFieldID(env,\
    fields->info_class,#name,type))) \
    {\
@@ -156,7 +168,7 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
 
 static int init_run_info_fields(JNIEnv* env, Run_info_fields* fields)
 {
-  if (!(fields->info_class = (*env)->FindClass(env,RUN_INFO_CLASS)))
+  if (!(fields->info_class = find_class_global(env,RUN_INFO_CLASS)))
   {  
     LOGE("Did not find RunInfo class");
     return 1;
@@ -197,27 +209,15 @@ static int init_config_vars(JNIEnv *env)
 {
   Config_var *v;
   
+  // the table and its lookup are generated from config_vars.spec, only the field IDs
+  // need to be resolved at run time
   for (v = config_vars; v->name; v++)
   {
-    if (!v->lookup_name)
-      v->lookup_name = v->name;
-
-    v->name_len = strlen(v->name);
-    v->lookup_name_len = strlen(v->lookup_name);
-    v->is_pw = 0;
-
-    if (v->lookup_name_len > 3 && !memcmp(v->lookup_name + v->lookup_name_len - 3,"_pw",3))
-    {
-      v->is_pw = 1;
-    }
-
     if (!(v->var_id = (*env)->GetFieldID(env,cfg_class,v->name,v->java_type)))
     {
       LOGE("Cannot find ConfigState.%s member", v->name);
       return -1;
     }
-    
-    HASH_ADD_KEYPTR(hh,config_h,v->lookup_name,strlen(v->lookup_name),v);
   }
   
   return 0;
@@ -225,7 +225,7 @@ static int init_config_vars(JNIEnv *env)
 
 static int init_gps_buf_fields(JNIEnv* env, GPS_buf_fields* fields )
 {
-  if (!(fields->the_class = (*env)->FindClass(env,COORD_BUF_CLASS)))
+  if (!(fields->the_class = find_class_global(env,COORD_BUF_CLASS)))
   {  
     LOGE("Did not find GPSCoordBuffer class");
     return 1;
@@ -237,7 +237,7 @@ static int init_gps_buf_fields(JNIEnv* env, GPS_buf_fields* fields )
   GET_BUF_FIELD(cfg,"L"CFG_CLASS";");
   
   
-  if (!(fields->coord_class = (*env)->FindClass(env,COORD_CLASS)))
+  if (!(fields->coord_class = find_class_global(env,COORD_CLASS)))
   {
     LOGE("Could not find GPSCoord class");
     return 1;
@@ -253,13 +253,14 @@ static int init_gps_buf_fields(JNIEnv* env, GPS_buf_fields* fields )
   GET_COORD_FIELD(bearing,"F");
   GET_COORD_FIELD(ts,"J");
   
-  if (!(fields->cfg_class = (*env)->FindClass(env,CFG_CLASS)))
+  if (!(fields->cfg_class = find_class_global(env,CFG_CLASS)))
   {
     LOGE("Could not find StateConfig class");
     return 1;
   }
   
   GET_CFG_FIELD(expire_files_days,"I");
+  GET_CFG_FIELD(archive_after_days,"I");
   return 0;
 }
 
@@ -287,6 +288,48 @@ static int init_gps_buf_fields(JNIEnv* env, GPS_buf_fields* fields )
 #define SET_BUF_MEMBER(name,type)  (*env)->Set##type##Field(env,this_obj, \
   gps_buf_fields.name ## _id,name)
 
+int config_var_print(JNIEnv* env, jobject config_obj, Config_var* var, char* buf, size_t buf_size)
+{
+  switch (var->kind)
+  {
+    case CFG_KIND_DOUBLE:
+      return print_config_double(env,config_obj,var,buf,buf_size);
+    case CFG_KIND_ANGLE:
+      return print_config_angle(env,config_obj,var,buf,buf_size);
+    case CFG_KIND_PACE:
+      return print_config_pace(env,config_obj,var,buf,buf_size);
+    case CFG_KIND_INT:
+      return print_config_int(env,config_obj,var,buf,buf_size);
+    case CFG_KIND_LONG:
+      return print_config_long(env,config_obj,var,buf,buf_size);
+    case CFG_KIND_STR:
+      return print_config_str(env,config_obj,var,buf,buf_size);
+  }
+
+  return -1;
+}
+
+int config_var_read(JNIEnv* env, jobject config_obj, Config_var* var, const char* val)
+{
+  switch (var->kind)
+  {
+    case CFG_KIND_DOUBLE:
+      return read_config_double(env,config_obj,var,val);
+    case CFG_KIND_ANGLE:
+      return read_config_angle(env,config_obj,var,val);
+    case CFG_KIND_PACE:
+      return read_config_pace(env,config_obj,var,val);
+    case CFG_KIND_INT:
+      return read_config_int(env,config_obj,var,val);
+    case CFG_KIND_LONG:
+      return read_config_long(env,config_obj,var,val);
+    case CFG_KIND_STR:
+      return read_config_str(env,config_obj,var,val);
+  }
+
+  return -1;
+}
+
 static int print_config_double(JNIEnv* env,void* config_obj,Config_var* var,char* buf,size_t buf_size )
 {
   return print_config_double_low(env,config_obj,var,buf,buf_size,VAR_TYPE_NORMAL);
@@ -470,6 +513,7 @@ static jboolean flush_gps_buffer(JNIEnv* env, jobject this_obj)
   jint buf_end,flush_ind;
   jobject cur_coord;
   jsize buf_len;
+  jboolean res = 1;
   
   if (!gps_data_fp)
   {
@@ -481,51 +525,47 @@ static jboolean flush_gps_buffer(JNIEnv* env, jobject this_obj)
   GET_BUF_MEMBER_NO_CHECK(buf_end,Int);
   GET_BUF_MEMBER_NO_CHECK(flush_ind,Int);
   
+  // nothing new is not a failure
   if (buf_end == flush_ind)
-    return 0;
+    return 1;
   
   buf_len = (*env)->GetArrayLength(env,buf);
   
+  // the writer thread does the formatting and waits for the card, not the UI thread
   for (; flush_ind != buf_end;)
   {
-    jobject coord = (*env)->GetObjectArrayElement(env,buf,flush_ind);
+    jint ind = flush_ind;
+    jobject coord = (*env)->GetObjectArrayElement(env,buf,ind);
+    Fix fix;
+    
+    if (++flush_ind == buf_len)
+      flush_ind = 0;
     
     if (!coord)
     {
-       LOGE("Coordinate object at index %d is NULL, wonder how that happened", flush_ind);
+       LOGE_RL(5000,"Coordinate object at index %d is NULL, wonder how that happened", ind);
+       res = 0;
        continue;
     }
     
-    fprintf(gps_data_fp,"%f,%f,%ld,%f,%f,%f,%f\n",
-            GET_COORD_MEMBER(lat,Double),
-            GET_COORD_MEMBER(lon,Double),
-            GET_COORD_MEMBER(ts,Long),
-            GET_COORD_MEMBER(dist_to_prev,Double),
-            GET_COORD_MEMBER(bearing,Float),
-            GET_COORD_MEMBER(accuracy,Float),
-            GET_COORD_MEMBER(speed,Float)
-            );
-   fflush(gps_data_fp);
-   
-   if (++flush_ind == buf_len)
-    flush_ind = 0;
-   
-   (*env)->DeleteLocalRef(env,coord);
+    fix.lat = GET_COORD_MEMBER(lat,Double);
+    fix.lon = GET_COORD_MEMBER(lon,Double);
+    fix.ts = GET_COORD_MEMBER(ts,Long);
+    fix.dist_to_prev = GET_COORD_MEMBER(dist_to_prev,Double);
+    fix.bearing = GET_COORD_MEMBER(bearing,Float);
+    fix.accuracy = GET_COORD_MEMBER(accuracy,Float);
+    fix.speed = GET_COORD_MEMBER(speed,Float);
+    
+    if (fix_writer_push(&gps_writer,&fix))
+      res = 0;
+    
+    live_note_fix(&fix);
+    (*env)->DeleteLocalRef(env,coord);
   }
   
   SET_BUF_MEMBER(flush_ind,Int);
   (*env)->DeleteLocalRef(env,buf);
-  return 1;
-}
-
-static int has_ext(const char* fname, const char* ext)
-{
-  const char*p = strrchr(fname,'.');
-  
-  if (!p || strcmp(p + 1,ext))
-    return 0;
-  
-  return 1;
+  return res;
 }
 
 static int get_config_path(JNIEnv* env, jobject* cfg_obj, char* path, int max_path, char* fmt, ...)
@@ -577,47 +617,14 @@ err:
 static int remove_expired_files(JNIEnv* env, jobject* this_obj, const char* dir_name)
 {
   jobject cfg;
-  jint expire_files_days;
-  DIR* dir_p;
-  struct dirent* dir_e;
-  time_t now;
+  jint expire_files_days,archive_after_days;
   
   GET_BUF_MEMBER(cfg,Object);
   GET_CFG_MEMBER_NO_CHECK(expire_files_days,Int);
-
-  time(&now);
-  
-  if (!(dir_p = opendir(dir_name)))
-  {
-    LOGE("opendir() failed while removing expired files");
-    return 1;
-  }
-  
-  while ((dir_e = readdir(dir_p)))
-  {
-    struct stat s;
-    char fname[PATH_MAX+1];
-    
-    if (has_ext(dir_e->d_name,"cnf"))
-      continue;
-    
-    snprintf(fname,sizeof(fname),"%s/%s",dir_name,dir_e->d_name);
-    
-    if (stat(fname,&s))
-    {
-      LOGE("Error reading %s entry during expired file purge", fname);
-      continue;
-    }
-    
-    if ((s.st_mode & S_IFMT) == S_IFREG && now - s.st_mtime > expire_files_days * 86400)
-    {
-      if (unlink(fname))
-        LOGE("Could not remove %s", fname);
-    }
-  }
+  GET_CFG_MEMBER_NO_CHECK(archive_after_days,Int);
   
-  closedir(dir_p);
-  return 0;
+  // the card can take seconds to stat a season of runs, do not make startup wait for it
+  return purge_start(dir_name,expire_files_days,archive_after_days);
 }
 
 JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_FastRunningFriend_set_1system_1time
@@ -647,7 +654,97 @@ JNIEXPORT jboolean
 Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_flush(JNIEnv* env,
                     jobject this_obj)
 {
-  return flush_gps_buffer(env,this_obj);
+  unsigned long long start_us = metrics_now_us();
+  jboolean res = flush_gps_buffer(env,this_obj);
+  
+  metric_record(METRIC_FLUSH_GPS_BUFFER,start_us,!res);
+  return res;
+}
+
+typedef struct
+{
+  char dir[PATH_MAX+1];
+  char gps_ts[TRACK_TS_LEN+1];
+  int smooth;
+} Finish_job;
+
+/* one finished workout at a time, runs are far apart but a reset can follow a reset */
+static pthread_mutex_t finish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void finish_workout(Finish_job* job)
+{
+  char workout[TRACK_TS_LEN+1];
+  size_t len = strlen(job->dir);
+  
+  if (track_find_workout(job->dir,job->gps_ts,workout))
+  {
+    LOGW("No workout found for GPS track %s", job->gps_ts);
+    return;
+  }
+  
+  if (len && job->dir[len-1] != '/')
+    strcat(job->dir,"/");
+  
+  // saving the smoothed workout records the change for sync by itself
+  if (job->smooth)
+  {
+    if (!run_timer_smooth_workout(job->dir,job->dir,workout))
+      return;
+
+    LOGW("Could not recompute distances of workout %s", workout);
+  }
+  
+  sync_note_change(job->dir,workout);
+}
+
+static void* finish_thread(void* arg)
+{
+  Finish_job* job = (Finish_job*)arg;
+  
+  // reading and rewriting the whole run waits on the card, stay out of the UI's way
+  if (setpriority(PRIO_PROCESS,syscall(__NR_gettid),PURGE_NICE))
+    LOGE("Could not lower workout finish thread priority (%d)", errno);
+  
+  pthread_mutex_lock(&finish_lock);
+  finish_workout(job);
+  pthread_mutex_unlock(&finish_lock);
+  free(job);
+  return 0;
+}
+
+/* the timer has already been reset and its file closed when we get here */
+static void finish_last_workout()
+{
+  Finish_job* job;
+  pthread_t thread;
+  pthread_attr_t attr;
+  
+  if (gps_data_dir_len + 2 > sizeof(job->dir))
+    return;
+  
+  if (!(job = (Finish_job*)malloc(sizeof(*job))))
+  {
+    LOGE("OOM finishing workout of GPS track %s", gps_data_ts);
+    return;
+  }
+  
+  memcpy(job->dir,gps_data_dir,gps_data_dir_len);
+  job->dir[gps_data_dir_len] = 0;
+  memcpy(job->gps_ts,gps_data_ts,sizeof(job->gps_ts));
+  job->smooth = config_get_smooth_on_save();
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+  
+  if (pthread_create(&thread,&attr,finish_thread,job))
+  {
+    LOGE("Could not start workout finish thread, finishing %s here", gps_data_ts);
+    pthread_mutex_lock(&finish_lock);
+    finish_workout(job);
+    pthread_mutex_unlock(&finish_lock);
+    free(job);
+  }
+  
+  pthread_attr_destroy(&attr);
 }
 
 JNIEXPORT jboolean
@@ -658,16 +755,26 @@ Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_close_1data_1file(JNIE
   
   if (gps_data_fp)
   {
+    fix_writer_stop(&gps_writer);
     res = (fclose(gps_data_fp) == 0);
     gps_data_fp = 0;
+    
+    if (pod_data_fp)
+    {
+      fclose(pod_data_fp);
+      pod_data_fp = 0;
+    }
+    
+    if (*gps_data_ts)
+      finish_last_workout();
+    
+    *gps_data_ts = 0;
   }
   
-  if (gps_debug_fp)
-  {
-    res |= (fclose(gps_debug_fp) == 0);
-    gps_debug_fp = 0;
-  }
+  if (trace_active())
+    res |= (trace_close() == 0);
   
+  log_ring_stop();
   return res;
 }
 
@@ -699,21 +806,34 @@ Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_open_1data_1file(JNIEn
   if (!(lt = localtime(&t)))
     return 0;
   
-  if (!strftime(p, p_end - p, "gps_data_%Y_%m_%d-%H_%M_%S.csv", lt))
+  if (!strftime(p, p_end - p, GPS_DATA_PREFIX TRACK_TS_FMT "." GPS_DATA_EXT, lt))
     return 0;
   
   if (!(gps_data_fp = fopen(fname,"w")))
     return 0;
   
+  if (fix_writer_start(&gps_writer,gps_data_fp))
+  {
+    fclose(gps_data_fp);
+    gps_data_fp = 0;
+    return 0;
+  }
+  
+  strftime(gps_data_ts, sizeof(gps_data_ts), TRACK_TS_FMT, lt);
+  metrics_reset();
+  
   // reuse fname
-  if (strftime(p, p_end - p, "gps_debug_%Y_%m_%d-%H_%M_%S.log", lt))
+  if (strftime(p, p_end - p, TRACE_FILE_PREFIX TRACK_TS_FMT ".trc", lt))
   {  
-    if (!(gps_debug_fp = fopen(fname,"w")))
+    if (trace_open(fname))
     {
-      LOGE("Could not open debug log %s", fname);
+      LOGE("Could not open debug trace %s", fname);
     }
   }
   
+  if (strftime(p, p_end - p, LOG_FILE_PREFIX TRACK_TS_FMT ".log", lt))
+    log_ring_start(fname);
+  
   return 1;
 }
 
@@ -721,7 +841,7 @@ JNIEXPORT jboolean
 Java_com_fastrunningblog_FastRunningFriend_ConfigState_run_1daemon(JNIEnv* env,
                                                   jobject this_obj)
 {
-  LOGE("Starting config daemon");
+  LOGI("Starting config daemon");
   
   if (http_run_daemon(env,this_obj))
   {
@@ -735,7 +855,7 @@ JNIEXPORT jboolean
 Java_com_fastrunningblog_FastRunningFriend_ConfigState_stop_1daemon(JNIEnv* env,
                                                   jobject this_obj)
 {
-  LOGE("stopping HTTPD daemon");
+  LOGI("Stopping HTTPD daemon");
   http_stop_daemon();
   return 1;
 }
@@ -812,25 +932,146 @@ JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer
   if (!msg_s)
     return;
   
-  if (gps_debug_fp)
-  {
-    time_t now;
-    char time_buf[64];
-    struct tm *now_tm;
-    time(&now);
-    
-    if (!(now_tm = localtime(&now)) || !strftime(time_buf,sizeof(time_buf),"%x %X",now_tm))
-     strncpy(time_buf, "Unknown time", sizeof(time_buf));
-    
-    fprintf(gps_debug_fp,"[%s] %s\n", time_buf,msg_s);
-    fflush(gps_debug_fp);
-  }
+  if (trace_active())
+    trace_msg(msg_s);
   else
-    LOGE(msg_s);
+    LOGI("%s", msg_s);
   
   (*env)->ReleaseStringUTFChars(env,msg,msg_s);
 }
 
+JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_trace
+  (JNIEnv *env, jobject this_obj, jint id, jint i0, jint i1, jint i2, jdouble d0, jdouble d1,
+   jdouble d2)
+{
+  trace_event(id,i0,i1,i2,d0,d1,d2);
+}
+
+JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_kf_1reset
+  (JNIEnv *env, jobject this_obj)
+{
+  kalman_reset(&kf);
+}
+
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_kf_1push
+  (JNIEnv *env, jobject this_obj, jdouble lat, jdouble lon, jlong ts, jfloat accuracy,
+   jfloat speed, jfloat bearing)
+{
+  return kalman_push(&kf,lat,lon,ts,accuracy,speed,bearing);
+}
+
+JNIEXPORT jint JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_kf_1conf
+  (JNIEnv *env, jobject this_obj)
+{
+  return kf.conf;
+}
+
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_kf_1pace_1t
+  (JNIEnv *env, jobject this_obj)
+{
+  double speed = kalman_speed(&kf);
+  
+  if (kf.n_fixes < KF_MIN_FIXES || speed < KF_STATIONARY_SPEED)
+    return 0.0;
+  
+  // ms per mile, same as the Java pace_t
+  return 1000.0 * METERS_PER_MILE / speed;
+}
+
+JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1reset
+  (JNIEnv *env, jobject this_obj, jdouble cal)
+{
+  fusion_reset(&fusion,cal);
+}
+
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1push_1gps
+  (JNIEnv *env, jobject this_obj, jdouble lat, jdouble lon, jlong ts, jfloat accuracy,
+   jfloat speed, jfloat bearing)
+{
+  return fusion_push_gps(&fusion,lat,lon,ts,accuracy,speed,bearing);
+}
+
+/* next to the GPS file of the run so the run can be replayed */
+static void record_pod_sample(long long ts, double speed, double dist)
+{
+  if (!pod_data_fp)
+  {
+    char fname[PATH_MAX+1];
+    const char* sep = (gps_data_dir_len && gps_data_dir[gps_data_dir_len-1] != '/') ? "/" : "";
+
+    if (!gps_data_fp || !*gps_data_ts)
+      return;
+
+    if (snprintf(fname,sizeof(fname),"%.*s%s" POD_DATA_PREFIX "%s." POD_DATA_EXT,
+                 (int)gps_data_dir_len,gps_data_dir,sep,gps_data_ts) >= (int)sizeof(fname))
+      return;
+
+    if (!(pod_data_fp = fopen(fname,"w")))
+    {
+      LOGE("Could not open footpod data file %s (%d)", fname, errno);
+      return;
+    }
+  }
+
+  fusion_print_pod_line(pod_data_fp,ts,speed,dist);
+}
+
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1push_1pod
+  (JNIEnv *env, jobject this_obj, jlong ts, jdouble speed, jdouble dist)
+{
+  record_pod_sample(ts,speed,dist);
+  return fusion_push_pod(&fusion,ts,speed,dist);
+}
+
+JNIEXPORT jint JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1conf
+  (JNIEnv *env, jobject this_obj)
+{
+  return fusion.conf;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1bridging
+  (JNIEnv *env, jobject this_obj)
+{
+  return fusion_bridging(&fusion);
+}
+
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1pace_1t
+  (JNIEnv *env, jobject this_obj)
+{
+  double speed = fusion_speed(&fusion);
+  
+  if (speed < KF_STATIONARY_SPEED ||
+      (!fusion_bridging(&fusion) && fusion.kf.n_fixes < KF_MIN_FIXES))
+    return 0.0;
+  
+  return 1000.0 * METERS_PER_MILE / speed;
+}
+
+/* 0 until the run has learned a calibration of its own */
+JNIEXPORT jdouble JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_fusion_1cal
+  (JNIEnv *env, jobject this_obj)
+{
+  return fusion.n_cal ? fusion.cal : 0.0;
+}
+
+JNIEXPORT jdoubleArray JNICALL Java_com_fastrunningblog_FastRunningFriend_GPSCoordBuffer_geo_1scales
+  (JNIEnv *env, jobject this_obj, jdouble lat0)
+{
+  Geo_frame f;
+  jdouble scales[2];
+  jdoubleArray res;
+  
+  geo_frame_init(&f,lat0,0.0);
+  scales[0] = f.m_per_deg_lat;
+  scales[1] = f.m_per_deg_lon;
+  
+  if (!(res = (*env)->NewDoubleArray(env,2)))
+    return 0;
+  
+  (*env)->SetDoubleArrayRegion(env,res,0,2,scales);
+  return res;
+}
+
 JNIEXPORT jboolean JNICALL Java_com_fastrunningblog_FastRunningFriend_ConfigState_read_1config
   (JNIEnv *env, jobject this_obj, jstring profile_name)
 {
@@ -838,7 +1079,9 @@ JNIEXPORT jboolean JNICALL Java_com_fastrunningblog_FastRunningFriend_ConfigStat
   const char* profile_name_s = (*env)->GetStringUTFChars(env,profile_name,0);
   char path[PATH_MAX+1];
   jboolean res = 0;
-  Config_var* cfg_var_p;
+  char buf[MAX_CONFIG_FILE_SIZE + 1];
+  char* p, *p_end, *line_end;
+  size_t data_size;
   
   if (!profile_name_s)
     return 0;
@@ -852,43 +1095,52 @@ JNIEXPORT jboolean JNICALL Java_com_fastrunningblog_FastRunningFriend_ConfigStat
     goto err;
   }
 
-  LOGE("Reading config file");
+  LOGI("Reading config file");
+
+  // the file is small, read it in one shot and parse it in place
+  data_size = fread(buf,1,sizeof(buf),fp);
   
-  while (!feof(fp))
+  if (data_size > MAX_CONFIG_FILE_SIZE)
   {
-    char buf[512];
-    char* p,*p_end;
+    LOGE("Config file %s is too large", path);
+    goto err;
+  }
+  
+  buf[data_size] = 0;
+  p_end = buf + data_size;
+  
+  for (p = buf; p < p_end; p = line_end + 1)
+  {
+    char* eq,*val_end;
     Config_var* cfg_v;
     
-    if (!fgets(buf,sizeof(buf),fp))
-      break;
+    if (!(line_end = (char*)memchr(p,'\n',p_end - p)))
+      line_end = p_end;
     
-    if (*buf == '#')
+    if (*p == '#' || p == line_end)
       continue;
     
-    if (!(p = strchr(buf,'=')))
+    if (!(eq = (char*)memchr(p,'=',line_end - p)))
     {
-      LOGE("Error in config file on line '%s'", buf);
+      LOGE("Error in config file on line '%.*s'", (int)(line_end - p), p);
       goto err;
     }
-    p_end = buf + strlen(buf) - 1;
-    *p = 0;
-    
-    HASH_FIND_STR(config_h, buf, cfg_v);
     
-    if (!cfg_v)
+    if (!(cfg_v = config_var_lookup(p,eq - p)))
     {
-      LOGE("Unknown variable '%s'", buf);
+      LOGE("Unknown variable '%.*s'", (int)(eq - p), p);
       continue;
     }
     
+    for (val_end = line_end; val_end > eq + 1 && isspace(val_end[-1]); val_end--); 
     
-    for ( ; p_end > buf && isspace(*p_end); p_end--); 
-    
-    p_end[1] = 0;
-    (*cfg_v->reader)(env, this_obj, cfg_v, p + 1);
+    *val_end = 0;
+    config_var_read(env, this_obj, cfg_v, eq + 1);
   }
   
+  if (config_snapshot_refresh(env,this_obj))
+    LOGE("Error refreshing config snapshot after reading config file");
+
   res = 1;
 err:  
   (*env)->ReleaseStringUTFChars(env,profile_name,profile_name_s);
@@ -932,7 +1184,7 @@ jboolean write_config(JNIEnv* env, jobject this_obj, const char* profile_name_s)
   for (cfg_var_p = config_vars; cfg_var_p->name; cfg_var_p++)
   {
     char buf[512];
-    if ((*cfg_var_p->printer)(env,this_obj,cfg_var_p,buf,sizeof(buf)))
+    if (config_var_print(env,this_obj,cfg_var_p,buf,sizeof(buf)))
       goto err;
     fprintf(fp,"%s=%s\n",cfg_var_p->lookup_name,buf);
   }
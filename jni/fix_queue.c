@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fix_queue.h"
+#include "log.h"
+#include "metrics.h"
+
+void fix_queue_init(Fix_queue* q)
+{
+  q->head = q->tail = q->overruns = q->max_depth = 0;
+}
+
+int fix_queue_push(Fix_queue* q, const Fix* f)
+{
+  unsigned int tail = q->tail, depth = tail - q->head;
+
+  if (depth >= FIX_QUEUE_SIZE)
+  {
+    __sync_fetch_and_add(&q->overruns,1);
+    return 1;
+  }
+
+  q->fixes[tail % FIX_QUEUE_SIZE] = *f;
+
+  // the fix has to be there before the consumer can see the new tail
+  __sync_synchronize();
+  q->tail = tail + 1;
+
+  if (depth + 1 > q->max_depth)
+    q->max_depth = depth + 1;
+
+  return 0;
+}
+
+unsigned int fix_queue_pop(Fix_queue* q, Fix* out, unsigned int max)
+{
+  unsigned int head = q->head, n = q->tail - head, i;
+
+  if (n > max)
+    n = max;
+
+  __sync_synchronize();
+
+  for (i = 0; i < n; i++)
+    out[i] = q->fixes[(head + i) % FIX_QUEUE_SIZE];
+
+  // done reading the slots before the producer may reuse them
+  __sync_synchronize();
+  q->head = head + n;
+  return n;
+}
+
+unsigned int fix_queue_depth(Fix_queue* q)
+{
+  return q->tail - q->head;
+}
+
+/* 1 if the queue was empty */
+static int write_batch(Fix_writer* w)
+{
+  Fix batch[FIX_WRITER_BATCH];
+  unsigned long long start_us;
+  unsigned int i,n;
+  int failed = 0;
+
+  if (!(n = fix_queue_pop(&w->q,batch,FIX_WRITER_BATCH)))
+    return 1;
+
+  start_us = metrics_now_us();
+
+  for (i = 0; i < n; i++)
+  {
+    Fix* f = batch + i;
+
+    if (fprintf(w->fp,"%f,%f,%lld,%f,%f,%f,%f\n",f->lat,f->lon,f->ts,f->dist_to_prev,
+                f->bearing,f->accuracy,f->speed) < 0)
+      failed = 1;
+  }
+
+  if (fflush(w->fp))
+    failed = 1;
+
+  if (failed)
+    LOGE_RL(5000,"Error writing GPS data (%d)", errno);
+
+  w->n_written += n;
+  metric_record(METRIC_FIX_WRITE,start_us,failed);
+  return 0;
+}
+
+static void* writer_thread(void* arg)
+{
+  Fix_writer* w = (Fix_writer*)arg;
+  struct pollfd pfd;
+  uint64_t n;
+
+  pfd.fd = w->event_fd;
+  pfd.events = POLLIN;
+
+  for (;;)
+  {
+    // read stop before draining so nothing pushed before the stop is left behind
+    int stop = w->stop;
+
+    __sync_synchronize();
+
+    while (!write_batch(w)) /* empty */;
+
+    if (stop)
+      break;
+
+    if (poll(&pfd,1,-1) < 0 && errno != EINTR)
+    {
+      LOGE("Error %d waiting for GPS fixes", errno);
+      break;
+    }
+
+    (void)read(w->event_fd,&n,sizeof(n));
+  }
+
+  return 0;
+}
+
+static void wake_writer(Fix_writer* w)
+{
+  uint64_t one = 1;
+
+  (void)write(w->event_fd,&one,sizeof(one));
+}
+
+int fix_writer_start(Fix_writer* w, FILE* fp)
+{
+  fix_queue_init(&w->q);
+  w->fp = fp;
+  w->stop = w->running = 0;
+  w->n_written = 0;
+
+  if ((w->event_fd = eventfd(0,EFD_NONBLOCK)) < 0)
+  {
+    LOGE("Error creating GPS writer eventfd (%d)", errno);
+    return 1;
+  }
+
+  if (pthread_create(&w->th,0,writer_thread,w))
+  {
+    LOGE("Error starting GPS writer thread");
+    close(w->event_fd);
+    w->event_fd = -1;
+    return 1;
+  }
+
+  w->running = 1;
+  return 0;
+}
+
+int fix_writer_push(Fix_writer* w, const Fix* f)
+{
+  if (!w->running)
+    return 1;
+
+  if (fix_queue_push(&w->q,f))
+  {
+    LOGW_RL(5000,"GPS writer is %u fixes behind, dropping a fix", FIX_QUEUE_SIZE);
+    wake_writer(w);
+    return 1;
+  }
+
+  wake_writer(w);
+  return 0;
+}
+
+int fix_writer_stop(Fix_writer* w)
+{
+  if (!w->running)
+    return 0;
+
+  __sync_synchronize();
+  w->stop = 1;
+  wake_writer(w);
+  pthread_join(w->th,0);
+  close(w->event_fd);
+  w->event_fd = -1;
+  w->running = 0;
+  LOGI("GPS writer: %u fixes written, %u dropped, at most %u queued", w->n_written,
+       w->q.overruns, w->q.max_depth);
+  return w->q.overruns != 0;
+}
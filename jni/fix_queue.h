@@ -0,0 +1,61 @@
+#ifndef FIX_QUEUE_H
+#define FIX_QUEUE_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+  Single producer, single consumer ring of GPS fixes. The producer never waits: when the
+  consumer is a whole ring behind, the new fix is dropped and counted as an overrun.
+  head and tail run free and wrap as unsigned, a slot is its index modulo FIX_QUEUE_SIZE.
+  The consumer takes fixes out in batches.
+*/
+
+#define FIX_QUEUE_SIZE 256 /* power of 2, over 4 minutes of 1 Hz fixes */
+#define FIX_WRITER_BATCH 32
+
+typedef struct
+{
+  double lat,lon,dist_to_prev;
+  long long ts; /* ms of running time */
+  float bearing,accuracy,speed;
+} Fix;
+
+typedef struct
+{
+  Fix fixes[FIX_QUEUE_SIZE];
+  volatile unsigned int head; /* written by the consumer only */
+  volatile unsigned int tail; /* written by the producer only */
+  volatile unsigned int overruns;
+  unsigned int max_depth;
+} Fix_queue;
+
+void fix_queue_init(Fix_queue* q);
+/* producer side, 1 if the fix was dropped */
+int fix_queue_push(Fix_queue* q, const Fix* f);
+/* consumer side, up to max fixes in the order they came, the number taken */
+unsigned int fix_queue_pop(Fix_queue* q, Fix* out, unsigned int max);
+unsigned int fix_queue_depth(Fix_queue* q);
+
+/*
+  Thread that drains a queue into the gps_data_ file so the thread the fixes arrive on
+  never waits for the card. One fflush() per batch.
+*/
+typedef struct
+{
+  Fix_queue q;
+  FILE* fp;
+  int event_fd;
+  volatile int stop;
+  int running;
+  pthread_t th;
+  unsigned int n_written;
+} Fix_writer;
+
+int fix_writer_start(Fix_writer* w, FILE* fp);
+/* producer side, wakes the writer up */
+int fix_writer_push(Fix_writer* w, const Fix* f);
+/* writes out what is queued and waits for the thread, the file stays open */
+int fix_writer_stop(Fix_writer* w);
+
+#endif
@@ -1,5 +1,6 @@
 #include "frb.h"
 #include "log.h"
+#include "metrics.h"
 #include "http_daemon.h"
 #include "url.h"
 #include "config_vars.h"
@@ -11,12 +12,8 @@
 #define MAX_TEMPLATE_BUF 4096
 #define MAX_POST_RESP_BUF 1024
 
-#define INIT_FRB_AUTH   if (get_config_var_str("frb_login", frb_login, sizeof(frb_login)) || \
-get_config_var_str("frb_pw", frb_pw, sizeof(frb_pw))) \
-{\
-  LOGE("Error fetching FRB auth config info");\
-  return 1;\
-}\
+#define INIT_FRB_AUTH   config_get_frb_login(frb_login);\
+config_get_frb_pw(frb_pw);\
 if (!*frb_login) \
 {\
   LOGE("FRB auth not configured, not fetching template");\
@@ -26,7 +23,7 @@ if (!*frb_login) \
 
 int frb_update_template()
 {
-  char frb_login[128],frb_pw[128];
+  char frb_login[CONFIG_STR_SIZE],frb_pw[CONFIG_STR_SIZE];
   UT_string* url = 0;
   char* template_buf;
   int res = 1;
@@ -131,32 +128,36 @@ retry:
   return res;
 }
 
-int frb_post_workout(Run_timer* t)
+static int frb_post_workout_low(Run_timer* t)
 {
-  char frb_login[128],frb_pw[128];
+  char frb_login[CONFIG_STR_SIZE],frb_pw[CONFIG_STR_SIZE];
   char* resp_buf = 0;
   size_t resp_size;
+  UT_string* form = 0;
   int res = 1;
 
   INIT_FRB_AUTH
 
-  if (run_timer_add_key_to_hash(t, "username", frb_login, strlen(frb_login)) ||
-      run_timer_add_key_to_hash(t, "pass", frb_pw, strlen(frb_pw)) ||
-      run_timer_add_key_to_hash(t, "frf_mode", "1", 1) ||
-      run_timer_add_key_to_hash(t, "action", "post_workout", 12) ||
-      run_timer_add_key_to_hash(t, "workout_ts", t->workout_ts, t->workout_ts_len))
+  utstring_new(form);
+  url_form_add(form,"username",frb_login,strlen(frb_login));
+  url_form_add(form,"pass",frb_pw,strlen(frb_pw));
+  url_form_add(form,"frf_mode","1",1);
+  url_form_add(form,"action","post_workout",12);
+  url_form_add(form,"workout_ts",t->workout_ts,t->workout_ts_len);
+
+  if (run_timer_form_fields(t,form))
   {
-    LOGE("Error adding Fast Running Blog login credentials to post hash");
-    return 1;
+    LOGE("Error serializing workout for Fast Running Blog");
+    goto err;
   }
 
   if (!(resp_buf = (char*)malloc(MAX_POST_RESP_BUF)))
   {
     LOGE("OOM allocating post response buffer");
-    return 1;
+    goto err;
   }
 
-  if (!(resp_size = url_fetch_with_hash(FRB_POST_URL,resp_buf,MAX_POST_RESP_BUF,t->post_h)))
+  if (!(resp_size = url_post_form(FRB_POST_URL,resp_buf,MAX_POST_RESP_BUF,form)))
   {
     LOGE("Error posting workout to Fast Running Blog");
     goto err;
@@ -174,5 +175,15 @@ err:
   if (resp_buf)
     free(resp_buf);
 
+  utstring_free(form);
+  return res;
+}
+
+int frb_post_workout(Run_timer* t)
+{
+  unsigned long long start_us = metrics_now_us();
+  int res = frb_post_workout_low(t);
+
+  metric_record(METRIC_FRB_POST_WORKOUT,start_us,res);
   return res;
 }
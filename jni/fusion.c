@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fusion.h"
+#include "track.h"
+
+void fusion_reset(Fusion* f, double cal)
+{
+  memset(f,0,sizeof(*f));
+  kalman_reset(&f->kf);
+  f->cal = (cal >= FUSION_MIN_CAL && cal <= FUSION_MAX_CAL) ? cal : 1.0;
+  f->gps_ts = f->pod_ts = -1;
+  f->pod_dist = -1.0;
+  f->conf = CONF_INITIAL;
+}
+
+/* SIGNAL_RESTORED is the filter adding a straight line over what it lost track of */
+static int gps_good(Fusion* f)
+{
+  return f->kf.conf == CONF_NORMAL || f->kf.conf == CONF_INITIAL;
+}
+
+static int gps_trusted(Fusion* f, long long ts)
+{
+  return f->gps_ts >= 0 && ts - f->gps_ts <= FUSION_GPS_TIMEOUT && gps_good(f);
+}
+
+static int pod_fresh(Fusion* f, long long ts)
+{
+  return f->pod_ts >= 0 && ts - f->pod_ts <= FUSION_POD_TIMEOUT;
+}
+
+static void calibrate(Fusion* f)
+{
+  if (f->seg_pod > 0.0)
+  {
+    double ratio = f->seg_gps / f->seg_pod;
+
+    if (ratio >= FUSION_MIN_CAL && ratio <= FUSION_MAX_CAL)
+    {
+      // average the first few segments with the starting value, then follow slowly
+      double w = 1.0 / (f->n_cal + 2);
+
+      if (w < FUSION_CAL_GAIN)
+        w = FUSION_CAL_GAIN;
+
+      f->cal += w * (ratio - f->cal);
+      f->n_cal++;
+    }
+  }
+
+  f->seg_gps = f->seg_pod = 0.0;
+}
+
+double fusion_push_gps(Fusion* f, double lat, double lon, long long ts, double accuracy,
+                       double speed, double bearing)
+{
+  int pod = pod_fresh(f,ts);
+  int restart = (pod && f->gps_ts >= 0 && ts - f->gps_ts > FUSION_GPS_TIMEOUT);
+  double d;
+
+  // the footpod covered the gap, do not let the filter add the straight line across it
+  if (restart)
+  {
+    kalman_reset(&f->kf);
+    f->seg_gps = f->seg_pod = 0.0;
+  }
+
+  f->gps_ts = ts;
+  f->pod_pending = 0.0;
+  d = kalman_push(&f->kf,lat,lon,ts,accuracy,speed,bearing) * METERS_PER_MILE;
+
+  if (pod && f->kf.conf == CONF_NORMAL)
+  {
+    f->seg_gps += d;
+
+    if (f->seg_gps >= FUSION_CAL_SEG)
+      calibrate(f);
+  }
+  else
+    f->seg_gps = f->seg_pod = 0.0;
+
+  if (pod && !gps_good(f))
+  {
+    f->conf = f->kf.conf;
+    return 0.0;
+  }
+
+  f->dist += d;
+  f->conf = restart ? CONF_SIGNAL_RESTORED : f->kf.conf;
+  return d / METERS_PER_MILE;
+}
+
+double fusion_push_pod(Fusion* f, long long ts, double speed, double dist)
+{
+  double d = 0.0;
+
+  if (pod_fresh(f,ts) && ts > f->pod_ts)
+  {
+    if (dist < 0.0)
+      d = speed * (ts - f->pod_ts) / 1000.0;
+    else if (f->pod_dist >= 0.0 && dist >= f->pod_dist)
+      d = dist - f->pod_dist;
+    // else the pod restarted its count, this sample is the new base
+  }
+
+  f->pod_ts = ts;
+  f->pod_dist = dist;
+  f->pod_speed = speed * f->cal;
+  f->n_pod++;
+
+  if (d <= 0.0)
+    return 0.0;
+
+  if (gps_trusted(f,ts))
+  {
+    if (f->kf.conf == CONF_NORMAL)
+      f->seg_pod += d;
+
+    f->pod_pending += d;
+    return 0.0;
+  }
+
+  // the last fix was trusted, the footpod also takes the time it took to find out
+  d = (d + f->pod_pending) * f->cal;
+  f->pod_pending = 0.0;
+  f->dist += d;
+  f->bridged += d;
+  f->conf = (f->gps_ts < 0) ? CONF_SIGNAL_SEARCH : CONF_SIGNAL_LOST;
+  return d / METERS_PER_MILE;
+}
+
+int fusion_bridging(Fusion* f)
+{
+  return pod_fresh(f,f->pod_ts) && !gps_trusted(f,f->pod_ts);
+}
+
+double fusion_speed(Fusion* f)
+{
+  return fusion_bridging(f) ? f->pod_speed : kalman_speed(&f->kf);
+}
+
+int fusion_parse_pod_line(const char* line, long long* ts, double* speed, double* dist)
+{
+  return sscanf(line,"%lld,%lf,%lf",ts,speed,dist) != 3;
+}
+
+int fusion_print_pod_line(FILE* fp, long long ts, double speed, double dist)
+{
+  return fprintf(fp,"%lld,%.3f,%.2f\n",ts,speed,dist) < 0;
+}
+
+int fusion_pod_file(const char* gps_fname, char* fname, size_t fname_size)
+{
+  const char* base = strrchr(gps_fname,'/');
+  size_t dir_len;
+
+  base = base ? base + 1 : gps_fname;
+  dir_len = base - gps_fname;
+
+  if (strncmp(base,GPS_DATA_PREFIX,strlen(GPS_DATA_PREFIX)))
+    return 1;
+
+  base += strlen(GPS_DATA_PREFIX);
+  return snprintf(fname,fname_size,"%.*s" POD_DATA_PREFIX "%s",(int)dir_len,gps_fname,
+                  base) >= (int)fname_size;
+}
+
+typedef struct
+{
+  FILE* fp;
+  int have;
+  long long ts;
+  double v[5];
+} Replay_src;
+
+static void next_gps(Replay_src* s)
+{
+  char line[TRACK_MAX_LINE];
+
+  s->have = 0;
+
+  while (fgets(line,sizeof(line),s->fp))
+  {
+    if (!track_parse_line(line,s->v,s->v + 1,&s->ts,s->v + 2,s->v + 3,s->v + 4))
+    {
+      s->have = 1;
+      return;
+    }
+  }
+}
+
+static void next_pod(Replay_src* s)
+{
+  char line[TRACK_MAX_LINE];
+
+  s->have = 0;
+
+  while (s->fp && fgets(line,sizeof(line),s->fp))
+  {
+    if (!fusion_parse_pod_line(line,&s->ts,s->v,s->v + 1))
+    {
+      s->have = 1;
+      return;
+    }
+  }
+}
+
+int fusion_replay(Fusion* f, const char* gps_fname, const char* pod_fname)
+{
+  Replay_src gps,pod;
+
+  memset(&gps,0,sizeof(gps));
+  memset(&pod,0,sizeof(pod));
+
+  if (!(gps.fp = fopen(gps_fname,"r")))
+    return 1;
+
+  // no footpod file is a GPS only run
+  if (pod_fname)
+    pod.fp = fopen(pod_fname,"r");
+
+  next_gps(&gps);
+  next_pod(&pod);
+
+  while (gps.have || pod.have)
+  {
+    if (gps.have && (!pod.have || gps.ts <= pod.ts))
+    {
+      // lat, lon, bearing, accuracy, speed as track_parse_line() has them
+      fusion_push_gps(f,gps.v[0],gps.v[1],gps.ts,gps.v[3],gps.v[4],gps.v[2]);
+      next_gps(&gps);
+    }
+    else
+    {
+      fusion_push_pod(f,pod.ts,pod.v[0],pod.v[1]);
+      next_pod(&pod);
+    }
+  }
+
+  fclose(gps.fp);
+
+  if (pod.fp)
+    fclose(pod.fp);
+
+  return 0;
+}
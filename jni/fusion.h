@@ -0,0 +1,58 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdio.h>
+#include "kalman.h"
+
+/*
+  Footpod and GPS fusion. GPS fixes go through the Kalman filter and own the distance
+  while the signal is good; footpod distance is scaled by a calibration factor learned
+  online by comparing the two over stretches of good signal, and takes over when the
+  fixes stop or the filter loses confidence. When the fixes come back the filter starts
+  over at the new position so the gap is not counted twice. Without footpod samples the
+  engine is the Kalman engine. Everything lives in Fusion, no allocation.
+*/
+
+#define POD_DATA_PREFIX "pod_data_"
+#define POD_DATA_EXT "csv"
+
+#define FUSION_GPS_TIMEOUT 3000 /* ms without a fix before the footpod takes over */
+#define FUSION_POD_TIMEOUT 5000 /* ms, longer than that and the pod is gone */
+#define FUSION_CAL_SEG 200.0 /* m of good signal compared per calibration step */
+#define FUSION_CAL_GAIN 0.25 /* weight of a new segment in the calibration */
+#define FUSION_MIN_CAL 0.7 /* a ratio outside of these is a bad segment, not a bad pod */
+#define FUSION_MAX_CAL 1.3
+
+typedef struct
+{
+  Kalman_filter kf;
+  double dist; /* meters, what the runner is shown */
+  double cal; /* GPS meters per footpod meter */
+  unsigned int n_cal; /* segments the calibration has learned from */
+  double seg_gps,seg_pod; /* current calibration segment */
+  double bridged; /* meters covered on the footpod alone */
+  double pod_pending; /* raw footpod meters since the last fix */
+  long long gps_ts,pod_ts; /* last sample of each, -1 for none yet */
+  double pod_dist; /* last raw cumulative footpod distance, -1 if the pod only reports speed */
+  double pod_speed; /* m/s, calibrated */
+  unsigned int n_pod;
+  Dist_conf_level conf;
+} Fusion;
+
+void fusion_reset(Fusion* f, double cal);
+/* both return the miles added to the distance, same as kalman_push() */
+double fusion_push_gps(Fusion* f, double lat, double lon, long long ts, double accuracy,
+                       double speed, double bearing);
+/* speed in m/s, dist the footpod cumulative distance in meters or negative if not reported */
+double fusion_push_pod(Fusion* f, long long ts, double speed, double dist);
+double fusion_speed(Fusion* f);
+int fusion_bridging(Fusion* f);
+
+int fusion_parse_pod_line(const char* line, long long* ts, double* speed, double* dist);
+int fusion_print_pod_line(FILE* fp, long long ts, double speed, double dist);
+/* pod_data_ file recorded with a gps_data_ file */
+int fusion_pod_file(const char* gps_fname, char* fname, size_t fname_size);
+/* feeds the recorded samples of both files through f in time order */
+int fusion_replay(Fusion* f, const char* gps_fname, const char* pod_fname);
+
+#endif
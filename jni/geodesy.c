@@ -0,0 +1,169 @@
+#include <math.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "geodesy.h"
+
+#define DEG_TO_RAD (M_PI/180.0)
+
+static void set_scales(Geo_frame* f, double lat0)
+{
+  double s = sin(lat0 * DEG_TO_RAD);
+  double w = 1.0 - WGS84_E2 * s * s;
+  double m = WGS84_A * (1.0 - WGS84_E2) / (w * sqrt(w)); /* meridional radius */
+  double n = WGS84_A / sqrt(w); /* prime vertical radius */
+
+  f->m_per_deg_lat = m * DEG_TO_RAD;
+  f->m_per_deg_lon = n * cos(lat0 * DEG_TO_RAD) * DEG_TO_RAD;
+}
+
+void geo_frame_init(Geo_frame* f, double lat0, double lon0)
+{
+  f->lat0 = lat0;
+  f->lon0 = lon0;
+  f->x0 = f->y0 = 0.0;
+  set_scales(f,lat0);
+}
+
+void geo_project_point(Geo_frame* f, double lat, double lon, double* x, double* y)
+{
+  double dx = (lon - f->lon0) * f->m_per_deg_lon, dy = (lat - f->lat0) * f->m_per_deg_lat;
+
+  *x = f->x0 + dx;
+  *y = f->y0 + dy;
+
+  if (dx * dx + dy * dy > GEO_REANCHOR_M * GEO_REANCHOR_M)
+  {
+    f->lat0 = lat;
+    f->lon0 = lon;
+    f->x0 = *x;
+    f->y0 = *y;
+    set_scales(f,lat);
+  }
+}
+
+void geo_project(Geo_frame* f, const double* lat, const double* lon, float* x, float* y,
+                 uint n)
+{
+  uint i;
+
+  for (i = 0; i < n; i++)
+  {
+    double px,py;
+
+    geo_project_point(f,lat[i],lon[i],&px,&py);
+    x[i] = (float)px;
+    y[i] = (float)py;
+  }
+}
+
+void geo_seg_dist(const float* x, const float* y, float* d, uint n)
+{
+  uint i = 0;
+
+  if (n < 2)
+    return;
+
+  n--;
+
+#if defined(__ARM_NEON__)
+  for (; i + 4 <= n; i += 4)
+  {
+    float32x4_t dx = vsubq_f32(vld1q_f32(x + i + 1),vld1q_f32(x + i));
+    float32x4_t dy = vsubq_f32(vld1q_f32(y + i + 1),vld1q_f32(y + i));
+    float32x4_t sq = vmlaq_f32(vmulq_f32(dx,dx),dy,dy);
+    /* sqrt(s) = s * rsqrt(s), two Newton steps on the estimate, guard s == 0 */
+    float32x4_t r = vrsqrteq_f32(sq);
+    r = vmulq_f32(r,vrsqrtsq_f32(vmulq_f32(sq,r),r));
+    r = vmulq_f32(r,vrsqrtsq_f32(vmulq_f32(sq,r),r));
+    r = vbslq_f32(vceqq_f32(sq,vdupq_n_f32(0.0f)),vdupq_n_f32(0.0f),r);
+    vst1q_f32(d + i,vmulq_f32(sq,r));
+  }
+#endif
+
+  for (; i < n; i++)
+  {
+    float dx = x[i + 1] - x[i], dy = y[i + 1] - y[i];
+    d[i] = sqrtf(dx * dx + dy * dy);
+  }
+}
+
+uint geo_simplify(const float* x, const float* y, uint n, float tol, unsigned char* keep,
+                  uint* stack)
+{
+  uint i,sp = 0,n_keep = 0;
+  float tol2 = tol * tol;
+
+  if (!n)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    keep[i] = 0;
+
+  keep[0] = keep[n - 1] = 1;
+
+  if (n > 2)
+  {
+    stack[sp++] = 0;
+    stack[sp++] = n - 1;
+  }
+
+  // explicit stack, a straight out and back run would recurse n deep
+  while (sp)
+  {
+    uint last = stack[--sp], first = stack[--sp], max_i = 0;
+    float dx = x[last] - x[first], dy = y[last] - y[first];
+    float len2 = dx * dx + dy * dy, max_d2 = 0.0f;
+
+    for (i = first + 1; i < last; i++)
+    {
+      float px = x[i] - x[first], py = y[i] - y[first], d2;
+
+      if (len2 > 0.0f)
+      {
+        /* squared distance to the segment, not the infinite line */
+        float u = (px * dx + py * dy) / len2;
+
+        if (u < 0.0f)
+          u = 0.0f;
+        else if (u > 1.0f)
+          u = 1.0f;
+
+        px -= u * dx;
+        py -= u * dy;
+      }
+
+      d2 = px * px + py * py;
+
+      if (d2 > max_d2)
+      {
+        max_d2 = d2;
+        max_i = i;
+      }
+    }
+
+    if (max_d2 > tol2)
+    {
+      keep[max_i] = 1;
+
+      if (max_i - first > 1)
+      {
+        stack[sp++] = first;
+        stack[sp++] = max_i;
+      }
+
+      if (last - max_i > 1)
+      {
+        stack[sp++] = max_i;
+        stack[sp++] = last;
+      }
+    }
+  }
+
+  for (i = 0; i < n; i++)
+    n_keep += keep[i];
+
+  return n_keep;
+}
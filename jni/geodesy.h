@@ -0,0 +1,50 @@
+#ifndef GEODESY_H
+#define GEODESY_H
+
+#include <sys/types.h>
+
+/*
+  Local metric frame anchored at the start of a run. Fixes are projected with the WGS84
+  meridional and prime vertical radii of curvature at the anchor, after that all
+  geometry is plain 2D arithmetic.
+
+  With one anchor the east scale drifts by tan(lat0) * D/R where D is the north-south
+  distance from it, about 0.5% at 45 degrees 32 km out. So the projection moves the
+  anchor to the point being projected once the track is GEO_REANCHOR_M from the current
+  one, keeping that point's coordinates, so the frame stays continuous and every segment
+  is measured with the scales of a point within GEO_REANCHOR_M of it: under 0.03%
+  against Vincenty at 45 degrees however long the run. Points have to be projected in
+  track order. Near the poles (above ~80 degrees) use Location.distanceBetween instead.
+
+  The array kernels work on separate x and y arrays of floats so the compiler can
+  vectorize them, with a NEON version of the distance kernel when built for armv7 with
+  NEON. Floats keep millimeter resolution up to ~30 km from the start.
+*/
+
+#define WGS84_A 6378137.0
+#define WGS84_E2 6.69437999014e-3
+#define GEO_REANCHOR_M 2000.0 /* also in GPSCoordBuffer, FastRunningFriend.java */
+
+typedef struct
+{
+  double lat0,lon0; /* current anchor */
+  double x0,y0; /* where the anchor is in the frame, 0 until the first re-anchor */
+  double m_per_deg_lat,m_per_deg_lon; /* scales at the current anchor */
+} Geo_frame;
+
+void geo_frame_init(Geo_frame* f, double lat0, double lon0);
+/* may move the anchor, see above */
+void geo_project_point(Geo_frame* f, double lat, double lon, double* x, double* y);
+void geo_project(Geo_frame* f, const double* lat, const double* lon, float* x, float* y,
+                 uint n);
+
+/* n points give n - 1 segments */
+void geo_seg_dist(const float* x, const float* y, float* d, uint n);
+/*
+  Douglas-Peucker: sets keep[i] for the points that stay within tol meters of the
+  original line, returns how many. stack needs room for n uint pairs.
+*/
+uint geo_simplify(const float* x, const float* y, uint n, float tol, unsigned char* keep,
+                  uint* stack);
+
+#endif
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <microhttpd.h>
 #include <internal.h>
 #include <ctype.h>
@@ -16,6 +20,13 @@
 #include "timer.h"
 #include "c_html.h"
 #include "frb.h"
+#include "metrics.h"
+#include "export.h"
+#include "trace.h"
+#include "archive.h"
+#include "sync.h"
+#include "fusion.h"
+#include "live.h"
 
 #define METHOD_ERROR "<html><head></head><body>Unsupported method</body>"
 
@@ -25,9 +36,14 @@
 struct Session
 {
   /**
-   * We keep all sessions in a linked list.
+   * We keep all sessions in a hash on sid.
    */
-  struct Session *next;
+  UT_hash_handle hh;
+
+  /**
+   * Next session in the same expiry wheel slot.
+   */
+  struct Session *wheel_next;
 
   /**
    * Unique ID for this session. 
@@ -67,6 +83,7 @@ struct Request
   const char *post_url;
   Post_type post_type;
   Run_timer post_timer;
+  int smooth; /* the workout form was sent with SMOOTH_KEY */
 };
 
 
@@ -80,6 +97,10 @@ static struct MHD_Daemon *httpd = 0;
 static UT_string* get_config_form(const char* msg, const char* url);
 static UT_string* get_review_list(const char* msg, const char* url);
 static UT_string* get_workout_review(const char* msg, const char* url);
+static UT_string* get_stats_page(const char* msg, const char* url);
+static UT_string* get_stats_json(const char* msg, const char* url);
+static UT_string* get_files_page(const char* msg, const char* url);
+static UT_string* get_live_page(const char* msg, const char* url);
 
 static void print_html_escaped(UT_string* res, const char* s);
 
@@ -111,6 +132,124 @@ post_iterator(void *cls,
          const char *data, uint64_t off, size_t size);
 
 
+/* the smoothed track of the last workout shown, reloaded only when its file changes */
+static Track workout_track;
+static char workout_track_fname[PATH_MAX+1];
+static time_t workout_track_mtime;
+
+static Track* get_workout_track(Run_timer* t)
+{
+  char fname[PATH_MAX+1];
+  struct stat st;
+
+  if (!t->workout_ts || track_find_gps_file(DATA_DIR,t->workout_ts,fname,sizeof(fname)) ||
+      stat(fname,&st))
+    return 0;
+
+  if (workout_track.n && !strcmp(fname,workout_track_fname) &&
+      st.st_mtime == workout_track_mtime)
+    return &workout_track;
+
+  track_free(&workout_track);
+  *workout_track_fname = 0;
+
+  if (track_load(&workout_track,fname) || track_smooth(&workout_track))
+  {
+    track_free(&workout_track);
+    return 0;
+  }
+
+  strcpy(workout_track_fname,fname);
+  workout_track_mtime = st.st_mtime;
+  return &workout_track;
+}
+
+/* replays the recorded footpod samples of the loaded track through the fusion engine */
+static void print_footpod(UT_string* res)
+{
+  char fname[PATH_MAX+1];
+  struct stat st;
+  Fusion f;
+
+  if (fusion_pod_file(workout_track_fname,fname,sizeof(fname)) || stat(fname,&st))
+    return;
+
+  fusion_reset(&f,config_get_footpod_cal());
+
+  if (fusion_replay(&f,workout_track_fname,fname))
+    return;
+
+  utstring_printf(res,"<h3>Footpod</h3><p>%u samples, fused distance %.3f, %.3f of it on the "
+                      "footpod alone, calibration %.3f from %u segments</p>\n",
+                  f.n_pod,f.dist / METERS_PER_MILE,f.bridged / METERS_PER_MILE,f.cal,f.n_cal);
+}
+
+static const char* conf_name(Dist_conf_level conf)
+{
+  switch (conf)
+  {
+    case CONF_NORMAL:
+      return "good";
+    case CONF_BAD_SIGNAL:
+      return "poor accuracy";
+    case CONF_SUSPECT_SIGNAL:
+      return "outliers";
+    case CONF_SIGNAL_LOST:
+      return "lost";
+    default:
+      return "unknown";
+  }
+}
+
+static void print_workout_gps(UT_string* res, Run_timer* t)
+{
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+  Track* tr;
+  uint leg_num = 1, split_num;
+
+  if (!(tr = get_workout_track(t)) || run_timer_join_track(t,tr))
+  {
+    utstring_printf(res,"<p>No GPS track for this workout</p>");
+    return;
+  }
+
+  utstring_printf(res,"<h3>GPS</h3><table><tr><th></th><th>Distance</th><th>GPS Distance</th>"
+                      "<th>GPS Pace</th><th>Pace Variation</th><th>Accuracy</th>"
+                      "<th>Fixes</th><th>Signal</th></tr>\n");
+
+  LL_FOREACH(t->first_leg,cur_leg)
+  {
+    split_num = 1;
+
+    LL_FOREACH(cur_leg->first_split,cur_split)
+    {
+      Run_split_gps* g = cur_split->gps;
+      Run_split* next = cur_split->next ? cur_split->next :
+                        (cur_leg->next ? cur_leg->next->first_split : 0);
+
+      if (!g || !next)
+        continue;
+
+      utstring_printf(res,"<tr><td>Leg %d Split %d</td><td>%.3f</td><td>%.3f</td><td>",
+                      leg_num,split_num,next->d - cur_split->d,g->d);
+
+      if (g->pace)
+        run_timer_print_time(res,g->pace);
+
+      utstring_printf(res,"</td><td>%.1f%%</td><td>%.1f m</td><td>%u/%u</td><td>%s</td></tr>\n",
+                      g->pace_cv * 100.0,g->accuracy,g->n - g->n_outliers,g->n,
+                      conf_name(g->conf));
+      split_num++;
+    }
+
+    leg_num++;
+  }
+
+  utstring_printf(res,"</table>");
+  print_footpod(res);
+}
+
 static int init_post_config();
 static int finalize_post_config();
 static int finalize_post_workout(struct Request* r);
@@ -118,6 +257,14 @@ static int ensure_review_timer_inited();
 
 #define WORKOUT_URL "/workout"
 #define WORKOUT_URL_LEN strlen(WORKOUT_URL)
+/* submit button on the workout form that asks for distances from the GPS track */
+#define SMOOTH_KEY "smooth"
+#define SIMPLIFY_ARG "simplify"
+#define EXPORT_BLOCK_SIZE 2048
+#define NOT_FOUND_ERROR "<html><head></head><body>Not found</body>"
+#define BAD_REQUEST_ERROR "<html><head></head><body>Bad request</body>"
+#define SERVER_ERROR "<html><head></head><body>Internal error</body>"
+#define BUSY_ERROR "<html><head></head><body>Too many clients</body>"
 
 
 /**
@@ -127,14 +274,46 @@ static int ensure_review_timer_inited();
 
 static struct Session *sessions;
 
+/*
+  Sessions expire SESSION_TTL seconds after their last request. Each one sits in the wheel
+  slot of the tick its deadline falls in, a request only moves the deadline, and when the
+  slot comes around a session that was used since goes back in further along the wheel.
+*/
+#define SESSION_TTL (60 * 60)
+#define SESSION_WHEEL_TICK 60
+#define SESSION_WHEEL_SLOTS 64 /* more than SESSION_TTL / SESSION_WHEEL_TICK */
+
+static struct Session *session_wheel[SESSION_WHEEL_SLOTS];
+static time_t session_wheel_tick = 0; /* last tick processed */
+
 #define CONFIG_PAGE_TITLE "FastRunningFriend Configuration"
 #define REVIEW_PAGE_TITLE "Workout Review"
 #define WORKOUT_PAGE_TITLE "Workout Details"
+#define STATS_PAGE_TITLE "Performance Statistics"
+#define LIVE_PAGE_TITLE "Live Run"
 
 #define CONFIG_URL "/config"
 #define CONFIG_URL_LEN strlen(CONFIG_URL)
 
-typedef enum {NAV_UNDEF,NAV_CONFIG,NAV_REVIEW} Nav_ident;
+#define STATS_URL "/stats"
+#define STATS_JSON_URL "/stats.json"
+#define JSON_MIME "application/json"
+
+#define FILES_URL "/files"
+#define FILES_URL_LEN strlen(FILES_URL)
+#define FILES_PAGE_TITLE "Data Files"
+/* strftime() in the C locale, which is all Android has */
+#define HTTP_DATE_FMT "%a, %d %b %Y %H:%M:%S GMT"
+#define HTTP_DATE_SIZE 32
+#define ARCHIVE_URL "/archive.tar"
+#define ARCHIVE_GZ_URL "/archive.tar.gz"
+#define SINCE_ARG "since"
+#define SYNC_URL "/sync"
+#define CURSOR_ARG "cursor"
+#define SYNC_CURSOR_HEADER "X-FRF-Sync-Cursor"
+#define LIVE_IDLE_TIMEOUT 60 /* s without an update before a /live client is let go */
+
+typedef enum {NAV_UNDEF,NAV_CONFIG,NAV_REVIEW,NAV_STATS,NAV_FILES,NAV_LIVE} Nav_ident;
 
 typedef struct 
 {
@@ -146,11 +325,16 @@ typedef struct
 Nav_item nav_arr[] = {
   {"Configuration","config",NAV_CONFIG},
   {"Workout Review","review",NAV_REVIEW},
+  {"Statistics","stats",NAV_STATS},
+  {"Files","files",NAV_FILES},
+  {"Live","live",NAV_LIVE},
   {0,0,NAV_UNDEF}
 };
 
 static void add_nav_menu(UT_string* res, Nav_ident type);
 static void print_workout_form(UT_string* res, Run_timer* t);
+static void print_workout_gps(UT_string* res, Run_timer* t);
+static void print_workout_downloads(UT_string* res, Run_timer* t);
 static void get_prev_and_next(const char* workout, const char** prev, const char** next);
 
 
@@ -315,7 +499,9 @@ static void print_workout_form(UT_string* res, Run_timer* t)
     leg_num++;
   }
 
-  utstring_printf(res,"<tr><td colspan='100%%'><input type='submit' value='Update'></td></tr></table></form>"
+  utstring_printf(res,"<tr><td colspan='100%%'><input type='submit' value='Update'>"
+  " <input type='submit' name='" SMOOTH_KEY "' value='Recompute distances from GPS'>"
+  "</td></tr></table></form>"
   "\n<script>");
   utstring_concat(res,zone_js);
   utstring_printf(res,"</script>");
@@ -376,12 +562,141 @@ static UT_string* get_workout_review(const char* msg, const char* url)
 
   print_workout_nav(res, t);
   print_workout_form(res,&w_timer);
+  print_workout_gps(res,&w_timer);
+  print_workout_downloads(res,&w_timer);
   utstring_printf(res,"</body></html>");
   run_timer_deinit(&w_timer);
 err:
   return res;
 }
 
+static UT_string* get_stats_page(const char* msg, const char* url)
+{
+  UT_string* res;
+
+  utstring_new(res);
+  utstring_printf(res, "<html><head><title>" STATS_PAGE_TITLE
+    "</title></head><body><h1>" STATS_PAGE_TITLE "</h1>");
+  add_nav_menu(res, NAV_STATS);
+  metrics_print_html(res);
+  utstring_printf(res,"<a href='" STATS_JSON_URL "'>JSON</a></body></html>");
+  return res;
+}
+
+/* the page does the rest with EventSource on LIVE_STREAM_URL */
+static UT_string* get_live_page(const char* msg, const char* url)
+{
+  UT_string* res;
+
+  utstring_new(res);
+  utstring_printf(res, "<html><head><title>" LIVE_PAGE_TITLE
+    "</title></head><body><h1>" LIVE_PAGE_TITLE "</h1>");
+  add_nav_menu(res, NAV_LIVE);
+  utstring_printf(res,LIVE_JS_Q_F);
+  utstring_printf(res,"</body></html>");
+  return res;
+}
+
+static UT_string* get_stats_json(const char* msg, const char* url)
+{
+  UT_string* res;
+
+  utstring_new(res);
+  metrics_print_json(res);
+  return res;
+}
+
+static int name_compare(const void* a, const void* b)
+{
+  return strcmp(*(const char**)a,*(const char**)b);
+}
+
+static UT_string* get_files_page(const char* msg, const char* url)
+{
+  UT_string* res;
+  Mem_pool pool;
+  DIR* d = 0;
+  struct dirent* d_ent;
+  char** names = 0;
+  uint n = 0,size = 0,i;
+
+  utstring_new(res);
+  utstring_printf(res, "<html><head><title>" FILES_PAGE_TITLE
+    "</title></head><body><h1>" FILES_PAGE_TITLE "</h1>");
+  add_nav_menu(res, NAV_FILES);
+
+  if (mem_pool_init(&pool,RUN_TIMER_MEM_POOL_BLOCK))
+  {
+    utstring_printf(res,"Error initializing memory pool");
+    goto done;
+  }
+
+  if (!(d = opendir(DATA_DIR)))
+  {
+    utstring_printf(res,"Could not open " DATA_DIR);
+    goto err;
+  }
+
+  while ((d_ent = readdir(d)))
+  {
+    if (!archive_is_data_file(d_ent->d_name))
+      continue;
+
+    if (n == size)
+    {
+      char** new_names;
+      uint new_size = size ? size * 2 : 64;
+
+      if (!(new_names = (char**)mem_pool_alloc(&pool,new_size * sizeof(char*))))
+        goto err;
+
+      if (n)
+        memcpy(new_names,names,n * sizeof(char*));
+
+      names = new_names;
+      size = new_size;
+    }
+
+    if (!(names[n] = mem_pool_cdup(&pool,d_ent->d_name,strlen(d_ent->d_name))))
+      goto err;
+
+    n++;
+  }
+
+  if (n)
+    qsort(names,n,sizeof(char*),name_compare);
+
+  utstring_printf(res,"<table><tr><th>File</th><th>Size</th><th>Modified</th></tr>\n");
+
+  for (i = 0; i < n; i++)
+  {
+    char fname[PATH_MAX+1],date[HTTP_DATE_SIZE];
+    struct stat st;
+    struct tm tm;
+
+    snprintf(fname,sizeof(fname),DATA_DIR "%s",names[i]);
+
+    if (stat(fname,&st) || !S_ISREG(st.st_mode))
+      continue;
+
+    localtime_r(&st.st_mtime,&tm);
+    strftime(date,sizeof(date),"%Y-%m-%d %H:%M:%S",&tm);
+    utstring_printf(res,"<tr><td><a href='" FILES_URL "/%s'>%s</a></td><td>%lld</td>"
+                        "<td>%s</td></tr>\n", names[i], names[i], (long long)st.st_size, date);
+  }
+
+  utstring_printf(res,"</table><p>Download all as <a href='" ARCHIVE_URL "'>tar</a> "
+                      "<a href='" ARCHIVE_GZ_URL "'>tar.gz</a></p>");
+err:
+  if (d)
+    closedir(d);
+
+  mem_pool_free(&pool);
+done:
+  utstring_printf(res,"</body></html>");
+  return res;
+}
+
 static void get_prev_and_next(const char* workout, const char** prev, const char** next)
 {
   char** rl;
@@ -505,6 +820,7 @@ static UT_string* get_config_form(const char* msg, const char* url)
 {
   UT_string* res;
   Config_var* cfg_var_p;
+  JNIEnv* env;
   
   // aborts on malloc() failure, which is OK - if things are so bad that malloc fails it is
   // OK to exit for now. TODO: fix so there is clean exit on malloc() failure
@@ -514,7 +830,7 @@ static UT_string* get_config_form(const char* msg, const char* url)
 
   add_nav_menu(res, NAV_CONFIG);
 
-  if (!jni_env || !jni_cfg)
+  if (!(env = cfg_jni_env()) || !jni_cfg)
   {
     utstring_printf(res, "Internal error</body></html>");
     return res;
@@ -532,7 +848,7 @@ static UT_string* get_config_form(const char* msg, const char* url)
     char buf[512];
     const char* input_type = cfg_var_p->is_pw ? "password":"text";
 
-    if ((*cfg_var_p->printer)(jni_env,jni_cfg,cfg_var_p,buf,sizeof(buf)))
+    if (config_var_print(env,(jobject)jni_cfg,cfg_var_p,buf,sizeof(buf)))
       goto err;
 
     utstring_printf(res,"<tr><td>%s</td><td>"
@@ -553,6 +869,25 @@ err:
 
 
 
+static void schedule_session (struct Session *session)
+{
+  time_t tick = (session->start + SESSION_TTL) / SESSION_WHEEL_TICK + 1;
+  uint slot;
+
+  if (!session_wheel_tick)
+    session_wheel_tick = time (NULL) / SESSION_WHEEL_TICK;
+
+  // the clock went back, do not lap the wheel
+  if (tick <= session_wheel_tick)
+    tick = session_wheel_tick + 1;
+  else if (tick - session_wheel_tick >= SESSION_WHEEL_SLOTS)
+    tick = session_wheel_tick + SESSION_WHEEL_SLOTS - 1;
+
+  slot = tick % SESSION_WHEEL_SLOTS;
+  session->wheel_next = session_wheel[slot];
+  session_wheel[slot] = session;
+}
+
 /**
  * Return the session handle for this connection, or 
  * create one if this is a new user.
@@ -569,14 +904,8 @@ get_session (struct MHD_Connection *connection)
           COOKIE_NAME)))
   {
       /* find existing session */
-      ret = sessions;
-      
-      while (ret)
-      {
-        if (0 == strcmp (cookie, ret->sid))
-          break;
-        ret = ret->next;
-      }
+      HASH_FIND_STR (sessions, cookie, ret);
+
       if (NULL != ret)
       {
         ret->rc++;
@@ -601,8 +930,8 @@ get_session (struct MHD_Connection *connection)
       (unsigned int) random ());
   ret->rc++;  
   ret->start = time (NULL);
-  ret->next = sessions;
-  sessions = ret;
+  HASH_ADD_STR (sessions, sid, ret);
+  schedule_session (ret);
   return ret;
 }
 
@@ -687,6 +1016,400 @@ static int ensure_review_timer_inited()
   return 0;
 }
 
+/* links to the exports, only when there is a GPS track to export */
+static void print_workout_downloads(UT_string* res, Run_timer* t)
+{
+  if (!get_workout_track(t))
+    return;
+
+  utstring_printf(res,"<p>Download <a href='" WORKOUT_URL "/%s.gpx'>GPX</a> "
+                      "<a href='" WORKOUT_URL "/%s.tcx'>TCX</a>, simplified to 5 m "
+                      "<a href='" WORKOUT_URL "/%s.gpx?" SIMPLIFY_ARG "=5'>GPX</a> "
+                      "<a href='" WORKOUT_URL "/%s.tcx?" SIMPLIFY_ARG "=5'>TCX</a></p>",
+                  t->workout_ts,t->workout_ts,t->workout_ts,t->workout_ts);
+}
+
+static ssize_t export_reader(void* cls, uint64_t pos, char* buf, size_t max)
+{
+  return export_read((Export_stream*)cls,buf,max);
+}
+
+static void export_free(void* cls)
+{
+  export_close((Export_stream*)cls);
+}
+
+/* /workout/<ts>.gpx or .tcx, returns 0 if url is not one of those */
+static int get_export_format(const char* url, Export_format* format)
+{
+  uint len = strlen(url);
+
+  if (strncmp(url,WORKOUT_URL "/",WORKOUT_URL_LEN + 1) || len < 4)
+    return 0;
+
+  if (!strcmp(url + len - 4,".gpx"))
+    *format = EXPORT_GPX;
+  else if (!strcmp(url + len - 4,".tcx"))
+    *format = EXPORT_TCX;
+  else
+    return 0;
+
+  return 1;
+}
+
+static int handle_export(const char* url, Export_format format, struct Session* session,
+                         struct MHD_Connection* connection)
+{
+  int ret;
+  struct MHD_Response *response;
+  Export_stream* s;
+  char workout[TRACK_TS_LEN+1];
+  char disposition[64];
+  const char* ts = url + WORKOUT_URL_LEN + 1, *simplify;
+  double tol = 0.0;
+
+  if (strlen(ts) != TRACK_TS_LEN + 4)
+    goto not_found;
+
+  memcpy(workout,ts,TRACK_TS_LEN);
+  workout[TRACK_TS_LEN] = 0;
+
+  if ((simplify = MHD_lookup_connection_value(connection,MHD_GET_ARGUMENT_KIND,SIMPLIFY_ARG)))
+    tol = atof(simplify);
+
+  if (!(s = export_open(DATA_DIR,workout,format,tol)))
+    goto not_found;
+
+  if (!(response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,EXPORT_BLOCK_SIZE,
+                                                     &export_reader,s,&export_free)))
+  {
+    export_close(s);
+    return MHD_NO;
+  }
+
+  snprintf(disposition,sizeof(disposition),"attachment; filename=\"%s.%s\"",
+           workout,export_ext(format));
+  add_session_cookie(session,response);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_TYPE,export_mime(format));
+  MHD_add_response_header(response,"Content-Disposition",disposition);
+  ret = MHD_queue_response(connection,MHD_HTTP_OK,response);
+  MHD_destroy_response(response);
+  return ret;
+
+not_found:
+  response = MHD_create_response_from_buffer(strlen(NOT_FOUND_ERROR),
+                (void *) NOT_FOUND_ERROR,
+                MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response(connection,MHD_HTTP_NOT_FOUND,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+/* days since the epoch of a proleptic Gregorian date, avoids timegm() */
+static long days_from_civil(int y, int m, int d)
+{
+  int era, yoe, doy;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097L + yoe * 365L + yoe / 4 - yoe / 100 + doy - 719468L;
+}
+
+static int parse_http_date(const char* s, time_t* t)
+{
+  static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  char mon[4];
+  const char* p;
+  int y,d,hh,mm,ss;
+
+  // only the RFC 1123 form, which is what browsers send back
+  if (sscanf(s,"%*3s, %d %3s %d %d:%d:%d GMT",&d,mon,&y,&hh,&mm,&ss) != 6 ||
+      !(p = strstr(months,mon)) || (p - months) % 3)
+    return 1;
+
+  *t = (time_t)(days_from_civil(y,(p - months) / 3 + 1,d) * 86400L +
+                hh * 3600 + mm * 60 + ss);
+  return 0;
+}
+
+/*
+  A single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range. Returns 0 for a
+  usable range, 1 for one that cannot be satisfied and -1 when the whole file should be
+  sent, which includes multiple ranges.
+*/
+static int parse_range(const char* s, off_t size, off_t* first, off_t* last)
+{
+  char* end;
+  long long a = -1, b = -1;
+
+  if (strncmp(s,"bytes=",6) || strchr(s,','))
+    return -1;
+
+  s += 6;
+
+  if (isdigit(*s))
+  {
+    a = strtoll(s,&end,10);
+    s = end;
+  }
+
+  if (*s++ != '-')
+    return -1;
+
+  if (isdigit(*s))
+  {
+    b = strtoll(s,&end,10);
+    s = end;
+  }
+
+  if (*s || (a < 0 && b < 0))
+    return -1;
+
+  if (a < 0)
+  {
+    if (!b || !size)
+      return 1;
+
+    a = (b > size) ? 0 : size - b;
+    b = size - 1;
+  }
+  else
+  {
+    if (a >= size)
+      return 1;
+
+    if (b < 0 || b >= size)
+      b = size - 1;
+    else if (b < a)
+      return -1;
+  }
+
+  *first = a;
+  *last = b;
+  return 0;
+}
+
+static int queue_error_response(struct MHD_Connection* connection, uint status, const char* body)
+{
+  int ret;
+  struct MHD_Response* response = MHD_create_response_from_buffer(strlen(body),(void*)body,
+                                                                  MHD_RESPMEM_PERSISTENT);
+  if (!response)
+    return MHD_NO;
+
+  ret = MHD_queue_response(connection,status,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+/* /files/<name>, the kernel copies the file straight to the socket with sendfile() */
+static int handle_file(const char* url, struct Session* session,
+                       struct MHD_Connection* connection)
+{
+  int fd = -1, ret, r = -1;
+  struct MHD_Response *response;
+  struct stat st;
+  struct tm tm;
+  char fname[PATH_MAX+1],last_modified[HTTP_DATE_SIZE],content_range[64];
+  const char* name = url + FILES_URL_LEN + 1, *h;
+  off_t first = 0, last = 0;
+  time_t ims;
+
+  if (!archive_is_data_file(name) ||
+      snprintf(fname,sizeof(fname),DATA_DIR "%s",name) >= (int)sizeof(fname) ||
+      (fd = open(fname,O_RDONLY)) < 0)
+    return queue_error_response(connection,MHD_HTTP_NOT_FOUND,NOT_FOUND_ERROR);
+
+  if (fstat(fd,&st) || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return queue_error_response(connection,MHD_HTTP_NOT_FOUND,NOT_FOUND_ERROR);
+  }
+
+  gmtime_r(&st.st_mtime,&tm);
+  strftime(last_modified,sizeof(last_modified),HTTP_DATE_FMT,&tm);
+
+  if ((h = MHD_lookup_connection_value(connection,MHD_HEADER_KIND,
+                                       MHD_HTTP_HEADER_IF_MODIFIED_SINCE)) &&
+      !parse_http_date(h,&ims) && st.st_mtime <= ims)
+  {
+    close(fd);
+
+    if (!(response = MHD_create_response_from_buffer(0,"",MHD_RESPMEM_PERSISTENT)))
+      return MHD_NO;
+
+    MHD_add_response_header(response,MHD_HTTP_HEADER_LAST_MODIFIED,last_modified);
+    ret = MHD_queue_response(connection,MHD_HTTP_NOT_MODIFIED,response);
+    MHD_destroy_response(response);
+    return ret;
+  }
+
+  if ((h = MHD_lookup_connection_value(connection,MHD_HEADER_KIND,MHD_HTTP_HEADER_RANGE)) &&
+      (r = parse_range(h,st.st_size,&first,&last)) == 1)
+  {
+    close(fd);
+    snprintf(content_range,sizeof(content_range),"bytes */%lld",(long long)st.st_size);
+
+    if (!(response = MHD_create_response_from_buffer(0,"",MHD_RESPMEM_PERSISTENT)))
+      return MHD_NO;
+
+    MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_RANGE,content_range);
+    ret = MHD_queue_response(connection,MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE,response);
+    MHD_destroy_response(response);
+    return ret;
+  }
+
+  if (r)
+  {
+    first = 0;
+    last = st.st_size - 1;
+  }
+
+  // the response owns fd from here on
+  if (!(response = MHD_create_response_from_fd_at_offset(last - first + 1,fd,first)))
+  {
+    close(fd);
+    return MHD_NO;
+  }
+
+  add_session_cookie(session,response);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_TYPE,"application/octet-stream");
+  MHD_add_response_header(response,MHD_HTTP_HEADER_LAST_MODIFIED,last_modified);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_ACCEPT_RANGES,"bytes");
+
+  if (!r)
+  {
+    snprintf(content_range,sizeof(content_range),"bytes %lld-%lld/%lld",(long long)first,
+             (long long)last,(long long)st.st_size);
+    MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_RANGE,content_range);
+  }
+
+  ret = MHD_queue_response(connection,r ? MHD_HTTP_OK : MHD_HTTP_PARTIAL_CONTENT,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+static ssize_t archive_reader(void* cls, uint64_t pos, char* buf, size_t max)
+{
+  return archive_read((Archive_stream*)cls,buf,max);
+}
+
+static void archive_free(void* cls)
+{
+  archive_close((Archive_stream*)cls);
+}
+
+/* /archive.tar[.gz]?since=<ts> */
+static int handle_archive(int gzip, struct Session* session, struct MHD_Connection* connection)
+{
+  int ret;
+  struct MHD_Response *response;
+  Archive_stream* s;
+  const char* since = MHD_lookup_connection_value(connection,MHD_GET_ARGUMENT_KIND,SINCE_ARG);
+
+  if (since && !*since)
+    since = 0;
+
+  if (!(s = archive_open(DATA_DIR,since,gzip)))
+    return queue_error_response(connection,MHD_HTTP_NOT_FOUND,NOT_FOUND_ERROR);
+
+  if (!(response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,ARCHIVE_BLOCK_SIZE,
+                                                     &archive_reader,s,&archive_free)))
+  {
+    archive_close(s);
+    return MHD_NO;
+  }
+
+  add_session_cookie(session,response);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_TYPE,
+                          gzip ? "application/gzip" : "application/x-tar");
+  MHD_add_response_header(response,"Content-Disposition",
+                          gzip ? "attachment; filename=\"FastRunningFriend.tar.gz\"" :
+                                 "attachment; filename=\"FastRunningFriend.tar\"");
+  ret = MHD_queue_response(connection,MHD_HTTP_OK,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+/* /sync?cursor=<n>, the workouts changed since the cursor the last sync returned */
+static int handle_sync(struct Session* session, struct MHD_Connection* connection)
+{
+  int ret;
+  struct MHD_Response *response;
+  Archive_stream* s;
+  Sync_seq cursor = 0;
+  char cursor_buf[32];
+  const char* arg = MHD_lookup_connection_value(connection,MHD_GET_ARGUMENT_KIND,CURSOR_ARG);
+
+  if (arg && *arg)
+  {
+    char* end;
+    errno = 0;
+    cursor = strtoull(arg,&end,10);
+
+    if (errno || *end)
+      return queue_error_response(connection,MHD_HTTP_BAD_REQUEST,BAD_REQUEST_ERROR);
+  }
+
+  if (!(s = sync_open(DATA_DIR,&cursor)))
+    return queue_error_response(connection,MHD_HTTP_INTERNAL_SERVER_ERROR,SERVER_ERROR);
+
+  if (!(response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,ARCHIVE_BLOCK_SIZE,
+                                                     &archive_reader,s,&archive_free)))
+  {
+    archive_close(s);
+    return MHD_NO;
+  }
+
+  snprintf(cursor_buf,sizeof(cursor_buf),"%llu",cursor);
+  add_session_cookie(session,response);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_TYPE,"application/gzip");
+  MHD_add_response_header(response,SYNC_CURSOR_HEADER,cursor_buf);
+  ret = MHD_queue_response(connection,MHD_HTTP_OK,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
+static ssize_t live_reader(void* cls, uint64_t pos, char* buf, size_t max)
+{
+  return live_read((Live_sub*)cls,buf,max);
+}
+
+static void live_free(void* cls)
+{
+  live_unsubscribe((Live_sub*)cls);
+}
+
+/* text/event-stream that stays open, the reader says 0 until something is published */
+static int handle_live(struct Session* session, struct MHD_Connection* connection)
+{
+  int ret;
+  struct MHD_Response *response;
+  Live_sub* sub;
+
+  if (!(sub = live_subscribe()))
+    return queue_error_response(connection,MHD_HTTP_SERVICE_UNAVAILABLE,BUSY_ERROR);
+
+  if (!(response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,LIVE_FRAME_SIZE,
+                                                     &live_reader,sub,&live_free)))
+  {
+    live_unsubscribe(sub);
+    return MHD_NO;
+  }
+
+  // the default timeout is for requests, not for a stream that waits for the runner
+  MHD_set_connection_option(connection,MHD_CONNECTION_OPTION_TIMEOUT,
+                            (unsigned int)LIVE_IDLE_TIMEOUT);
+  add_session_cookie(session,response);
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CONTENT_TYPE,"text/event-stream");
+  MHD_add_response_header(response,MHD_HTTP_HEADER_CACHE_CONTROL,"no-cache");
+  ret = MHD_queue_response(connection,MHD_HTTP_OK,response);
+  MHD_destroy_response(response);
+  return ret;
+}
+
 static int
 handle_page (const void *cls,
         const char *mime,
@@ -709,6 +1432,23 @@ handle_page (const void *cls,
   {
     cb = get_workout_review;
   }
+  else if (strcmp(url,STATS_URL) == 0)
+  {
+    cb = get_stats_page;
+  }
+  else if (strcmp(url,STATS_JSON_URL) == 0)
+  {
+    cb = get_stats_json;
+    mime = JSON_MIME;
+  }
+  else if (strcmp(url,FILES_URL) == 0)
+  {
+    cb = get_files_page;
+  }
+  else if (strcmp(url,LIVE_URL) == 0)
+  {
+    cb = get_live_page;
+  }
   
   if (!(reply_s = (*cb)(session->msg,url)))
     return MHD_NO;
@@ -720,7 +1460,7 @@ handle_page (const void *cls,
                 MHD_RESPMEM_MUST_COPY);
   add_session_cookie (session, response);
   MHD_add_response_header (response,
-         MHD_HTTP_HEADER_CONTENT_ENCODING,
+         MHD_HTTP_HEADER_CONTENT_TYPE,
          mime);
   ret = MHD_queue_response (connection, 
           MHD_HTTP_OK, 
@@ -764,7 +1504,7 @@ post_iterator_config (void *cls,
   Config_var* cfg_v;
 
   //LOGE("post_interator_config: key='%s' value='%-.*s'", key, size, data);
-  HASH_FIND_STR(config_h,key,cfg_v);
+  cfg_v = config_var_lookup(key,strlen(key));
 
   if (cfg_v && utstring_len(cfg_v->post_val) + size < MAX_POST_VAR_SIZE)
   {
@@ -789,11 +1529,17 @@ post_iterator_workout(void *cls,
   if (!size)
     return MHD_YES;
 
-  LOGE("post_interator_workout: key='%s' value='%-.*s'", key, size, data);
+  LOGD("post_interator_workout: key='%s' off=%llu value='%-.*s'", key, off, size, data);
 
-  if (run_timer_add_key_to_hash(&r->post_timer,key,data,size))
+  if (!strcmp(key,SMOOTH_KEY))
   {
-    LOGE("Error adding key to hash");
+    r->smooth = 1;
+    return MHD_YES;
+  }
+
+  if (run_timer_post_field(&r->post_timer,key,data,off,size))
+  {
+    LOGE("Error decoding field %s", key);
     return MHD_NO;
   }
 
@@ -862,7 +1608,7 @@ post_iterator(void *cls,
  *         error while handling the request
  */
 static int
-create_response (void *cls,
+create_response_low (void *cls,
      struct MHD_Connection *connection,
      const char *url,
      const char *method,
@@ -880,7 +1626,7 @@ create_response (void *cls,
   struct Page page = {"/","text/html", &handle_page, 0};
   
   request = *ptr;
-  LOGE("In create_response, request=%p", *ptr);
+  LOGD("In create_response, request=%p", *ptr);
   
   if (!request)
   {
@@ -997,7 +1743,24 @@ create_response (void *cls,
   if ( (0 == strcmp (method, MHD_HTTP_METHOD_GET)) ||
        (0 == strcmp (method, MHD_HTTP_METHOD_HEAD)) )
   {
-    LOGE("Processing URL %s", url);
+    Export_format format;
+    LOGD("Processing URL %s", url);
+
+    if (get_export_format(url,&format))
+      return handle_export(url,format,session,connection);
+
+    if (!strncmp(url,FILES_URL "/",FILES_URL_LEN + 1))
+      return handle_file(url,session,connection);
+
+    if (!strcmp(url,ARCHIVE_URL) || !strcmp(url,ARCHIVE_GZ_URL))
+      return handle_archive(!strcmp(url,ARCHIVE_GZ_URL),session,connection);
+
+    if (!strcmp(url,SYNC_URL))
+      return handle_sync(session,connection);
+
+    if (!strcmp(url,LIVE_STREAM_URL))
+      return handle_live(session,connection);
+
     ret = (*page.handler)(url,
           page.mime,
           session, connection);
@@ -1016,6 +1779,24 @@ create_response (void *cls,
   return ret;
 }
 
+static int
+create_response (void *cls,
+     struct MHD_Connection *connection,
+     const char *url,
+     const char *method,
+     const char *version,
+     const char *upload_data, 
+     size_t *upload_data_size,
+     void **ptr)
+{
+  unsigned long long start_us = metrics_now_us();
+  int ret = create_response_low(cls,connection,url,method,version,upload_data,
+                                upload_data_size,ptr);
+
+  metric_record(METRIC_HTTP_RESPONSE,start_us,ret != MHD_YES);
+  return ret;
+}
+
 
 /**
  * Callback called upon completion of a request.
@@ -1051,29 +1832,39 @@ request_completed_callback (void *cls,
 static void expire_sessions ()
 {
   struct Session *pos;
-  struct Session *prev;
   struct Session *next;
-  time_t now;
+  time_t now = time (NULL);
+  time_t now_tick = now / SESSION_WHEEL_TICK;
+
+  // nothing is due until the next tick
+  if (!session_wheel_tick || now_tick <= session_wheel_tick)
+    return;
+
+  // after a long sleep every slot is due once, no need to go around more than that
+  if (now_tick - session_wheel_tick > SESSION_WHEEL_SLOTS)
+    session_wheel_tick = now_tick - SESSION_WHEEL_SLOTS;
+
+  while (session_wheel_tick < now_tick)
+  {
+    uint slot = ++session_wheel_tick % SESSION_WHEEL_SLOTS;
 
-  now = time (NULL);
-  prev = NULL;
-  pos = sessions;
-  while (NULL != pos)
+    pos = session_wheel[slot];
+    session_wheel[slot] = NULL;
+
+    for (; pos; pos = next)
     {
-      next = pos->next;
-      if (now - pos->start > 60 * 60)
+      next = pos->wheel_next;
+
+      /* a session still in use by a request stays until it is done */
+      if (!pos->rc && now - pos->start > SESSION_TTL)
       {
-        /* expire sessions after 1h */
-        if (NULL == prev)
-          sessions = pos->next;
-        else
-          prev->next = next;
+        HASH_DEL (sessions, pos);
         free (pos);
       }
       else
-        prev = pos;
-      pos = next;
+        schedule_session (pos);
     }
+  }
 }
 
 void http_stop_daemon()
@@ -1083,7 +1874,7 @@ void http_stop_daemon()
   if (httpd)
   {
     httpd->shutdown = MHD_YES;
-    LOGE("requesting shutdown");
+    LOGI("requesting shutdown");
   }
 }
 
@@ -1096,6 +1887,7 @@ int http_run_daemon(JNIEnv* env,jobject* cfg_obj)
   fd_set es;
   int max;
   int res = 0;
+  int live_fd;
 
   MHD_UNSIGNED_LONG_LONG mhd_timeout;
   
@@ -1121,8 +1913,12 @@ int http_run_daemon(JNIEnv* env,jobject* cfg_obj)
     goto err;
   }
 
-  LOGE("Running config daemon");
+  LOGI("Running config daemon");
   cfg_jni_init(env,cfg_obj);
+
+  if (live_init())
+    LOGE("No live update wakeups, /live clients will lag behind");
+
   httpd_running = 1;
 
   while (1)
@@ -1134,6 +1930,16 @@ int http_run_daemon(JNIEnv* env,jobject* cfg_obj)
     FD_ZERO (&es);
     if (MHD_YES != MHD_get_fdset (httpd, &rs, &ws, &es, &max))
       break; /* fatal internal error */
+
+    // wakes us up to hand /live clients what was just published
+    if ((live_fd = live_wake_fd()) >= 0)
+    {
+      FD_SET(live_fd,&rs);
+
+      if (live_fd > max)
+        max = live_fd;
+    }
+
     if (MHD_get_timeout (httpd, &mhd_timeout) == MHD_YES) 
     {
       tv.tv_sec = mhd_timeout / 1000;
@@ -1154,6 +1960,9 @@ int http_run_daemon(JNIEnv* env,jobject* cfg_obj)
         continue;
     }
 
+    if (live_fd >= 0 && FD_ISSET(live_fd,&rs))
+      live_clear_wake();
+
     if (exit_requested)
     {
       exit_requested = 0;
@@ -1176,8 +1985,9 @@ int http_run_daemon(JNIEnv* env,jobject* cfg_obj)
   }
   MHD_stop_daemon(httpd);
 err:
+  live_end();
   cfg_jni_reset();
-  LOGE("Exiting config daemon");
+  LOGI("Exiting config daemon");
   httpd_running = 0;
   httpd = 0;
   return res;
@@ -1190,7 +2000,25 @@ int http_daemon_running()
 
 static int finalize_post_workout(struct Request* r)
 {
-  run_timer_parse_keys(&r->post_timer);
+  if (run_timer_post_end(&r->post_timer))
+  {
+    r->session->msg = "Error saving workout";
+    return 1;
+  }
+
+  if (r->smooth)
+  {
+    Track tr;
+
+    if (run_timer_load_track(&r->post_timer,DATA_DIR,&tr))
+    {
+      r->session->msg = "No usable GPS track for this workout";
+      return 1;
+    }
+
+    run_timer_apply_track(&r->post_timer,&tr);
+    track_free(&tr);
+  }
 
   if (run_timer_save(&r->post_timer))
   {
@@ -1211,13 +2039,20 @@ static int finalize_post_config()
 {
   Config_var *v;
   int res = 0;
+  JNIEnv* env = cfg_jni_env();
+
+  if (!env || !jni_cfg)
+  {
+    LOGE("JNI environment not available while saving configuration");
+    return 1;
+  }
 
   for (v = config_vars; v->name; v++)
   {
      const char* val = utstring_body(v->post_val);
      //LOGE("Setting '%s' to '%s'", v->lookup_name, val);
 
-     if ((*v->reader)(jni_env,jni_cfg,v,val))
+     if (config_var_read(env,(jobject)jni_cfg,v,val))
        res = 1;
 
      utstring_free(v->post_val);
@@ -1226,10 +2061,13 @@ static int finalize_post_config()
 
   if (!res)
   {
-    if (!write_config(jni_env,jni_cfg,"default"))
+    if (!write_config(env,jni_cfg,"default"))
       res = 1;
   }
 
+  if (config_snapshot_refresh(env,(jobject)jni_cfg))
+    res = 1;
+
   frb_update_template();
   return res;
 }
@@ -0,0 +1,206 @@
+#include <math.h>
+#include <string.h>
+
+#include "kalman.h"
+
+#define DEG_TO_RAD (M_PI/180.0)
+
+void kalman_reset(Kalman_filter* kf)
+{
+  memset(kf,0,sizeof(*kf));
+  kf->conf = CONF_INITIAL;
+}
+
+static void kalman_start(Kalman_filter* kf, double e, double n, double r)
+{
+  memset(kf->x,0,sizeof(kf->x));
+  memset(kf->P,0,sizeof(kf->P));
+  kf->x[0] = kf->ref_e = e;
+  kf->x[1] = kf->ref_n = n;
+  kf->P[0][0] = kf->P[1][1] = r;
+  kf->P[2][2] = kf->P[3][3] = KF_INIT_VEL_VAR;
+  kf->n_rejects = 0;
+}
+
+static void kalman_predict(Kalman_filter* kf, double dt)
+{
+  double (*P)[4] = kf->P;
+  double q = KF_ACCEL_NOISE, dt2 = dt * dt;
+  int i;
+
+  kf->x[0] += dt * kf->x[2];
+  kf->x[1] += dt * kf->x[3];
+
+  // P = F P F^T, F adds dt * velocity to position
+  for (i = 0; i < 4; i++)
+  {
+    P[0][i] += dt * P[2][i];
+    P[1][i] += dt * P[3][i];
+  }
+
+  for (i = 0; i < 4; i++)
+  {
+    P[i][0] += dt * P[i][2];
+    P[i][1] += dt * P[i][3];
+  }
+
+  // white acceleration noise, same on both axes
+  P[0][0] += q * dt2 * dt / 3.0;
+  P[1][1] += q * dt2 * dt / 3.0;
+  P[0][2] += q * dt2 / 2.0;
+  P[2][0] += q * dt2 / 2.0;
+  P[1][3] += q * dt2 / 2.0;
+  P[3][1] += q * dt2 / 2.0;
+  P[2][2] += q * dt;
+  P[3][3] += q * dt;
+}
+
+// scalar update of state component k, measurements are independent so no matrix inverse
+static void kalman_update(Kalman_filter* kf, int k, double z, double r)
+{
+  double (*P)[4] = kf->P;
+  double y = z - kf->x[k], s = P[k][k] + r;
+  double K[4],row_k[4];
+  int i,j;
+
+  for (i = 0; i < 4; i++)
+  {
+    K[i] = P[i][k] / s;
+    row_k[i] = P[k][i];
+  }
+
+  for (i = 0; i < 4; i++)
+  {
+    kf->x[i] += K[i] * y;
+
+    for (j = 0; j < 4; j++)
+      P[i][j] -= K[i] * row_k[j];
+  }
+}
+
+static double position_d2(Kalman_filter* kf, double e, double n, double r)
+{
+  double s00 = kf->P[0][0] + r, s11 = kf->P[1][1] + r, s01 = kf->P[0][1];
+  double det = s00 * s11 - s01 * s01;
+  double y0 = e - kf->x[0], y1 = n - kf->x[1];
+
+  if (det <= 0.0)
+    return 0.0;
+
+  return (y0 * y0 * s11 - 2.0 * y0 * y1 * s01 + y1 * y1 * s00) / det;
+}
+
+/*
+  Returns the distance in miles covered since the previous fix, kf->conf gets the
+  confidence level for it.
+*/
+double kalman_push(Kalman_filter* kf, double lat, double lon, long long ts, double accuracy,
+                   double speed, double bearing)
+{
+  double e,n,r,de,dn,d_step = 0.0;
+  int rejected = 0;
+
+  if (accuracy <= 0.0)
+    accuracy = KF_DEFAULT_ACCURACY;
+  else if (accuracy < KF_MIN_ACCURACY)
+    accuracy = KF_MIN_ACCURACY;
+
+  r = accuracy * accuracy;
+
+  if (!kf->n_fixes)
+  {
+    geo_frame_init(&kf->frame,lat,lon);
+    kalman_start(kf,0.0,0.0,r);
+    kf->last_ts = ts;
+    kf->n_fixes = 1;
+    kf->conf = CONF_INITIAL;
+    return 0.0;
+  }
+
+  geo_project_point(&kf->frame,lat,lon,&e,&n);
+
+  if (ts > kf->last_ts)
+  {
+    kalman_predict(kf,(ts - kf->last_ts) / 1000.0);
+    kf->last_ts = ts;
+  }
+
+  kf->n_fixes++;
+
+  if (position_d2(kf,e,n,r) > KF_GATE)
+  {
+    rejected = 1;
+
+    // the filter has lost track rather than the fixes being bad, start over at the fix
+    if (++kf->n_rejects > KF_MAX_REJECTS)
+    {
+      de = e - kf->ref_e;
+      dn = n - kf->ref_n;
+      kf->dist += (d_step = sqrt(de * de + dn * dn));
+      kalman_start(kf,e,n,r);
+      kf->conf = CONF_SIGNAL_RESTORED;
+      return d_step / METERS_PER_MILE;
+    }
+  }
+  else
+  {
+    kf->n_rejects = 0;
+    kalman_update(kf,0,e,r);
+    kalman_update(kf,1,n,r);
+  }
+
+  if (speed > KF_MIN_DOPPLER_SPEED)
+  {
+    double v_r = KF_SPEED_SIGMA * KF_SPEED_SIGMA;
+    kalman_update(kf,2,speed * sin(bearing * DEG_TO_RAD),v_r);
+    kalman_update(kf,3,speed * cos(bearing * DEG_TO_RAD),v_r);
+    kf->have_doppler = 1;
+  }
+  else if (kf->have_doppler)
+  {
+    /*
+      A receiver that reports speed and now says close to 0 means we are standing. One
+      that never reported speed tells us nothing, 0 is just the default there.
+    */
+    double v_r = KF_MIN_DOPPLER_SPEED * KF_MIN_DOPPLER_SPEED;
+    kalman_update(kf,2,0.0,v_r);
+    kalman_update(kf,3,0.0,v_r);
+  }
+
+  /*
+    Hold the reference point while standing or while the move is within the position
+    uncertainty so the jitter of the estimate does not add up.
+  */
+  de = kf->x[0] - kf->ref_e;
+  dn = kf->x[1] - kf->ref_n;
+
+  if (kalman_speed(kf) >= KF_STATIONARY_SPEED &&
+      sqrt(de * de + dn * dn) > KF_MIN_STEP_SIGMAS * kalman_pos_sigma(kf))
+  {
+    d_step = sqrt(de * de + dn * dn);
+    kf->dist += d_step;
+    kf->ref_e = kf->x[0];
+    kf->ref_n = kf->x[1];
+  }
+
+  if (kf->n_fixes < KF_MIN_FIXES)
+    kf->conf = CONF_INITIAL;
+  else if (rejected)
+    kf->conf = CONF_SUSPECT_SIGNAL;
+  else if (kalman_pos_sigma(kf) > KF_BAD_SIGMA)
+    kf->conf = CONF_BAD_SIGNAL;
+  else
+    kf->conf = CONF_NORMAL;
+
+  return d_step / METERS_PER_MILE;
+}
+
+double kalman_speed(Kalman_filter* kf)
+{
+  return sqrt(kf->x[2] * kf->x[2] + kf->x[3] * kf->x[3]);
+}
+
+double kalman_pos_sigma(Kalman_filter* kf)
+{
+  return sqrt((kf->P[0][0] + kf->P[1][1]) / 2.0);
+}
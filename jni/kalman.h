@@ -0,0 +1,61 @@
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#include "geodesy.h"
+
+/*
+  Constant velocity Kalman filter over GPS fixes in a local east/north frame anchored at
+  the first fix. Position is observed with the fix accuracy as its standard deviation,
+  velocity with the Doppler speed and bearing when the receiver reports them. Everything
+  lives in Kalman_filter, no allocation.
+*/
+
+#define KF_ACCEL_NOISE 0.3 /* m^2/s^3, how hard a runner can change speed */
+#define KF_DEFAULT_ACCURACY 20.0 /* m, used when the fix has no accuracy */
+#define KF_MIN_ACCURACY 3.0
+#define KF_SPEED_SIGMA 0.5 /* m/s */
+#define KF_MIN_DOPPLER_SPEED 0.5 /* m/s, below that the bearing is noise */
+#define KF_STATIONARY_SPEED 0.3 /* m/s, do not accumulate distance below that */
+#define KF_MIN_STEP_SIGMAS 3.0 /* nor for moves within that many position sigmas */
+#define KF_GATE 16.0 /* squared Mahalanobis distance for the position gate, 2 dof */
+#define KF_MAX_REJECTS 5
+#define KF_MIN_FIXES 3
+#define KF_BAD_SIGMA 20.0 /* m */
+#define KF_INIT_VEL_VAR 25.0 /* (m/s)^2 */
+
+#define METERS_PER_MILE 1609.34
+
+/* must match the order of DistInfo.ConfidenceLevel in FastRunningFriend.java */
+typedef enum
+{
+  CONF_NORMAL,
+  CONF_INITIAL,
+  CONF_BAD_SIGNAL,
+  CONF_SUSPECT_SIGNAL,
+  CONF_SIGNAL_LOST,
+  CONF_SIGNAL_SEARCH,
+  CONF_SIGNAL_RECOVERY,
+  CONF_SIGNAL_RESTORED,
+  CONF_SIGNAL_DISABLED
+} Dist_conf_level;
+
+typedef struct
+{
+  Geo_frame frame;
+  double x[4]; /* east, north, v_east, v_north */
+  double P[4][4];
+  double ref_e,ref_n; /* where distance was last accumulated from */
+  long long last_ts;
+  unsigned int n_fixes,n_rejects;
+  int have_doppler;
+  double dist; /* meters */
+  Dist_conf_level conf;
+} Kalman_filter;
+
+void kalman_reset(Kalman_filter* kf);
+double kalman_push(Kalman_filter* kf, double lat, double lon, long long ts, double accuracy,
+                   double speed, double bearing);
+double kalman_speed(Kalman_filter* kf);
+double kalman_pos_sigma(Kalman_filter* kf);
+
+#endif
@@ -210,7 +210,7 @@
 /* #undef LIBCURL_PROTOCOL_TFTP */
 
 /* This is a Linux kernel */
-/* #undef LINUX */
+#define LINUX 1
 
 /* Define to the sub-directory in which libtool stores uninstalled libraries.
    */
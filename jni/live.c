@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "live.h"
+#include "log.h"
+
+typedef struct
+{
+  uint len;
+  char data[LIVE_FRAME_SIZE];
+} Live_frame;
+
+struct st_live_sub
+{
+  int in_use;
+  Live_frame frames[LIVE_QUEUE_FRAMES];
+  uint head,n;
+  Live_frame cur; /* being sent */
+  uint cur_off;
+  uint sent,dropped;
+};
+
+/* everything below is guarded by hub_lock */
+static pthread_mutex_t hub_lock = PTHREAD_MUTEX_INITIALIZER;
+static Live_sub subs[LIVE_MAX_CLIENTS];
+static uint n_subs = 0;
+static Live_frame last_frame;
+static unsigned long long frame_id = 0;
+static Fix last_fix;
+static int have_fix = 0;
+static int wake_fd = -1;
+
+int live_init()
+{
+  pthread_mutex_lock(&hub_lock);
+
+  if (wake_fd < 0 && (wake_fd = eventfd(0,EFD_NONBLOCK)) < 0)
+    LOGE("Error creating live update eventfd (%d)", errno);
+
+  pthread_mutex_unlock(&hub_lock);
+  return wake_fd < 0;
+}
+
+void live_end()
+{
+  pthread_mutex_lock(&hub_lock);
+
+  if (wake_fd >= 0)
+    close(wake_fd);
+
+  wake_fd = -1;
+  pthread_mutex_unlock(&hub_lock);
+}
+
+int live_wake_fd()
+{
+  return wake_fd;
+}
+
+void live_clear_wake()
+{
+  uint64_t n;
+
+  if (wake_fd >= 0)
+    (void)read(wake_fd,&n,sizeof(n));
+}
+
+// called with hub_lock held
+static void wake()
+{
+  uint64_t one = 1;
+
+  if (wake_fd >= 0)
+    (void)write(wake_fd,&one,sizeof(one));
+}
+
+// called with hub_lock held, a full queue loses its oldest frame
+static void enqueue(Live_sub* sub, const Live_frame* f)
+{
+  if (sub->n == LIVE_QUEUE_FRAMES)
+  {
+    sub->head = (sub->head + 1) % LIVE_QUEUE_FRAMES;
+    sub->n--;
+    sub->dropped++;
+  }
+
+  sub->frames[(sub->head + sub->n) % LIVE_QUEUE_FRAMES] = *f;
+  sub->n++;
+}
+
+Live_sub* live_subscribe()
+{
+  Live_sub* sub = 0;
+  uint i;
+
+  pthread_mutex_lock(&hub_lock);
+
+  for (i = 0; i < LIVE_MAX_CLIENTS; i++)
+  {
+    if (!subs[i].in_use)
+    {
+      sub = subs + i;
+      break;
+    }
+  }
+
+  if (!sub)
+    goto err;
+
+  memset(sub,0,sizeof(*sub));
+  sub->in_use = 1;
+  n_subs++;
+
+  // tell EventSource how soon to come back, then where the run is now
+  sub->cur.len = snprintf(sub->cur.data,sizeof(sub->cur.data),"retry: %u\n\n",LIVE_RETRY_MS);
+
+  if (last_frame.len)
+    enqueue(sub,&last_frame);
+
+err:
+  pthread_mutex_unlock(&hub_lock);
+  return sub;
+}
+
+void live_unsubscribe(Live_sub* sub)
+{
+  pthread_mutex_lock(&hub_lock);
+  LOGI("Live client done, %u frames sent, %u dropped", sub->sent, sub->dropped);
+  sub->in_use = 0;
+  n_subs--;
+  pthread_mutex_unlock(&hub_lock);
+}
+
+ssize_t live_read(Live_sub* sub, char* buf, size_t max)
+{
+  size_t n;
+
+  pthread_mutex_lock(&hub_lock);
+
+  if (sub->cur_off == sub->cur.len)
+  {
+    if (!sub->n)
+    {
+      pthread_mutex_unlock(&hub_lock);
+      return 0;
+    }
+
+    sub->cur = sub->frames[sub->head];
+    sub->cur_off = 0;
+    sub->head = (sub->head + 1) % LIVE_QUEUE_FRAMES;
+    sub->n--;
+    sub->sent++;
+  }
+
+  if ((n = sub->cur.len - sub->cur_off) > max)
+    n = max;
+
+  memcpy(buf,sub->cur.data + sub->cur_off,n);
+  sub->cur_off += n;
+  pthread_mutex_unlock(&hub_lock);
+  return n;
+}
+
+int live_has_subscribers()
+{
+  return n_subs != 0;
+}
+
+void live_publish(const char* data, uint len)
+{
+  Live_frame f;
+  int n;
+  uint i;
+
+  pthread_mutex_lock(&hub_lock);
+  n = snprintf(f.data,sizeof(f.data),"id: %llu\ndata: %.*s\n\n",++frame_id,(int)len,data);
+
+  if (n < 0 || n >= (int)sizeof(f.data))
+  {
+    LOGE_RL(5000,"Live update of %u bytes does not fit in a frame", len);
+    goto err;
+  }
+
+  f.len = n;
+  last_frame = f;
+
+  for (i = 0; i < LIVE_MAX_CLIENTS; i++)
+  {
+    if (subs[i].in_use)
+      enqueue(subs + i,&f);
+  }
+
+  wake();
+err:
+  pthread_mutex_unlock(&hub_lock);
+}
+
+void live_note_fix(const Fix* f)
+{
+  pthread_mutex_lock(&hub_lock);
+  last_fix = *f;
+  have_fix = 1;
+  pthread_mutex_unlock(&hub_lock);
+}
+
+void live_publish_run(const Run_info* info, double dist, double pace_t, int conf)
+{
+  char buf[LIVE_FRAME_SIZE];
+  Fix fix;
+  int n,fix_ok;
+
+  pthread_mutex_lock(&hub_lock);
+  fix = last_fix;
+  fix_ok = have_fix;
+  pthread_mutex_unlock(&hub_lock);
+
+  n = snprintf(buf,sizeof(buf),"{\"t_total\":%llu,\"t_leg\":%llu,\"t_split\":%llu,"
+               "\"d_last_leg\":%.3f,\"d_last_split\":%.3f,\"dist\":%.3f,\"pace_t\":%.0f,"
+               "\"conf\":%d,\"fix\":",info->t_total,info->t_leg,info->t_split,
+               info->d_last_leg,info->d_last_split,dist,pace_t,conf);
+
+  if (n > 0 && n < (int)sizeof(buf))
+  {
+    if (fix_ok)
+      n += snprintf(buf + n,sizeof(buf) - n,"{\"lat\":%.6f,\"lon\":%.6f,\"ts\":%lld,"
+                    "\"accuracy\":%.1f,\"speed\":%.2f,\"bearing\":%.0f}}",fix.lat,fix.lon,
+                    fix.ts,fix.accuracy,fix.speed,fix.bearing);
+    else
+      n += snprintf(buf + n,sizeof(buf) - n,"null}");
+  }
+
+  if (n <= 0 || n >= (int)sizeof(buf))
+    return;
+
+  live_publish(buf,n);
+}
@@ -0,0 +1,45 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <sys/types.h>
+#include "timer.h"
+#include "fix_queue.h"
+
+/*
+  Publish/subscribe hub behind the /live Server-Sent Events stream. The UI thread
+  publishes a snapshot of the run with every distance update, each /live connection
+  subscribes and gets its own short queue of SSE frames. A client that does not keep up
+  loses the oldest frames in its queue, the publisher only ever copies into memory. The
+  config daemon selects on live_wake_fd() so that waiting connections are served as soon
+  as something is published.
+*/
+
+#define LIVE_URL "/live"
+#define LIVE_STREAM_URL "/live/events"
+#define LIVE_MAX_CLIENTS 4
+#define LIVE_QUEUE_FRAMES 4
+#define LIVE_FRAME_SIZE 512
+#define LIVE_RETRY_MS 2000 /* how soon EventSource reconnects */
+
+typedef struct st_live_sub Live_sub;
+
+int live_init();
+void live_end();
+/* readable when there is something for a subscriber, -1 when the hub is not running */
+int live_wake_fd();
+void live_clear_wake();
+
+/* 0 if there are LIVE_MAX_CLIENTS already, the last frame published is queued for it */
+Live_sub* live_subscribe();
+void live_unsubscribe(Live_sub* sub);
+/* same contract as MHD_ContentReaderCallback, 0 when the queue is empty */
+ssize_t live_read(Live_sub* sub, char* buf, size_t max);
+
+int live_has_subscribers();
+/* data is one line of JSON */
+void live_publish(const char* data, uint len);
+void live_note_fix(const Fix* f);
+/* dist in miles, pace_t in ms per mile, conf a Dist_conf_level */
+void live_publish_run(const Run_info* info, double dist, double pace_t, int conf);
+
+#endif
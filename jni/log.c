@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "log.h"
+
+/*
+  Lock-free multi-producer ring of preformatted messages. A producer claims a slot by
+  bumping log_head, marks it as being written with an odd seq of 2 * pos + 1, fills it
+  and publishes it with the even seq 2 * pos + 2. The drain thread is the only consumer,
+  it writes published slots to the log file in batches. A slot whose seq is behind the
+  one it expects has not been published yet and is picked up on the next pass, one whose
+  seq is ahead was overwritten by a later message and is counted as lost.
+*/
+typedef struct
+{
+  volatile unsigned int seq;
+  int level;
+  unsigned long long ts;
+  char msg[LOG_MSG_SIZE];
+} Log_slot;
+
+static Log_slot log_ring[LOG_RING_SIZE];
+static volatile unsigned int log_head = 0;
+static unsigned int log_tail = 0;
+static volatile int log_ring_active = 0;
+static volatile int log_ring_done = 0;
+static FILE* log_fp = 0;
+static pthread_t log_thread;
+
+static const char level_chars[] = "DIWE";
+static const int android_prio[] = {ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR};
+
+static unsigned long long log_now()
+{
+  struct timeval t;
+
+  if (gettimeofday(&t,0))
+    return 0;
+
+  return (unsigned long long)t.tv_sec * 1000LL + (unsigned long long)t.tv_usec/1000LL;
+}
+
+void frf_log(int level, const char* fmt, ...)
+{
+  va_list ap;
+
+  // errors always reach logcat, everything else only if there is no ring to take it
+  if (!log_ring_active || level >= FRF_LOG_ERROR)
+  {
+    va_start(ap,fmt);
+    __android_log_vprint(android_prio[level],LOG_TAG,fmt,ap);
+    va_end(ap);
+  }
+
+  if (log_ring_active)
+  {
+    unsigned int pos = __sync_fetch_and_add(&log_head,1);
+    Log_slot* slot = log_ring + (pos % LOG_RING_SIZE);
+
+    slot->seq = 2 * pos + 1;
+    __sync_synchronize();
+    slot->level = level;
+    slot->ts = log_now();
+    va_start(ap,fmt);
+    vsnprintf(slot->msg,sizeof(slot->msg),fmt,ap);
+    va_end(ap);
+    __sync_synchronize();
+    slot->seq = 2 * pos + 2;
+  }
+}
+
+int log_rate_check(Log_rate_limit* rl, unsigned int interval_ms)
+{
+  struct timespec ts;
+  unsigned long long now;
+  unsigned int suppressed;
+
+  if (clock_gettime(CLOCK_MONOTONIC,&ts))
+    return 1;
+
+  now = (unsigned long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+
+  if (rl->last_ts && now - rl->last_ts < interval_ms)
+  {
+    __sync_fetch_and_add(&rl->suppressed,1);
+    return 0;
+  }
+
+  rl->last_ts = now;
+
+  if ((suppressed = __sync_lock_test_and_set(&rl->suppressed,0)))
+    frf_log(FRF_LOG_INFO,"%u similar messages suppressed", suppressed);
+
+  return 1;
+}
+
+static void log_ring_drain()
+{
+  unsigned int head = log_head, lost = 0;
+
+  if (head - log_tail > LOG_RING_SIZE)
+  {
+    lost = head - log_tail - LOG_RING_SIZE;
+    log_tail = head - LOG_RING_SIZE;
+  }
+
+  for (; log_tail != head; log_tail++)
+  {
+    Log_slot* slot = log_ring + (log_tail % LOG_RING_SIZE);
+    char msg[LOG_MSG_SIZE];
+    unsigned long long ts;
+    int level;
+    time_t t;
+    struct tm tm;
+    char time_buf[32];
+    unsigned int want = 2 * log_tail + 2;
+    int ahead = (int)(slot->seq - want);
+
+    // claimed but not yet published, the writer may have been preempted in between
+    if (ahead < 0)
+      break;
+
+    if (ahead > 0)
+    {
+      lost++;
+      continue;
+    }
+
+    __sync_synchronize();
+    level = slot->level;
+    ts = slot->ts;
+    memcpy(msg,slot->msg,sizeof(msg));
+    __sync_synchronize();
+
+    // a later writer took the slot while we were copying it
+    if (slot->seq != want)
+    {
+      lost++;
+      continue;
+    }
+
+    msg[sizeof(msg)-1] = 0;
+    t = ts / 1000;
+
+    if (!localtime_r(&t,&tm) || !strftime(time_buf,sizeof(time_buf),"%Y-%m-%d %H:%M:%S",&tm))
+      strcpy(time_buf,"Unknown time");
+
+    fprintf(log_fp,"[%s.%03u] %c %s\n", time_buf, (unsigned int)(ts % 1000),
+            level_chars[level], msg);
+  }
+
+  if (lost)
+    fprintf(log_fp,"%u log messages lost\n", lost);
+
+  fflush(log_fp);
+}
+
+static void* log_drain_thread(void* arg)
+{
+  while (!log_ring_done)
+  {
+    usleep(LOG_DRAIN_INTERVAL * 1000);
+    log_ring_drain();
+  }
+
+  return 0;
+}
+
+int log_ring_start(const char* fname)
+{
+  if (log_ring_active)
+    return 0;
+
+  if (!(log_fp = fopen(fname,"w")))
+  {
+    LOGE("Could not open log file %s (%d)", fname, errno);
+    return 1;
+  }
+
+  log_ring_done = 0;
+  log_tail = log_head;
+
+  if (pthread_create(&log_thread,0,log_drain_thread,0))
+  {
+    LOGE("Could not start log drain thread");
+    fclose(log_fp);
+    log_fp = 0;
+    return 1;
+  }
+
+  log_ring_active = 1;
+  return 0;
+}
+
+void log_ring_stop()
+{
+  if (!log_ring_active)
+    return;
+
+  log_ring_active = 0;
+  log_ring_done = 1;
+  pthread_join(log_thread,0);
+  log_ring_drain();
+  fclose(log_fp);
+  log_fp = 0;
+}
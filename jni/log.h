@@ -3,7 +3,54 @@
 #include <android/log.h>
 #include <errno.h>
 
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,"Fast Running Friend",__VA_ARGS__)
+#define LOG_TAG "Fast Running Friend"
+#define LOG_FILE_PREFIX "frf_log_"
 
+#define FRF_LOG_DEBUG 0
+#define FRF_LOG_INFO 1
+#define FRF_LOG_WARN 2
+#define FRF_LOG_ERROR 3
 
-#endif
\ No newline at end of file
+/*
+  Messages below FRF_LOG_LEVEL are removed at compile time, arguments included, so
+  debug traces in the GPS and timer paths cost nothing in a normal build. Build with
+  -DFRF_LOG_LEVEL=0 to get them back.
+*/
+#ifndef FRF_LOG_LEVEL
+#define FRF_LOG_LEVEL FRF_LOG_INFO
+#endif
+
+#define LOG_RING_SIZE 256
+#define LOG_MSG_SIZE 120
+#define LOG_DRAIN_INTERVAL 1000 /* ms */
+
+typedef struct
+{
+  unsigned long long last_ts;
+  unsigned int suppressed;
+} Log_rate_limit;
+
+void frf_log(int level, const char* fmt, ...) __attribute__((format(printf,2,3)));
+int log_rate_check(Log_rate_limit* rl, unsigned int interval_ms);
+int log_ring_start(const char* fname);
+void log_ring_stop();
+
+#define FRF_LOG(level,...) do { if ((level) >= FRF_LOG_LEVEL) frf_log((level),__VA_ARGS__); } while (0)
+
+/* at most one message per interval_ms from each call site, the rest are counted */
+#define FRF_LOG_RL(level,interval_ms,...) do { if ((level) >= FRF_LOG_LEVEL) \
+  { \
+    static Log_rate_limit log_rl_; \
+    if (log_rate_check(&log_rl_,(interval_ms))) \
+      frf_log((level),__VA_ARGS__); \
+  } } while (0)
+
+#define LOGD(...) FRF_LOG(FRF_LOG_DEBUG,__VA_ARGS__)
+#define LOGI(...) FRF_LOG(FRF_LOG_INFO,__VA_ARGS__)
+#define LOGW(...) FRF_LOG(FRF_LOG_WARN,__VA_ARGS__)
+#define LOGE(...) FRF_LOG(FRF_LOG_ERROR,__VA_ARGS__)
+
+#define LOGW_RL(interval_ms,...) FRF_LOG_RL(FRF_LOG_WARN,interval_ms,__VA_ARGS__)
+#define LOGE_RL(interval_ms,...) FRF_LOG_RL(FRF_LOG_ERROR,interval_ms,__VA_ARGS__)
+
+#endif
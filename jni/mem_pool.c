@@ -15,7 +15,7 @@ static Mem_pool_block* get_block(uint block_size)
   b->cur = b->buf = (char*)b + sizeof(*b);
   b->buf_end = b->buf + block_size;
   b->next = 0;
-  LOGE("Allocated block at %p b->buf=%p b->buf_end=%p", b, b->buf, b->buf_end);
+  LOGD("Allocated block at %p b->buf=%p b->buf_end=%p", b, b->buf, b->buf_end);
   return b;
 }
 
@@ -45,7 +45,7 @@ char* mem_pool_alloc(Mem_pool* pool, uint size)
     {
       char* res = block->cur;
       block->cur += size;
-      LOGE("Allocated memory at %p size = %d new cur=%p", res, size, block->cur);
+      LOGD("Allocated memory at %p size = %d new cur=%p", res, size, block->cur);
       return res;
     }
   }
@@ -56,7 +56,7 @@ char* mem_pool_alloc(Mem_pool* pool, uint size)
 
   block->cur += size;
   LL_APPEND(pool->first_block,block);
-  LOGE("Allocated memory in new block at %p size = %d new cur=%p", block->buf, size, block->cur);
+  LOGD("Allocated memory in new block at %p size = %d new cur=%p", block->buf, size, block->cur);
   return block->buf;
 }
 
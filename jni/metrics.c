@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+
+#define US_PER_S 1000000U
+
+static Metric metrics[METRIC_COUNT] = {
+  {"flush_gps_buffer"},
+  {"gps_sirf_read"},
+  {"run_timer_save"},
+  {"http_response"},
+  {"frb_post_workout"},
+  {"fix_write"}
+};
+
+static time_t metrics_start = 0;
+
+unsigned long long metrics_now_us()
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC,&ts))
+    return 0;
+
+  return (unsigned long long)ts.tv_sec * US_PER_S + ts.tv_nsec / 1000;
+}
+
+static uint bucket_of(uint us)
+{
+  uint b;
+
+  if (!us)
+    return 0;
+
+  b = 31 - __builtin_clz(us);
+  return (b < METRIC_N_BUCKETS) ? b : METRIC_N_BUCKETS - 1;
+}
+
+void metric_record(Metric_id id, unsigned long long start_us, int failed)
+{
+  Metric* m = metrics + id;
+  unsigned long long d = metrics_now_us() - start_us;
+  uint us,old_us,new_us,old_max;
+
+  us = (d > 0xffffffffULL) ? 0xffffffffU : (uint)d;
+  __sync_fetch_and_add(&m->count,1);
+
+  if (failed)
+    __sync_fetch_and_add(&m->errors,1);
+
+  __sync_fetch_and_add(&m->buckets[bucket_of(us)],1);
+
+  // the adder whose sum crosses a second boundary carries it into total_s
+  __sync_fetch_and_add(&m->total_s,us / US_PER_S);
+  new_us = __sync_add_and_fetch(&m->total_us,us % US_PER_S);
+  old_us = new_us - us % US_PER_S;
+
+  if (new_us / US_PER_S > old_us / US_PER_S)
+  {
+    __sync_fetch_and_sub(&m->total_us,US_PER_S);
+    __sync_fetch_and_add(&m->total_s,1);
+  }
+
+  while ((old_max = m->max_us) < us)
+  {
+    if (__sync_bool_compare_and_swap(&m->max_us,old_max,us))
+      break;
+  }
+}
+
+void metrics_reset()
+{
+  Metric* m;
+
+  for (m = metrics; m < metrics + METRIC_COUNT; m++)
+  {
+    m->count = m->errors = m->total_s = m->total_us = m->max_us = 0;
+    memset((void*)m->buckets,0,sizeof(m->buckets));
+  }
+
+  time(&metrics_start);
+}
+
+static double metric_total_ms(Metric* m)
+{
+  return m->total_s * 1000.0 + m->total_us / 1000.0;
+}
+
+void metrics_print_html(UT_string* res)
+{
+  Metric* m;
+  uint b;
+
+  if (metrics_start)
+  {
+    char time_buf[64];
+    struct tm tm;
+
+    if (localtime_r(&metrics_start,&tm) && strftime(time_buf,sizeof(time_buf),"%Y-%m-%d %H:%M:%S",&tm))
+      utstring_printf(res,"<p>Counting since %s</p>", time_buf);
+  }
+
+  utstring_printf(res,"<table border=1><tr><th>Function</th><th>Calls</th><th>Errors</th>"
+                      "<th>Total ms</th><th>Avg us</th><th>Max us</th><th>Histogram (us)</th></tr>\n");
+
+  for (m = metrics; m < metrics + METRIC_COUNT; m++)
+  {
+    uint count = m->count;
+
+    utstring_printf(res,"<tr><td>%s</td><td>%u</td><td>%u</td><td>%.3f</td><td>%.1f</td><td>%u</td><td>",
+                    m->name, count, m->errors, metric_total_ms(m),
+                    count ? metric_total_ms(m) * 1000.0 / count : 0.0, m->max_us);
+
+    for (b = 0; b < METRIC_N_BUCKETS; b++)
+    {
+      if (m->buckets[b])
+        utstring_printf(res,"&lt;%u:%u ", 2U << b, m->buckets[b]);
+    }
+
+    utstring_printf(res,"</td></tr>\n");
+  }
+
+  utstring_printf(res,"</table>\n");
+}
+
+void metrics_print_json(UT_string* res)
+{
+  Metric* m;
+  uint b;
+
+  utstring_printf(res,"{\"since\":%ld,\"bucket_unit\":\"us\",\"metrics\":{", (long)metrics_start);
+
+  for (m = metrics; m < metrics + METRIC_COUNT; m++)
+  {
+    utstring_printf(res,"%s\"%s\":{\"count\":%u,\"errors\":%u,\"total_ms\":%.3f,\"max_us\":%u,"
+                    "\"buckets\":[", (m == metrics) ? "" : ",", m->name, m->count, m->errors,
+                    metric_total_ms(m), m->max_us);
+
+    for (b = 0; b < METRIC_N_BUCKETS; b++)
+      utstring_printf(res,"%s%u", b ? "," : "", m->buckets[b]);
+
+    utstring_printf(res,"]}");
+  }
+
+  utstring_printf(res,"}}\n");
+}
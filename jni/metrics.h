@@ -0,0 +1,43 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+#include "utstring.h"
+
+/*
+  Call counts and latency histograms for the hot paths. Bucket k counts calls that took
+  [2^k,2^(k+1)) microseconds, the last bucket takes everything slower. All updates are
+  atomic so any thread can record without taking a lock. Counters are cleared when a run
+  starts so /stats shows the numbers for the current or the last run.
+*/
+
+#define METRIC_N_BUCKETS 24
+
+typedef enum
+{
+  METRIC_FLUSH_GPS_BUFFER,
+  METRIC_GPS_SIRF_READ,
+  METRIC_RUN_TIMER_SAVE,
+  METRIC_HTTP_RESPONSE,
+  METRIC_FRB_POST_WORKOUT,
+  METRIC_FIX_WRITE,
+  METRIC_COUNT
+} Metric_id;
+
+typedef struct
+{
+  const char* name;
+  volatile uint count;
+  volatile uint errors;
+  volatile uint total_s,total_us; /* 32 bit halves, armeabi has no 64 bit atomics */
+  volatile uint max_us;
+  volatile uint buckets[METRIC_N_BUCKETS];
+} Metric;
+
+unsigned long long metrics_now_us();
+void metric_record(Metric_id id, unsigned long long start_us, int failed);
+void metrics_reset();
+void metrics_print_html(UT_string* res);
+void metrics_print_json(UT_string* res);
+
+#endif
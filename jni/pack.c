@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "pack.h"
+#include "timer.h"
+#include "track.h"
+#include "log.h"
+
+/* native byte order, the file never leaves the phone except to be archived as is */
+typedef struct
+{
+  char magic[8];
+  uint64_t index_off;
+  uint32_t n_entries;
+  uint32_t index_crc;
+} Pack_header;
+
+typedef struct
+{
+  char workout[TRACK_TS_LEN+1];
+  uint32_t timer_size,meta_size,comp_size;
+  uint64_t off;
+} Pack_entry;
+
+/* the index of the last pack read, reloaded when its header changes */
+static Pack_entry* pack_index = 0;
+static uint pack_n = 0;
+static Pack_header pack_hdr;
+static char pack_fname[PATH_MAX+1];
+static pthread_mutex_t pack_lock = PTHREAD_MUTEX_INITIALIZER;
+/* one append at a time, readers only take pack_lock */
+static pthread_mutex_t pack_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int dir_path(char* buf, size_t size, const char* dir, const char* name)
+{
+  size_t len = strlen(dir);
+  const char* sep = (len && dir[len - 1] != '/') ? "/" : "";
+
+  return snprintf(buf,size,"%s%s%s",dir,sep,name) >= (int)size;
+}
+
+static int workout_path(char* buf, size_t size, const char* dir, const char* prefix,
+                        const char* workout)
+{
+  char name[NAME_MAX+1];
+
+  snprintf(name,sizeof(name),"%s%s.%s",prefix,workout,TIMER_DATA_EXT);
+  return dir_path(buf,size,dir,name);
+}
+
+static int entry_compare(const void* a, const void* b)
+{
+  return strcmp(((const Pack_entry*)a)->workout,((const Pack_entry*)b)->workout);
+}
+
+/* with pack_lock held, 0 entries if there is no pack yet */
+static int load_index(const char* dir)
+{
+  char fname[PATH_MAX+1];
+  Pack_header hdr;
+  Pack_entry* index = 0;
+  size_t index_size;
+  int fd;
+
+  if (dir_path(fname,sizeof(fname),dir,PACK_FILE))
+    return 1;
+
+  if ((fd = open(fname,O_RDONLY)) < 0)
+  {
+    pack_n = 0;
+    *pack_fname = 0;
+    return errno != ENOENT;
+  }
+
+  if (pread(fd,&hdr,sizeof(hdr),0) != sizeof(hdr) || memcmp(hdr.magic,PACK_MAGIC,8))
+  {
+    close(fd);
+    pack_n = 0;
+    *pack_fname = 0;
+    return 0;
+  }
+
+  if (!strcmp(fname,pack_fname) && !memcmp(&hdr,&pack_hdr,sizeof(hdr)))
+  {
+    close(fd);
+    return 0;
+  }
+
+  index_size = hdr.n_entries * sizeof(Pack_entry);
+
+  if (hdr.n_entries && !(index = (Pack_entry*)malloc(index_size)))
+  {
+    LOGE("OOM loading pack index");
+    goto err;
+  }
+
+  if (hdr.n_entries && (pread(fd,index,index_size,hdr.index_off) != (ssize_t)index_size ||
+      crc32(0,(const Bytef*)index,index_size) != hdr.index_crc))
+  {
+    LOGE("Corrupt index in %s", fname);
+    goto err;
+  }
+
+  close(fd);
+  free(pack_index);
+  pack_index = index;
+  pack_n = hdr.n_entries;
+  pack_hdr = hdr;
+  strcpy(pack_fname,fname);
+  return 0;
+err:
+  close(fd);
+  free(index);
+  return 1;
+}
+
+static int find_entry(const char* dir, const char* workout, Pack_entry* e)
+{
+  Pack_entry key, *found = 0;
+
+  if (strlen(workout) != TRACK_TS_LEN)
+    return 1;
+
+  memcpy(key.workout,workout,TRACK_TS_LEN + 1);
+  pthread_mutex_lock(&pack_lock);
+
+  if (!load_index(dir) && pack_n &&
+      (found = (Pack_entry*)bsearch(&key,pack_index,pack_n,sizeof(key),entry_compare)))
+    *e = *found;
+
+  pthread_mutex_unlock(&pack_lock);
+  return found == 0;
+}
+
+int pack_read_workout(const char* dir, const char* workout, char** buf, uint* timer_size,
+                      uint* meta_size)
+{
+  char fname[PATH_MAX+1];
+  Pack_entry e;
+  char* comp = 0, *res = 0;
+  uLongf size;
+  int fd = -1;
+
+  if (find_entry(dir,workout,&e) || dir_path(fname,sizeof(fname),dir,PACK_FILE))
+    return 1;
+
+  size = e.timer_size + e.meta_size;
+
+  if (!(comp = (char*)malloc(e.comp_size)) || !(res = (char*)malloc(size + 1)))
+  {
+    LOGE("OOM reading %s from pack", workout);
+    goto err;
+  }
+
+  // blocks never change once written, no need to hold the lock
+  if ((fd = open(fname,O_RDONLY)) < 0 || pread(fd,comp,e.comp_size,e.off) != e.comp_size)
+  {
+    LOGE("Error reading %s from %s (%d)", workout, fname, errno);
+    goto err;
+  }
+
+  if (uncompress((Bytef*)res,&size,(const Bytef*)comp,e.comp_size) != Z_OK ||
+      size != e.timer_size + e.meta_size)
+  {
+    LOGE("Corrupt block for %s in %s", workout, fname);
+    goto err;
+  }
+
+  res[size] = 0;
+  close(fd);
+  free(comp);
+  *buf = res;
+  *timer_size = e.timer_size;
+  *meta_size = e.meta_size;
+  return 0;
+err:
+  if (fd >= 0)
+    close(fd);
+
+  free(comp);
+  free(res);
+  return 1;
+}
+
+static int write_file(const char* fname, const char* data, uint size)
+{
+  FILE* fp;
+  int res = 0;
+
+  if (!(fp = fopen(fname,"w")))
+    return 1;
+
+  if (size && fwrite(data,size,1,fp) != 1)
+    res = 1;
+
+  if (fclose(fp))
+    res = 1;
+
+  return res;
+}
+
+int pack_restore_workout(const char* dir, const char* workout)
+{
+  char fname[PATH_MAX+1],meta_fname[PATH_MAX+1];
+  char* buf;
+  uint timer_size,meta_size;
+  int res = 1;
+
+  if (workout_path(fname,sizeof(fname),dir,TIMER_DATA_PREFIX,workout) ||
+      workout_path(meta_fname,sizeof(meta_fname),dir,META_DATA_PREFIX,workout))
+    return 1;
+
+  if (pack_read_workout(dir,workout,&buf,&timer_size,&meta_size))
+    return 1;
+
+  // meta first, a timer file without one is what a crash in between should leave
+  if (write_file(meta_fname,buf + timer_size,meta_size) ||
+      write_file(fname,buf,timer_size))
+  {
+    LOGE("Error restoring %s from pack (%d)", workout, errno);
+    goto err;
+  }
+
+  LOGI("Restored %s from pack", workout);
+  res = 0;
+err:
+  free(buf);
+  return res;
+}
+
+static char* read_file(const char* fname, uint* size, time_t* mtime)
+{
+  struct stat st;
+  char* buf = 0;
+  int fd;
+
+  if ((fd = open(fname,O_RDONLY)) < 0)
+  {
+    *size = 0;
+    return 0;
+  }
+
+  if (fstat(fd,&st) || !(buf = (char*)malloc(st.st_size + 1)) ||
+      read(fd,buf,st.st_size) != st.st_size)
+  {
+    free(buf);
+    buf = 0;
+    *size = 0;
+  }
+  else
+  {
+    *size = st.st_size;
+
+    if (mtime)
+      *mtime = st.st_mtime;
+  }
+
+  close(fd);
+  return buf;
+}
+
+/* deflates the workout into a new block at *off, updates or adds its entry keeping the index sorted */
+static int append_block(int fd, const char* dir, const char* workout, uint64_t* off,
+                        Pack_entry* index, uint* n, time_t* mtime)
+{
+  char fname[PATH_MAX+1];
+  char* timer_buf = 0, *meta_buf = 0, *raw = 0, *comp = 0;
+  uint timer_size,meta_size;
+  uLongf comp_size;
+  Pack_entry key, *e;
+  int res = 1;
+
+  if (workout_path(fname,sizeof(fname),dir,TIMER_DATA_PREFIX,workout) ||
+      !(timer_buf = read_file(fname,&timer_size,mtime)))
+    goto err;
+
+  if (workout_path(fname,sizeof(fname),dir,META_DATA_PREFIX,workout))
+    goto err;
+
+  meta_buf = read_file(fname,&meta_size,0);
+  comp_size = compressBound(timer_size + meta_size);
+
+  if (!(raw = (char*)malloc(timer_size + meta_size + 1)) ||
+      !(comp = (char*)malloc(comp_size)))
+    goto err;
+
+  memcpy(raw,timer_buf,timer_size);
+
+  if (meta_size)
+    memcpy(raw + timer_size,meta_buf,meta_size);
+
+  if (compress2((Bytef*)comp,&comp_size,(const Bytef*)raw,timer_size + meta_size,
+                PACK_LEVEL) != Z_OK)
+    goto err;
+
+  if (pwrite(fd,comp,comp_size,*off) != (ssize_t)comp_size)
+  {
+    LOGE("Error appending %s to pack (%d)", workout, errno);
+    goto err;
+  }
+
+  memcpy(key.workout,workout,TRACK_TS_LEN + 1);
+
+  if (!(e = (Pack_entry*)bsearch(&key,index,*n,sizeof(key),entry_compare)))
+    e = index + (*n)++;
+
+  *e = key;
+  e->timer_size = timer_size;
+  e->meta_size = meta_size;
+  e->comp_size = comp_size;
+  e->off = *off;
+  *off += comp_size;
+
+  if (e == index + *n - 1)
+    qsort(index,*n,sizeof(Pack_entry),entry_compare);
+  res = 0;
+err:
+  free(timer_buf);
+  free(meta_buf);
+  free(raw);
+  free(comp);
+  return res;
+}
+
+int pack_add_workouts(const char* dir, char** workouts, uint n)
+{
+  char fname[PATH_MAX+1];
+  Pack_entry* index = 0;
+  Pack_header hdr;
+  time_t* mtimes = 0;
+  unsigned char* packed = 0;
+  uint n_index, n_packed = 0, i;
+  uint64_t off;
+  int fd = -1, res = 1;
+
+  if (!n || dir_path(fname,sizeof(fname),dir,PACK_FILE))
+    return !n ? 0 : 1;
+
+  pthread_mutex_lock(&pack_write_lock);
+  pthread_mutex_lock(&pack_lock);
+
+  if (load_index(dir))
+  {
+    pthread_mutex_unlock(&pack_lock);
+    goto err;
+  }
+
+  n_index = pack_n;
+
+  if ((index = (Pack_entry*)malloc((n_index + n) * sizeof(Pack_entry))) && n_index)
+    memcpy(index,pack_index,n_index * sizeof(Pack_entry));
+
+  // appends go after the committed index, whatever a crashed append left there is garbage
+  off = n_index ? pack_hdr.index_off + n_index * sizeof(Pack_entry) : sizeof(Pack_header);
+  pthread_mutex_unlock(&pack_lock);
+
+  mtimes = (time_t*)malloc(n * sizeof(time_t));
+  packed = (unsigned char*)calloc(n,1);
+
+  if (!index || !mtimes || !packed)
+  {
+    LOGE("OOM packing workouts");
+    goto err;
+  }
+
+  if ((fd = open(fname,O_RDWR|O_CREAT,0644)) < 0)
+  {
+    LOGE("Could not open %s (%d)", fname, errno);
+    goto err;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (strlen(workouts[i]) != TRACK_TS_LEN)
+      continue;
+
+    if (append_block(fd,dir,workouts[i],&off,index,&n_index,mtimes + i))
+    {
+      LOGE("Could not pack %s", workouts[i]);
+      continue;
+    }
+
+    packed[i] = 1;
+    n_packed++;
+  }
+
+  if (!n_packed)
+    goto err;
+
+  memset(&hdr,0,sizeof(hdr));
+  memcpy(hdr.magic,PACK_MAGIC,8);
+  hdr.index_off = off;
+  hdr.n_entries = n_index;
+  hdr.index_crc = crc32(0,(const Bytef*)index,n_index * sizeof(Pack_entry));
+
+  // the header is the commit point, it goes in last and only after the rest is synced
+  if (pwrite(fd,index,n_index * sizeof(Pack_entry),off) !=
+        (ssize_t)(n_index * sizeof(Pack_entry)) || fsync(fd) ||
+      pwrite(fd,&hdr,sizeof(hdr),0) != sizeof(hdr) || fsync(fd))
+  {
+    LOGE("Error writing index of %s (%d)", fname, errno);
+    goto err;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    char data_fname[PATH_MAX+1];
+    struct stat st;
+
+    if (!packed[i] ||
+        workout_path(data_fname,sizeof(data_fname),dir,TIMER_DATA_PREFIX,workouts[i]))
+      continue;
+
+    // edited while we were packing it, keep it on the card and pack it next time
+    if (stat(data_fname,&st) || st.st_mtime != mtimes[i])
+      continue;
+
+    unlink(data_fname);
+
+    if (!workout_path(data_fname,sizeof(data_fname),dir,META_DATA_PREFIX,workouts[i]))
+      unlink(data_fname);
+  }
+
+  LOGI("Packed %u of %u workouts into %s", n_packed, n, fname);
+  res = (n_packed < n);
+err:
+  if (fd >= 0)
+    close(fd);
+
+  free(index);
+  free(mtimes);
+  free(packed);
+  pthread_mutex_unlock(&pack_write_lock);
+  return res;
+}
+
+char** pack_list_workouts(const char* dir, Mem_pool* pool, uint* n)
+{
+  char** res = 0;
+  uint i;
+
+  *n = 0;
+  pthread_mutex_lock(&pack_lock);
+
+  if (load_index(dir) || !pack_n)
+    goto done;
+
+  if (!(res = (char**)mem_pool_alloc(pool,pack_n * sizeof(char*))))
+    goto done;
+
+  for (i = 0; i < pack_n; i++)
+  {
+    if (!(res[i] = mem_pool_dup(pool,pack_index[i].workout,TRACK_TS_LEN + 1)))
+    {
+      res = 0;
+      goto done;
+    }
+  }
+
+  *n = pack_n;
+done:
+  pthread_mutex_unlock(&pack_lock);
+  return res;
+}
@@ -0,0 +1,31 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <sys/types.h>
+#include "mem_pool.h"
+
+/*
+  Archive tier for old workouts. The timer and meta data of a workout are deflated into
+  a block of their own and appended to PACK_FILE, followed by a fresh copy of the index.
+  The header at the start of the file points at the current index and is rewritten only
+  once everything after it is on the card, so a crash in the middle of an append loses
+  nothing packed before. A workout packed again after an edit replaces its index entry,
+  the old block stays behind as garbage.
+
+  dir is the data directory, with or without the trailing slash.
+*/
+
+#define PACK_FILE "workouts.pack"
+#define PACK_MAGIC "FRFPACK1"
+#define PACK_LEVEL 9 /* packing runs in the background, inflating costs the same */
+
+/* timer data followed by meta data in a malloc()ed buffer with a NUL after it */
+int pack_read_workout(const char* dir, const char* workout, char** buf, uint* timer_size,
+                      uint* meta_size);
+/* writes the timer and meta files of a packed workout back to the directory */
+int pack_restore_workout(const char* dir, const char* workout);
+/* packs the timer and meta files of the workouts and removes them */
+int pack_add_workouts(const char* dir, char** workouts, uint n);
+char** pack_list_workouts(const char* dir, Mem_pool* pool, uint* n);
+
+#endif
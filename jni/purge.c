@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "purge.h"
+#include "archive.h"
+#include "pack.h"
+#include "timer.h"
+#include "track.h"
+#include "log.h"
+
+typedef struct
+{
+  char dir[PATH_MAX+1];
+  int expire_days,archive_days;
+} Purge_job;
+
+typedef enum {PURGE_EXPIRE,PURGE_ARCHIVE} Purge_class;
+
+static volatile int purge_running = 0;
+
+static int is_config_file(const char* name)
+{
+  size_t len = strlen(name);
+
+  return len >= 4 && !strcmp(name + len - 4,".cnf");
+}
+
+static int has_prefix(const char* name, const char* prefix)
+{
+  return !strncmp(name,prefix,strlen(prefix));
+}
+
+/* the oldest file of each class the last pass kept, only if it was archiving as we are */
+static int read_mark(int dir_fd, int archive, time_t* mark)
+{
+  char buf[64];
+  long long expire_t, archive_t;
+  int mark_archive;
+  ssize_t n;
+  int fd;
+
+  if ((fd = openat(dir_fd,PURGE_MARK_FILE,O_RDONLY)) < 0)
+    return 1;
+
+  n = read(fd,buf,sizeof(buf) - 1);
+  close(fd);
+
+  if (n <= 0)
+    return 1;
+
+  buf[n] = 0;
+
+  if (sscanf(buf,"%lld %lld %d",&expire_t,&archive_t,&mark_archive) != 3 ||
+      expire_t <= 0 || archive_t <= 0 || mark_archive != archive)
+    return 1;
+
+  mark[PURGE_EXPIRE] = (time_t)expire_t;
+  mark[PURGE_ARCHIVE] = (time_t)archive_t;
+  return 0;
+}
+
+static void write_mark(int dir_fd, int archive, const time_t* mark)
+{
+  char buf[64];
+  int fd, len = snprintf(buf,sizeof(buf),"%lld %lld %d\n",(long long)mark[PURGE_EXPIRE],
+                         (long long)mark[PURGE_ARCHIVE],archive);
+
+  if ((fd = openat(dir_fd,PURGE_MARK_FILE,O_WRONLY|O_CREAT|O_TRUNC,0644)) < 0)
+  {
+    LOGE("Could not write %s (%d)", PURGE_MARK_FILE, errno);
+    return;
+  }
+
+  if (write(fd,buf,len) != len)
+    LOGE("Could not write %s (%d)", PURGE_MARK_FILE, errno);
+
+  close(fd);
+}
+
+static int add_workout(char*** workouts, uint* n, uint* size, const char* ts)
+{
+  if (strlen(ts) <= TRACK_TS_LEN || ts[TRACK_TS_LEN] != '.')
+    return 1;
+
+  if (*n == *size)
+  {
+    uint new_size = *size ? *size * 2 : 64;
+    char** p;
+
+    if (!(p = (char**)realloc(*workouts,new_size * sizeof(char*))))
+      return 1;
+
+    *workouts = p;
+    *size = new_size;
+  }
+
+  if (!((*workouts)[*n] = strndup(ts,TRACK_TS_LEN)))
+    return 1;
+
+  (*n)++;
+  return 0;
+}
+
+static int purge_dir(Purge_job* job)
+{
+  DIR* d;
+  struct dirent* e;
+  int dir_fd, archive = job->archive_days > 0;
+  time_t now, cutoff[2], mark[2], oldest[2] = {0,0};
+  char** workouts = 0;
+  uint n = 0, n_stat = 0, n_removed = 0, n_workouts = 0, size = 0, i;
+
+  time(&now);
+  cutoff[PURGE_EXPIRE] = now - (time_t)job->expire_days * 86400;
+  cutoff[PURGE_ARCHIVE] = now - (time_t)job->archive_days * 86400;
+
+  if (!(d = opendir(job->dir)))
+  {
+    LOGE("opendir() failed while removing expired files");
+    return 1;
+  }
+
+  dir_fd = dirfd(d);
+
+  // nothing the last pass kept is due, and anything written since is newer
+  if (!read_mark(dir_fd,archive,mark) && mark[PURGE_EXPIRE] >= cutoff[PURGE_EXPIRE] &&
+      (!archive || mark[PURGE_ARCHIVE] >= cutoff[PURGE_ARCHIVE]))
+  {
+    LOGI("No files due to expire or be archived");
+    closedir(d);
+    return 0;
+  }
+
+  while ((e = readdir(d)))
+  {
+    struct stat st;
+    const char* ts;
+    time_t t;
+    Purge_class c = PURGE_EXPIRE;
+
+    if (++n % PURGE_BATCH == 0)
+      usleep(PURGE_INTERVAL * 1000);
+
+    if (*e->d_name == '.' || is_config_file(e->d_name) || !strcmp(e->d_name,PACK_FILE))
+      continue;
+
+    if (archive)
+    {
+      // meta data goes into the pack with its timer data
+      if (has_prefix(e->d_name,META_DATA_PREFIX))
+        continue;
+
+      if (has_prefix(e->d_name,TIMER_DATA_PREFIX))
+        c = PURGE_ARCHIVE;
+    }
+
+    // the name says it is too new to be due, no need to ask the card
+    if ((ts = archive_name_ts(e->d_name)) && !track_parse_ts(ts,&t) &&
+        (t -= PURGE_NAME_SLACK) >= cutoff[c])
+      goto keep;
+
+    n_stat++;
+
+    if (fstatat(dir_fd,e->d_name,&st,0))
+    {
+      LOGE("Error reading %s entry during expired file purge", e->d_name);
+      continue;
+    }
+
+    if (!S_ISREG(st.st_mode))
+      continue;
+
+    if (st.st_mtime < cutoff[c])
+    {
+      if (c == PURGE_ARCHIVE)
+      {
+        if (add_workout(&workouts,&n_workouts,&size,ts))
+          LOGE("Could not queue %s for the pack", e->d_name);
+
+        continue;
+      }
+
+      if (unlinkat(dir_fd,e->d_name,0))
+        LOGE("Could not remove %s", e->d_name);
+      else
+        n_removed++;
+
+      continue;
+    }
+
+    t = st.st_mtime;
+keep:
+    if (!oldest[c] || t < oldest[c])
+      oldest[c] = t;
+  }
+
+  for (i = 0; i < 2; i++)
+    mark[i] = oldest[i] ? oldest[i] : now;
+
+  // whatever did not make it into the pack is due again on the next start
+  if (n_workouts && pack_add_workouts(job->dir,workouts,n_workouts))
+    mark[PURGE_ARCHIVE] = 1;
+
+  write_mark(dir_fd,archive,mark);
+  closedir(d);
+  LOGI("Expired file purge: %u entries, %u checked, %u removed, %u archived", n, n_stat,
+       n_removed, n_workouts);
+
+  for (i = 0; i < n_workouts; i++)
+    free(workouts[i]);
+
+  free(workouts);
+  return 0;
+}
+
+static void* purge_thread(void* arg)
+{
+  Purge_job* job = (Purge_job*)arg;
+
+  // on Linux this only applies to the calling thread
+  if (setpriority(PRIO_PROCESS,syscall(__NR_gettid),PURGE_NICE))
+    LOGE("Could not lower purge thread priority (%d)", errno);
+
+  purge_dir(job);
+  free(job);
+  __sync_lock_release(&purge_running);
+  return 0;
+}
+
+int purge_start(const char* dir, int expire_days, int archive_days)
+{
+  Purge_job* job = 0;
+  pthread_t thread;
+  pthread_attr_t attr;
+  size_t len = strlen(dir);
+
+  if (__sync_lock_test_and_set(&purge_running,1))
+    return 0;
+
+  if (len >= sizeof(job->dir) || !(job = (Purge_job*)malloc(sizeof(*job))))
+    goto err;
+
+  memcpy(job->dir,dir,len + 1);
+  job->expire_days = expire_days;
+  job->archive_days = archive_days;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&thread,&attr,purge_thread,job))
+  {
+    LOGE("Could not start expired file purge thread");
+    pthread_attr_destroy(&attr);
+    goto err;
+  }
+
+  pthread_attr_destroy(&attr);
+  return 0;
+err:
+  free(job);
+  __sync_lock_release(&purge_running);
+  return 1;
+}
@@ -0,0 +1,23 @@
+#ifndef PURGE_H
+#define PURGE_H
+
+#include <time.h>
+
+/*
+  Removes data files older than expire_files_days from a low priority thread, a batch of
+  directory entries at a time, so app start does not wait on the card. Timer and meta
+  data are not removed but moved into the pack once older than archive_after_days, unless
+  that is 0. The oldest file of each kind a full pass leaves behind is remembered in
+  PURGE_MARK_FILE, and until one of them is due the directory is not read at all.
+*/
+
+#define PURGE_BATCH 32 /* directory entries per wake-up */
+#define PURGE_INTERVAL 100 /* ms between batches */
+#define PURGE_NICE 10
+#define PURGE_MARK_FILE ".purge_mark"
+/* a file is never modified before the time in its name, give or take a clock change */
+#define PURGE_NAME_SLACK (24 * 3600)
+
+int purge_start(const char* dir, int expire_days, int archive_days);
+
+#endif
@@ -4,16 +4,28 @@
 #include <errno.h>
 #include <termios.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "sirf_gps.h"
 
 #include "log.h"
+#include "metrics.h"
+#include "config_vars.h"
 
-#define PACKET_MSG "SiRF GPS packet dump: "
-#define PACKET_MSG_LEN strlen(PACKET_MSG)
+#define DUMP_BYTES_PER_LINE 24
 
+/* one receiver, one lock for its command queue and stop flag */
+static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int write_msg(Gps_sirf_session* s, byte* msg, uint msg_len);
+static int read_data(Gps_sirf_session* s);
+
+#if FRF_LOG_LEVEL <= FRF_LOG_DEBUG
 static char hexdigit(uint c)
 {
   if (c < 10)
@@ -21,6 +33,7 @@ static char hexdigit(uint c)
 
   return 'A' + (c - 10);
 }
+#endif
 
 static int write_to_file(char* fname, char* str, uint len)
 {
@@ -35,39 +48,45 @@ static int write_to_file(char* fname, char* str, uint len)
   if (write(fd, str, len) != len)
   {
     LOGE("Write of %u bytes to %s failed (%d):", len, fname, errno);
-    return 0;
+    close(fd);
+    return 1;
   }
 
   close(fd);
+  return 0;
 }
 
+#if FRF_LOG_LEVEL <= FRF_LOG_DEBUG
 static void dump_packet(byte* packet, uint len)
 {
-  char* buf = (char*)malloc(PACKET_MSG_LEN + len * 3 + 1);
-  char* p, *p_end, *bp;
+  char buf[DUMP_BYTES_PER_LINE * 3 + 1];
+  byte* p, *p_end = packet + len;
+  uint offset = 0;
 
-  if (!buf)
+  // one log line per chunk so the dump fits in a log ring slot
+  for (p = packet; p < p_end; offset += DUMP_BYTES_PER_LINE)
   {
-    LOGE("OOM trying to dump SiRF GPS packet");
-    return;
-  }
+    char* bp = buf;
+    byte* chunk_end = p + DUMP_BYTES_PER_LINE;
 
-  p_end = packet + len;
-  memcpy(buf,PACKET_MSG,PACKET_MSG_LEN);
-  bp = buf + PACKET_MSG_LEN;
+    if (chunk_end > p_end)
+      chunk_end = p_end;
 
-  for (p = packet; p < p_end; p++)
-  {
-    uint c = *p;
-    *bp++ = hexdigit((c & 0xf0) >> 4);
-    *bp++ = hexdigit(c & 0x0f);
-    *bp++ = ' ';
-  }
+    for (; p < chunk_end; p++)
+    {
+      uint c = *p;
+      *bp++ = hexdigit((c & 0xf0) >> 4);
+      *bp++ = hexdigit(c & 0x0f);
+      *bp++ = ' ';
+    }
 
-  *bp = 0;
-  LOGE(buf);
-  free(buf);
+    *bp = 0;
+    LOGD("SiRF GPS packet dump %04x: %s", offset, buf);
+  }
 }
+#else
+#define dump_packet(packet,len)
+#endif
 
 static void mem_end(Gps_sirf_session* s)
 {
@@ -78,10 +97,72 @@ static void mem_end(Gps_sirf_session* s)
   }
 }
 
-int gps_sirf_init(Gps_sirf_session* s)
+static int add_to_epoll(Gps_sirf_session* s, int fd)
+{
+  struct epoll_event ev;
+
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(s->epoll_fd,EPOLL_CTL_ADD,fd,&ev) != 0;
+}
+
+/* wakes up the reader thread, with cmd_lock held */
+static void kick(Gps_sirf_session* s)
+{
+  uint64_t one = 1;
+
+  if (write(s->event_fd,&one,sizeof(one)) != sizeof(one))
+    LOGE("Error waking up the GPS SiRF thread (%d)", errno);
+}
+
+/*
+  Binary protocol, no line discipline. The read returns once vmin bytes are in or the
+  line has been quiet for vtime tenths of a second after the first byte, so a burst of
+  messages comes in one read rather than one wake up per byte.
+*/
+static int set_raw(Gps_sirf_session* s)
 {
-  uint resp_len;
   struct termios tty_opts;
+  int vmin = config_get_sirf_vmin(), vtime = config_get_sirf_vtime();
+
+  if (tcgetattr(s->fd, &tty_opts))
+  {
+    LOGE("Error %d getting GPS SiRF tty attributes", errno);
+    return 1;
+  }
+
+  cfmakeraw(&tty_opts);
+  tty_opts.c_cflag |= CLOCAL | CREAD;
+  tty_opts.c_cc[VMIN] = (vmin < 0) ? 0 : (vmin > 255 ? 255 : vmin);
+  tty_opts.c_cc[VTIME] = (vtime < 0) ? 0 : (vtime > 255 ? 255 : vtime);
+  (void)cfsetispeed(&tty_opts, B1500000);
+  (void)cfsetospeed(&tty_opts, B1500000);
+
+  if (tcsetattr(s->fd, TCSANOW, &tty_opts))
+  {
+    LOGE("Error %d setting GPS SiRF tty attributes", errno);
+    return 1;
+  }
+
+  // whatever came in cooked before this is garbage
+  (void)tcflush(s->fd, TCIFLUSH);
+  return 0;
+}
+
+/* config path if set, else where the MotoACTV has it */
+static const char* dev_path(char* buf, void (*get)(char*), const char* def)
+{
+  get(buf);
+  return *buf ? buf : def;
+}
+
+int gps_sirf_init(Gps_sirf_session* s)
+{
+  char path[CONFIG_STR_SIZE];
+  const char* tty;
+
+  s->fd = s->standby_fd = s->reset_fd = s->epoll_fd = s->event_fd = -1;
 
   if (!(s->msg_buf = (byte*)malloc(GPS_SIRF_MSG_BUF_SIZE)))
   {
@@ -92,36 +173,104 @@ int gps_sirf_init(Gps_sirf_session* s)
   s->msg_buf_end = s->msg_buf + GPS_SIRF_MSG_BUF_SIZE;
   s->cur_p = s->cur_msg = s->msg_buf;
 
-  write_to_file(GPS_SIRF_SLEEP_FILE,"20",2);
-  s->fd = s->standby_fd = s->reset_fd = -1;
+  if ((s->event_fd = eventfd(0,EFD_NONBLOCK)) < 0 || (s->epoll_fd = epoll_create(2)) < 0 ||
+      add_to_epoll(s,s->event_fd))
+  {
+    LOGE("Error setting up GPS SiRF events (%d)", errno);
+    return 1;
+  }
+
+  pthread_mutex_lock(&cmd_lock);
+  s->cmd_head = s->cmd_tail = 0;
+  s->stop = 0;
+  s->active = 1;
+  pthread_mutex_unlock(&cmd_lock);
 
-  if ((s->fd = open(GPS_SIRF_TTY,O_RDWR|O_NOCTTY)) < 0)
+  write_to_file((char*)dev_path(path,config_get_sirf_sleep_file,GPS_SIRF_SLEEP_FILE),"20",2);
+  tty = dev_path(path,config_get_sirf_tty,GPS_SIRF_TTY);
+
+  if ((s->fd = open(tty,O_RDWR|O_NOCTTY)) < 0)
   {
-    LOGE("Error opening GPS SiRF device %s (%d)", GPS_SIRF_TTY, errno);
-    mem_end(s);
+    LOGE("Error opening GPS SiRF device %s (%d)", tty, errno);
     return 1;
   }
 
   // attempt exclusive access
   (void)ioctl(s->fd, (unsigned long)TIOCEXCL);
 
-  if (tcgetattr(s->fd, &tty_opts) == 0)
-  {
-    (void)cfsetispeed(&tty_opts, B1500000);
-    (void)cfsetospeed(&tty_opts, B1500000);
-    (void)tcsetattr(s->fd, TCSANOW, &tty_opts);
-  }
+  if (set_raw(s))
+    return 1;
+
+  memset(&s->measure,0,sizeof(s->measure));
+  s->measure.on = config_get_sirf_measure();
 
   if (gps_sirf_init_pin_magic(s))
   {
     LOGE("Error doing the initial pin magic on GPS SiRF device");
-    mem_end(s);
+    return 1;
+  }
+
+  if (add_to_epoll(s,s->fd))
+  {
+    LOGE("Error watching GPS SiRF device (%d)", errno);
     return 1;
   }
 
   return 0;
 }
 
+static void handle_msg(Gps_sirf_session* s, Gps_sirf_msg* msg)
+{
+  switch (msg->id)
+  {
+    case SIRF_OK_TO_SEND:
+      LOGI("GPS SiRF got OK_TO_SEND");
+
+      if (gps_sirf_send(s,(byte*)"\x84\x00",2))
+      {
+        LOGE("Error requesting GPS SiRF software version");
+      }
+      break;
+    default:
+      LOGD("Got GPS SiRF message ID %u of length %u", (uint)msg->id, msg->len);
+      dump_packet(msg->data, msg->len);
+      break;
+  }
+
+  if (s->on_msg)
+    s->on_msg(s->on_msg_arg,msg);
+}
+
+/* sends what was queued, 1 when asked to stop */
+static int handle_events(Gps_sirf_session* s)
+{
+  uint64_t n;
+  Gps_sirf_cmd cmd;
+  int stop;
+
+  // clear the counter first, a kick after this wakes us up again
+  (void)read(s->event_fd,&n,sizeof(n));
+  pthread_mutex_lock(&cmd_lock);
+
+  while (!s->stop && s->cmd_head != s->cmd_tail)
+  {
+    cmd = s->cmds[s->cmd_head];
+    s->cmd_head = (s->cmd_head + 1) % GPS_SIRF_CMD_QUEUE;
+
+    // the tty can block, do not make other threads wait for it
+    pthread_mutex_unlock(&cmd_lock);
+
+    if (write_msg(s,cmd.data,cmd.len))
+      LOGE("Error sending GPS SiRF message ID %u", (uint)cmd.data[0]);
+
+    pthread_mutex_lock(&cmd_lock);
+  }
+
+  stop = s->stop;
+  pthread_mutex_unlock(&cmd_lock);
+  return stop;
+}
+
 int gps_sirf_loop(Gps_sirf_session* s)
 {
   Gps_sirf_msg msg;
@@ -132,43 +281,105 @@ int gps_sirf_loop(Gps_sirf_session* s)
     return 1;
   }
 
-  s->done = 0;
+  if (gps_sirf_set_msg_rates(s))
+  {
+    LOGE("SiRF GPS: Error setting message rates");
+    return 1;
+  }
 
-  for (; !s->done ;)
+  for (;;)
   {
-    if (gps_sirf_read(s,&msg))
+    struct epoll_event ev[2];
+    int i,n;
+
+    // nothing to do until the receiver talks or another thread wants something
+    if ((n = epoll_wait(s->epoll_fd,ev,2,-1)) < 0)
     {
-      sleep(1);
-      continue;
+      if (errno == EINTR)
+        continue;
+
+      LOGE("Error %d waiting for SiRF GPS events", errno);
+      return 1;
     }
 
-    switch (msg.id)
+    for (i = 0; i < n; i++)
     {
-      case SIRF_OK_TO_SEND:
-        LOGE("GPS SiRF got OK_TO_SEND");
-
-        if (gps_sirf_write(s,"\x84\x00",2))
-        {
-          LOGE("Error requesting GPS SiRF software version");
-        }
-        break;
-      default:
-        LOGE("Got GPS SiRF message ID %u of length %u", (uint)msg.id, msg.len);
-        dump_packet(msg.data, msg.len);
-        break;
+      if (ev[i].data.fd == s->event_fd)
+      {
+        if (handle_events(s))
+          return 0;
+
+        continue;
+      }
+
+      if (ev[i].events & (EPOLLERR|EPOLLHUP))
+      {
+        LOGE("SiRF GPS device went away");
+        return 1;
+      }
+
+      if (read_data(s) < 0)
+        return 1;
+
+      while (!gps_sirf_read(s,&msg))
+        handle_msg(s,&msg);
     }
   }
 
   return 0;
 }
 
+int gps_sirf_send(Gps_sirf_session* s, byte* msg, uint msg_len)
+{
+  int res = 1;
+
+  if (msg_len > GPS_SIRF_MAX_CMD)
+  {
+    LOGE("GPS SIRF message of %u bytes is too big", msg_len);
+    return 1;
+  }
+
+  pthread_mutex_lock(&cmd_lock);
+
+  if (!s->active)
+    goto err;
+
+  if ((s->cmd_tail + 1) % GPS_SIRF_CMD_QUEUE == s->cmd_head)
+  {
+    LOGE("GPS SiRF command queue is full");
+    goto err;
+  }
+
+  s->cmds[s->cmd_tail].len = msg_len;
+  memcpy(s->cmds[s->cmd_tail].data,msg,msg_len);
+  s->cmd_tail = (s->cmd_tail + 1) % GPS_SIRF_CMD_QUEUE;
+  kick(s);
+  res = 0;
+err:
+  pthread_mutex_unlock(&cmd_lock);
+  return res;
+}
+
+void gps_sirf_stop(Gps_sirf_session* s)
+{
+  pthread_mutex_lock(&cmd_lock);
+
+  if (s->active)
+  {
+    s->stop = 1;
+    kick(s);
+  }
+
+  pthread_mutex_unlock(&cmd_lock);
+}
+
 
 int gps_sirf_send_hw_cfg_resp(Gps_sirf_session* s)
 {
   // magic string taken from SiRFDrv, TODO: figure out what it actually means
   byte msg[] = {SIRF_HW_CFG_RESP,0x78,0x00,0x05,0xbc,0xa8,0x90,0x00};
 
-  if (gps_sirf_write(s,msg,sizeof(msg)))
+  if (gps_sirf_send(s,msg,sizeof(msg)))
   {
     LOGE("Error responding to GPS SiRF HW config request");
     return 1;
@@ -262,16 +473,20 @@ int gps_sirf_read_ready(Gps_sirf_session* s)
 int gps_sirf_init_pin_magic(Gps_sirf_session* s)
 {
   int i;
+  char path[CONFIG_STR_SIZE];
+  const char* pin = dev_path(path,config_get_sirf_standby,GPS_SIRF_STANDBY);
 
-  if ((s->standby_fd = open(GPS_SIRF_STANDBY,O_RDWR)) < 0)
+  if ((s->standby_fd = open(pin,O_RDWR)) < 0)
   {
-    LOGE("Error opening GPS SiRF device %s (%d)", GPS_SIRF_STANDBY, errno);
+    LOGE("Error opening GPS SiRF device %s (%d)", pin, errno);
     return 1;
   }
 
-  if ((s->reset_fd = open(GPS_SIRF_RESET,O_RDWR)) < 0)
+  pin = dev_path(path,config_get_sirf_reset,GPS_SIRF_RESET);
+
+  if ((s->reset_fd = open(pin,O_RDWR)) < 0)
   {
-    LOGE("Error opening GPS SiRF device %s (%d)", GPS_SIRF_RESET, errno);
+    LOGE("Error opening GPS SiRF device %s (%d)", pin, errno);
     return 1;
   }
 
@@ -294,7 +509,20 @@ int gps_sirf_init_pin_magic(Gps_sirf_session* s)
 }
 
 
-int gps_sirf_write(Gps_sirf_session* s, byte* msg, uint msg_len)
+/* 15 bit sum of the payload bytes */
+static uint checksum(byte* p, uint len)
+{
+  byte* p_end = p + len;
+  uint crc = 0;
+
+  for (; p < p_end; p++)
+    crc += *p;
+
+  return crc & 0x7fff;
+}
+
+/* frames and writes a message, reader thread only */
+static int write_msg(Gps_sirf_session* s, byte* msg, uint msg_len)
 {
   uint crc = 0;
   byte* p,*src_p,*src_p_end = msg + msg_len;
@@ -319,14 +547,14 @@ int gps_sirf_write(Gps_sirf_session* s, byte* msg, uint msg_len)
   }
 
   // store checksum
-  *p++ = (byte)((crc & 0xff00) >> 8);
+  *p++ = (byte)((crc & 0x7f00) >> 8);
   *p++ = (byte)(crc & 0xff);
   *p++ = (byte)0xb0;
   *p++ = (byte)0xb3;
 
   if (write_len != write(s->fd, s->out_buf, write_len))
   {
-    LOGE("Error writing SiRF GPS packet, tried to write %u bytes");
+    LOGE("Error writing SiRF GPS packet, tried to write %u bytes", write_len);
     return 1;
   }
 
@@ -335,150 +563,256 @@ int gps_sirf_write(Gps_sirf_session* s, byte* msg, uint msg_len)
 }
 
 #define GPS_SIRF_MIN_RESP 4
-#define GPS_SIRF_READ_TIMEOUT 1
+#define GPS_SIRF_MID_LOG_SIZE 512
 
-uint read_data(Gps_sirf_session* s)
+/* bytes/s per message ID, the ones that show up are the ones worth turning off */
+static void log_mid_stats(Gps_sirf_measure* m, unsigned long long dt)
 {
-  byte* p;
-  uint len,read_len,bytes_to_read;
-  struct timeval timeout;
-  fd_set rfds;
-  int res;
-  
-  timeout.tv_sec = 1;
-  timeout.tv_usec = 0;
-  FD_ZERO(&rfds);
-  FD_SET(s->fd, &rfds);
-  s->read_wrap = 0;
-  
-  if ((res = select(s->fd + 1, &rfds, 0, 0, &timeout)) < 0)
-  {
-    LOGE("Error %d in select() reading from SiRF GPS", errno);
-    return 0;
-  }
-  else if (res == 0)
+  char buf[GPS_SIRF_MID_LOG_SIZE];
+  char* p = buf,*p_end = buf + sizeof(buf);
+  uint i;
+
+  *p = 0;
+
+  for (i = 0; i < 256 && p < p_end; i++)
   {
-    LOGE("Timeout reading from SiRF GPS");
-    return 0;
+    if (!m->mid_msgs[i])
+      continue;
+
+    p += snprintf(p,p_end - p," %u:%u/%.0f",i,m->mid_msgs[i],m->mid_bytes[i] * 1e6 / dt);
   }
+
+  LOGI("SiRF GPS MID:msgs/bytes per s%s, skipped %.0f bytes/s", buf, m->skipped * 1e6 / dt);
+  memset(m->mid_msgs,0,sizeof(m->mid_msgs));
+  memset(m->mid_bytes,0,sizeof(m->mid_bytes));
+  m->skipped = 0;
+}
+
+static void measure_read(Gps_sirf_session* s, uint len)
+{
+  Gps_sirf_measure* m = &s->measure;
+  unsigned long long now = metrics_now_us(), dt;
+
+  if (!m->start_us)
+    m->start_us = now;
+
+  m->reads++;
+  m->bytes += len;
+
+  if (len > m->max_len)
+    m->max_len = len;
+
+  if ((dt = now - m->start_us) < GPS_SIRF_MEASURE_INTERVAL * 1000ULL)
+    return;
+
+  LOGI("SiRF GPS: %.2f reads/s, %.1f bytes/read, max %u bytes, %.0f bytes/s",
+       m->reads * 1e6 / dt, (double)m->bytes / m->reads, m->max_len, m->bytes * 1e6 / dt);
+  log_mid_stats(m,dt);
+  m->start_us = now;
+  m->reads = m->bytes = m->max_len = 0;
+}
+
+/* what the tty has for us, -1 on error */
+static int read_data(Gps_sirf_session* s)
+{
+  uint space;
+  int res;
   
-  if (ioctl(s->fd,FIONREAD,&bytes_to_read))
+  // everything before cur_msg has been handled, make room at the start of the buffer
+  if (s->msg_buf_end - s->cur_p < GPS_SIRF_MIN_READ && s->cur_msg > s->msg_buf)
   {
-    LOGE("Error fetching number of bytes to read from SiRF GPS");
+    uint read_msg_len = s->cur_p - s->cur_msg;
+
+    memmove(s->msg_buf, s->cur_msg, read_msg_len);
+    s->cur_msg = s->msg_buf;
+    s->cur_p = s->msg_buf + read_msg_len;
   }
-  
-  LOGE("SiRF GPS: %u bytes to read", bytes_to_read);
-  
 
-  // full buffer
-  if (s->cur_p + bytes_to_read > s->msg_buf_end)
+  if (!(space = s->msg_buf_end - s->cur_p))
   {
-    uint read_msg_len = s->cur_p - s->cur_msg;
-    LOGE("Message buffer is full, recyling the beginning");
+    LOGE("SiRF GPS message buffer is full of garbage, dropping it");
+    s->cur_msg = s->cur_p = s->msg_buf;
+    space = GPS_SIRF_MSG_BUF_SIZE;
+  }
 
-    if (s->msg_buf + read_msg_len + bytes_to_read > s->msg_buf_end)
-    {
-      LOGE("Cannot read message of size %u - not enough room in the buffer", bytes_to_read + read_msg_len);
+  // VMIN/VTIME decide when this returns, no need to ask the driver how much is there
+  if ((res = read(s->fd,s->cur_p,space)) < 0)
+  {
+    if (errno == EINTR || errno == EAGAIN)
       return 0;
-    }
 
-    if (read_msg_len)
-    {
-      memcpy(s->msg_buf, s->cur_msg, read_msg_len);
-    }
-
-    s->cur_msg = s->msg_buf;
-    s->cur_p = s->msg_buf;
-    s->read_wrap = 1;
+    LOGE("Error %d reading from SiRF GPS", errno);
+    return -1;
   }
 
-  if (read(s->fd,s->cur_p,bytes_to_read) != bytes_to_read)
-  {
-    LOGE("I thought SiRF GPS had %u bytes to read! (%d)", bytes_to_read, errno);
-    return 0;
-  }
+  LOGD("SiRF GPS: read %d bytes", res);
+
+  if (s->measure.on)
+    measure_read(s,res);
 
-  dump_packet(s->cur_p, bytes_to_read);
-  s->cur_p += bytes_to_read;
-  return bytes_to_read;
+  dump_packet(s->cur_p, res);
+  s->cur_p += res;
+  return res;
 }
 
-int gps_sirf_read(Gps_sirf_session* s, Gps_sirf_msg* msg)
+/* the header at p is not a message start after all, resync past it */
+static void skip_frame_start(Gps_sirf_session* s, byte* p)
 {
-  byte* p;
-  uint len = 0;
+  if (s->measure.on)
+    s->measure.skipped += 2;
 
-  int parsed_header = 0;
-  int should_read_fd = (s->cur_p == s->cur_msg);
+  s->cur_msg = p + 2;
+}
 
+static int gps_sirf_read_low(Gps_sirf_session* s, Gps_sirf_msg* msg)
+{
   for (;;)
   {
-    uint read_len,buf_len;
+    byte* p = s->cur_msg;
+    uint len;
 
-    if (should_read_fd && (read_len = read_data(s)) == 0)
-      return 1;
+    for (; p + 1 < s->cur_p && (*p != 0xa0 || p[1] != 0xa2); p++) /*empty */;
 
-    buf_len = s->cur_p - s->cur_msg;
+    if (s->measure.on)
+      s->measure.skipped += p - s->cur_msg;
 
-    if (!parsed_header && buf_len >= GPS_SIRF_MIN_RESP)
-    {
-      p = s->cur_msg;
+    // a lone 0xa0 at the end may be the start of the next message
+    s->cur_msg = p;
 
-      for (; p < s->cur_p - 2 && (*p != 0xa0 || p[1] != 0xa2); p++) /*empty */;
+    if (s->cur_p - p < GPS_SIRF_MIN_RESP)
+      break;
 
-      if (*p != 0xa0 || p[1] != 0xa2)
-      {
-        s->cur_msg = s->cur_p;
-        should_read_fd = 1;
-        continue;
-      }
+    len = ((uint)(p[2]) << 8) + (uint)p[3];
+    LOGD("SiRF GPS: len=%u", len);
 
-      s->cur_msg = p;
+    if (len > GPS_SIRF_MAX_PAYLOAD)
+    {
+      LOGW_RL(5000,"Bad length %u in SiRF GPS response", len);
+      skip_frame_start(s,p);
+      continue;
+    }
+
+    // header, body, checksum and trailer
+    if (s->cur_p - p < len + 8)
+      break;
 
-      len = ((uint)(p[2]) << 8) + (uint)p[3];
-      LOGE("SiRF GPS: len=%u", len);
-      parsed_header = 1;
+    if (p[len + 6] != 0xb0 || p[len + 7] != 0xb3)
+    {
+      LOGW_RL(5000,"Bad trailing magic in SiRF GPS response");
+      dump_packet(p,len + 8);
+      skip_frame_start(s,p);
+      continue;
     }
 
-    if (parsed_header && len + 4 <= s->cur_p - s->cur_msg)
+    if (checksum(p + 4,len) != (((uint)p[len + 4] << 8) | p[len + 5]))
     {
-      p += 4 + len + 2; // skip the header, body, and checksum
+      LOGW_RL(5000,"Bad checksum in SiRF GPS response");
+      skip_frame_start(s,p);
+      continue;
+    }
 
-      if (*p != 0xb0 || p[1] != 0xb3)
-      {
-        LOGE("Bad trailing magic in SiRF GPS response");
-        dump_packet(s->cur_msg,buf_len);
-        s->cur_msg = p + 2;
-        should_read_fd = 1;
-        parsed_header = 0;
-        continue;
-      }
+    msg->id = p[4];
+    msg->data = p + 5;
+    msg->len = len;
+    s->cur_msg = p + len + 8;
 
-      break;
+    if (s->measure.on)
+    {
+      s->measure.mid_msgs[msg->id]++;
+      s->measure.mid_bytes[msg->id] += len + 8;
     }
-
-    // if we had enough in the buffer to parse out the message we would not have gotten here
-    should_read_fd = 1;
+    return 0;
   }
 
-  msg->id = s->cur_msg[4];
-  msg->data = s->cur_msg + 5;
-  msg->len = len;
-  s->cur_msg += len + 8;
-  return 0;
+  // nothing half read, the next read can start at the beginning of the buffer
+  if (s->cur_msg == s->cur_p)
+    s->cur_msg = s->cur_p = s->msg_buf;
+
+  return 1;
+}
+
+int gps_sirf_read(Gps_sirf_session* s, Gps_sirf_msg* msg)
+{
+  unsigned long long start_us = metrics_now_us();
+  int res = gps_sirf_read_low(s,msg);
+
+  metric_record(METRIC_GPS_SIRF_READ,start_us,res);
+  return res;
 }
 
 int gps_sirf_init_data_source(Gps_sirf_session* s)
 {
-  char buf[25];
+  byte buf[25];
   memset(buf,0,sizeof(buf));
   buf[0] = SIRF_INIT_DATA_SRC;
   buf[24] = 4; // reset all history
-  return gps_sirf_write(s,buf,sizeof(buf));
+  return gps_sirf_send(s,buf,sizeof(buf));
+}
+
+/* periodic output the app does not read, everything else is left at the default */
+static const byte unused_mids[] =
+{
+  SIRF_NAV, // MID 41 has all of it and more
+  4, // tracker data
+  7, // clock status
+  9, // CPU throughput
+  13, // visible list
+  27, // DGPS status
+  28,29,30,31, // navigation library
+  50, // SBAS parameters
+};
+
+static int set_msg_rate(Gps_sirf_session* s, byte mode, byte mid, byte rate)
+{
+  byte buf[8];
+
+  memset(buf,0,sizeof(buf));
+  buf[0] = SIRF_SET_MSG_RATE;
+  buf[1] = mode;
+  buf[2] = mid;
+  buf[3] = rate;
+  return gps_sirf_send(s,buf,sizeof(buf));
+}
+
+int gps_sirf_set_msg_rates(Gps_sirf_session* s)
+{
+  long rate = (config_get_gps_update_interval() + 500) / 1000;
+  uint i;
+
+  if (!config_get_sirf_rate_control())
+    return 0;
+
+  if (rate < 1)
+    rate = 1;
+  else if (rate > GPS_SIRF_MAX_RATE)
+    rate = GPS_SIRF_MAX_RATE;
+
+  if (set_msg_rate(s,SIRF_RATE_DEBUG_OFF,0,0) ||
+      set_msg_rate(s,SIRF_RATE_ONE,SIRF_GEODETIC_NAV,(byte)rate))
+    return 1;
+
+  for (i = 0; i < sizeof(unused_mids); i++)
+  {
+    if (set_msg_rate(s,SIRF_RATE_ONE,unused_mids[i],0))
+      return 1;
+  }
+
+  LOGI("SiRF GPS: %u message IDs off, fixes every %ld s", i, rate);
+  return 0;
 }
 
 int gps_sirf_end(Gps_sirf_session* s)
 {
+  pthread_mutex_lock(&cmd_lock);
+  s->active = 0;
+  pthread_mutex_unlock(&cmd_lock);
+
+  if (s->epoll_fd >= 0)
+    close(s->epoll_fd);
+
+  if (s->event_fd >= 0)
+    close(s->event_fd);
+
   if (s->fd >= 0)
     close(s->fd);
 
@@ -494,7 +828,7 @@ int gps_sirf_end(Gps_sirf_session* s)
     close(s->reset_fd);
   }
 
-  s->standby_fd = s->reset_fd = s->fd = -1;
+  s->standby_fd = s->reset_fd = s->fd = s->epoll_fd = s->event_fd = -1;
   mem_end(s);
   return 0;
 }
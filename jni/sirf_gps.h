@@ -1,6 +1,7 @@
 #ifndef SIRF_GPS_H
 #define SIRF_GPS_H
 
+/* defaults for the sirf_* device paths in the config */
 #define GPS_SIRF_TTY "/dev/ttyS0"
 #define GPS_SIRF_STANDBY "/dev/gps_standby"
 #define GPS_SIRF_RESET "/dev/gps_reset"
@@ -8,18 +9,20 @@
 
 #define GPS_SIRF_PIN_SLEEP 1000
 #define GPS_SIRF_MSG_BUF_SIZE (128*1024)
+#define GPS_SIRF_MAX_PAYLOAD 2047 /* 11 bit length in the SiRF framing */
+#define GPS_SIRF_MAX_CMD 128
+#define GPS_SIRF_CMD_QUEUE 32 /* room for the rate setup burst */
+#define GPS_SIRF_MIN_READ 4096 /* move the unparsed tail to the start below that much room */
+#define GPS_SIRF_MEASURE_INTERVAL 10000 /* ms between read statistics */
+#define GPS_SIRF_MAX_RATE 30 /* s, the longest MID 166 accepts */
 
 typedef unsigned char byte;
 
 typedef struct
- {
-   int fd,reset_fd,standby_fd;
-   byte out_buf[4096];
-   byte* msg_buf,*msg_buf_end;
-   byte* cur_msg,*cur_p;
-   int read_wrap; // flag to show that the read had to wrap to the start of the buffer
-   volatile int done;
- } Gps_sirf_session;
+  {
+    uint len;
+    byte data[GPS_SIRF_MAX_CMD];
+  } Gps_sirf_cmd;
 
 typedef struct
   {
@@ -28,14 +31,52 @@ typedef struct
     uint len;
   } Gps_sirf_msg;
 
+/* read statistics for tuning VMIN/VTIME, logged when sirf_measure is on */
+typedef struct
+  {
+    int on;
+    unsigned long long start_us;
+    uint reads,bytes,max_len;
+    /* what the parser got, framing included, and what it threw away */
+    uint mid_msgs[256],mid_bytes[256];
+    uint skipped;
+  } Gps_sirf_measure;
+
+/*
+  The reader thread sleeps in epoll_wait() on the tty and an eventfd. Other threads queue
+  commands or ask it to stop through the eventfd, the thread is the only one that touches
+  the tty.
+*/
+typedef struct
+ {
+   int fd,reset_fd,standby_fd;
+   int epoll_fd,event_fd;
+   byte out_buf[GPS_SIRF_MAX_CMD + 8];
+   byte* msg_buf,*msg_buf_end;
+   byte* cur_msg,*cur_p;
+   /* guarded by the command lock in sirf_gps.c */
+   Gps_sirf_cmd cmds[GPS_SIRF_CMD_QUEUE];
+   uint cmd_head,cmd_tail;
+   int active,stop;
+   Gps_sirf_measure measure;
+   /* called on the reader thread for every message after the built in handling */
+   void (*on_msg)(void* arg, Gps_sirf_msg* msg);
+   void* on_msg_arg;
+ } Gps_sirf_session;
+
 int gps_sirf_init(Gps_sirf_session* s);
 int gps_sirf_end(Gps_sirf_session* s);
-int gps_sirf_write(Gps_sirf_session* s, byte* msg, uint msg_len);
+/* queues a message for the reader thread to send, safe from any thread */
+int gps_sirf_send(Gps_sirf_session* s, byte* msg, uint msg_len);
+void gps_sirf_stop(Gps_sirf_session* s);
+/* the next complete message already read from the tty, 1 if there is none */
 int gps_sirf_read(Gps_sirf_session* s, Gps_sirf_msg* msg);
 int gps_sirf_init_pin_magic(Gps_sirf_session* s);
 int gps_sirf_wiggle_reset(Gps_sirf_session* s);
 int gps_sirf_wiggle_standby(Gps_sirf_session* s);
 int gps_sirf_init_data_source(Gps_sirf_session* s);
+/* turns off the messages nobody reads, fixes every gps_update_interval */
+int gps_sirf_set_msg_rates(Gps_sirf_session* s);
 
 /*
 int gps_sirf_read_ready(Gps_sirf_session* s);
@@ -46,9 +87,16 @@ int gps_sirf_send_hw_cfg_resp(Gps_sirf_session* s);
 int gps_sirf_loop(Gps_sirf_session* s);
 
 
+#define SIRF_NAV 0x02
 #define SIRF_OK_TO_SEND 0x12
+#define SIRF_GEODETIC_NAV 0x29
 #define SIRF_HW_CFG_REQ 0x47
 #define SIRF_HW_CFG_RESP 0xd6
 #define SIRF_INIT_DATA_SRC 0x80
+#define SIRF_SET_MSG_RATE 0xa6
+
+/* MID 166 modes */
+#define SIRF_RATE_ONE 0
+#define SIRF_RATE_DEBUG_OFF 4
 
 #endif
\ No newline at end of file
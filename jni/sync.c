@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sync.h"
+#include "pack.h"
+#include "timer.h"
+#include "track.h"
+#include "uthash.h"
+#include "log.h"
+
+typedef struct
+{
+  char workout[TRACK_TS_LEN+1];
+  Sync_seq seq;
+  UT_hash_handle hh;
+} Sync_entry;
+
+typedef struct
+{
+  Sync_entry* entries;
+  Sync_seq last;
+  uint n_lines;
+} Sync_journal;
+
+/*
+  The journal as last read or written by us, so a save only appends a line instead of
+  reading the whole file again. A stat() tells us if the file changed under us, a wiped
+  data directory say, and then it is read again. Guarded by sync_lock.
+*/
+typedef struct
+{
+  Sync_journal j;
+  char dir[PATH_MAX+1];
+  int loaded,have_file;
+  ino_t ino;
+  off_t size;
+} Sync_cache;
+
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static Sync_cache cache;
+
+static int dir_path(char* buf, size_t size, const char* dir, const char* name)
+{
+  size_t len = strlen(dir);
+  const char* sep = (len && dir[len - 1] != '/') ? "/" : "";
+
+  return snprintf(buf,size,"%s%s%s",dir,sep,name) >= (int)size;
+}
+
+static int add_entry(Sync_journal* j, const char* workout, Sync_seq seq)
+{
+  Sync_entry* e;
+
+  HASH_FIND_STR(j->entries,workout,e);
+
+  if (!e)
+  {
+    if (!(e = (Sync_entry*)malloc(sizeof(*e))))
+      return 1;
+
+    strcpy(e->workout,workout);
+    e->seq = seq;
+    HASH_ADD_STR(j->entries,workout,e);
+  }
+  else if (seq > e->seq)
+    e->seq = seq;
+
+  return 0;
+}
+
+static void free_journal(Sync_journal* j)
+{
+  Sync_entry* e, *tmp;
+
+  HASH_ITER(hh,j->entries,e,tmp)
+  {
+    HASH_DEL(j->entries,e);
+    free(e);
+  }
+}
+
+/* with sync_lock held, a missing journal is an empty one */
+static int read_journal(const char* dir, Sync_journal* j)
+{
+  char fname[PATH_MAX+1];
+  char line[64];
+  FILE* fp;
+
+  memset(j,0,sizeof(*j));
+
+  if (dir_path(fname,sizeof(fname),dir,SYNC_JOURNAL_FILE))
+    return 1;
+
+  if (!(fp = fopen(fname,"r")))
+    return errno != ENOENT;
+
+  while (fgets(line,sizeof(line),fp))
+  {
+    Sync_seq seq;
+    char workout[TRACK_TS_LEN+1];
+
+    if (sscanf(line,"%llu %19s",&seq,workout) != 2)
+      continue;
+
+    j->n_lines++;
+
+    if (seq > j->last)
+      j->last = seq;
+
+    if (strlen(workout) == TRACK_TS_LEN && add_entry(j,workout,seq))
+    {
+      LOGE("OOM reading sync journal");
+      fclose(fp);
+      free_journal(j);
+      return 1;
+    }
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+static int seq_compare(Sync_entry* a, Sync_entry* b)
+{
+  return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* one line per workout, the base line keeps the last sequence if it was not a workout's */
+static int compact_journal(const char* dir, Sync_journal* j)
+{
+  char fname[PATH_MAX+1],tmp_fname[PATH_MAX+1];
+  Sync_entry* e;
+  FILE* fp;
+
+  if (dir_path(fname,sizeof(fname),dir,SYNC_JOURNAL_FILE) ||
+      dir_path(tmp_fname,sizeof(tmp_fname),dir,SYNC_JOURNAL_FILE ".tmp"))
+    return 1;
+
+  if (!(fp = fopen(tmp_fname,"w")))
+    return 1;
+
+  HASH_SORT(j->entries,seq_compare);
+  fprintf(fp,"%llu " SYNC_BASE "\n", j->last);
+
+  for (e = j->entries; e; e = e->hh.next)
+    fprintf(fp,"%llu %s\n", e->seq, e->workout);
+
+  if (fclose(fp) || rename(tmp_fname,fname))
+  {
+    LOGE("Error compacting sync journal (%d)", errno);
+    unlink(tmp_fname);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int append_journal(const char* dir, Sync_seq seq, const char* workout)
+{
+  char fname[PATH_MAX+1];
+  FILE* fp;
+  int res = 0;
+
+  if (dir_path(fname,sizeof(fname),dir,SYNC_JOURNAL_FILE) || !(fp = fopen(fname,"a")))
+    return 1;
+
+  if (fprintf(fp,"%llu %s\n", seq, workout) < 0)
+    res = 1;
+
+  if (fclose(fp))
+    res = 1;
+
+  return res;
+}
+
+/* with sync_lock held, remembers what the journal file looks like after we touched it */
+static void note_file(const char* dir)
+{
+  char fname[PATH_MAX+1];
+  struct stat st;
+
+  cache.have_file = !dir_path(fname,sizeof(fname),dir,SYNC_JOURNAL_FILE) && !stat(fname,&st);
+
+  if (cache.have_file)
+  {
+    cache.ino = st.st_ino;
+    cache.size = st.st_size;
+  }
+}
+
+/* with sync_lock held, reads the journal only if it is not the one we have */
+static int load_journal(const char* dir)
+{
+  char fname[PATH_MAX+1];
+  struct stat st;
+  int have_file;
+
+  if (strlen(dir) >= sizeof(cache.dir) || dir_path(fname,sizeof(fname),dir,SYNC_JOURNAL_FILE))
+    return 1;
+
+  have_file = !stat(fname,&st);
+
+  if (cache.loaded && !strcmp(cache.dir,dir) && have_file == cache.have_file &&
+      (!have_file || (st.st_ino == cache.ino && st.st_size == cache.size)))
+    return 0;
+
+  free_journal(&cache.j);
+  cache.loaded = 0;
+
+  if (read_journal(dir,&cache.j))
+    return 1;
+
+  strcpy(cache.dir,dir);
+  cache.loaded = 1;
+  note_file(dir);
+  return 0;
+}
+
+int sync_note_change(const char* dir, const char* workout)
+{
+  Sync_journal* j = &cache.j;
+  int res = 1;
+
+  if (!workout || strlen(workout) != TRACK_TS_LEN)
+    return 1;
+
+  pthread_mutex_lock(&sync_lock);
+
+  if (load_journal(dir))
+    goto err;
+
+  if (add_entry(j,workout,j->last + 1))
+    goto err;
+
+  j->last++;
+
+  if (j->n_lines >= SYNC_MAX_JOURNAL)
+  {
+    if (compact_journal(dir,j))
+      goto err;
+
+    j->n_lines = HASH_COUNT(j->entries) + 1;
+  }
+  else
+  {
+    if (append_journal(dir,j->last,workout))
+      goto err;
+
+    j->n_lines++;
+  }
+
+  res = 0;
+err:
+  if (res)
+  {
+    LOGE("Could not record change of %s for sync", workout);
+    // whatever made it to the card is read again next time
+    cache.loaded = 0;
+  }
+  else
+    note_file(dir);
+
+  pthread_mutex_unlock(&sync_lock);
+  return res;
+}
+
+/* every workout there is, loose or packed */
+static int list_all(const char* dir, Sync_journal* all)
+{
+  DIR* d;
+  struct dirent* d_ent;
+  Mem_pool pool;
+  char** packed;
+  uint n_packed,i;
+  int res = 1;
+
+  if (!(d = opendir(dir)))
+    return 1;
+
+  while ((d_ent = readdir(d)))
+  {
+    const char* ts = d_ent->d_name + strlen(TIMER_DATA_PREFIX);
+    char workout[TRACK_TS_LEN+1];
+
+    if (strncmp(d_ent->d_name,TIMER_DATA_PREFIX,strlen(TIMER_DATA_PREFIX)) ||
+        strlen(ts) <= TRACK_TS_LEN || ts[TRACK_TS_LEN] != '.')
+      continue;
+
+    memcpy(workout,ts,TRACK_TS_LEN);
+    workout[TRACK_TS_LEN] = 0;
+
+    if (add_entry(all,workout,0))
+      goto err;
+  }
+
+  if (mem_pool_init(&pool,RUN_TIMER_MEM_POOL_BLOCK))
+    goto err;
+
+  if ((packed = pack_list_workouts(dir,&pool,&n_packed)))
+  {
+    for (i = 0; i < n_packed; i++)
+    {
+      if (add_entry(all,packed[i],0))
+      {
+        mem_pool_free(&pool);
+        goto err;
+      }
+    }
+  }
+
+  mem_pool_free(&pool);
+  res = 0;
+err:
+  closedir(d);
+  return res;
+}
+
+static char* dup_data(const char* data, uint size)
+{
+  char* res;
+
+  if ((res = (char*)malloc(size ? size : 1)))
+    memcpy(res,data,size);
+
+  return res;
+}
+
+static int add_workout(Archive_stream* s, const char* dir, const char* workout)
+{
+  char name[NAME_MAX+1],meta_name[NAME_MAX+1],fname[PATH_MAX+1];
+  struct stat st;
+
+  snprintf(name,sizeof(name),TIMER_DATA_PREFIX "%s." TIMER_DATA_EXT,workout);
+  snprintf(meta_name,sizeof(meta_name),META_DATA_PREFIX "%s." META_DATA_EXT,workout);
+
+  if (dir_path(fname,sizeof(fname),dir,name))
+    return 1;
+
+  if (!stat(fname,&st))
+  {
+    if (archive_add_file(s,name))
+      return 1;
+
+    if (!dir_path(fname,sizeof(fname),dir,meta_name) && !stat(fname,&st) &&
+        archive_add_file(s,meta_name))
+      return 1;
+  }
+  else
+  {
+    char* buf;
+    uint timer_size,meta_size;
+    int res;
+
+    // gone since it was listed is not an error, it is no longer a change either
+    if (pack_read_workout(dir,workout,&buf,&timer_size,&meta_size))
+      return 0;
+
+    res = archive_add_data(s,name,dup_data(buf,timer_size),timer_size) ||
+      archive_add_data(s,meta_name,dup_data(buf + timer_size,meta_size),meta_size);
+    free(buf);
+
+    if (res)
+      return 1;
+  }
+
+  if (!track_find_gps_file(dir,workout,fname,sizeof(fname)))
+    return archive_add_file(s,strrchr(fname,'/') + 1);
+
+  return 0;
+}
+
+Archive_stream* sync_open(const char* dir, Sync_seq* cursor)
+{
+  Archive_stream* s = 0;
+  Sync_journal j, all;
+  Sync_entry* e;
+  int full;
+
+  memset(&all,0,sizeof(all));
+  memset(&j,0,sizeof(j));
+  pthread_mutex_lock(&sync_lock);
+
+  if (load_journal(dir))
+  {
+    pthread_mutex_unlock(&sync_lock);
+    return 0;
+  }
+
+  if (!cache.j.last)
+  {
+    if (append_journal(dir,1,SYNC_BASE))
+    {
+      cache.loaded = 0;
+      pthread_mutex_unlock(&sync_lock);
+      goto err;
+    }
+
+    cache.j.last = 1;
+    cache.j.n_lines++;
+    note_file(dir);
+  }
+
+  // a cursor from before the journal was lost, or from another phone
+  j.last = cache.j.last;
+  full = (!*cursor || *cursor > j.last);
+
+  // copy what changed after the cursor, the archive is built without the lock
+  for (e = full ? 0 : cache.j.entries; e; e = e->hh.next)
+  {
+    if (e->seq > *cursor && add_entry(&j,e->workout,e->seq))
+    {
+      pthread_mutex_unlock(&sync_lock);
+      goto err;
+    }
+  }
+
+  pthread_mutex_unlock(&sync_lock);
+
+  if (full && list_all(dir,&all))
+    goto err;
+
+  if (!(s = archive_new(dir)))
+    goto err;
+
+  for (e = full ? all.entries : j.entries; e; e = e->hh.next)
+  {
+    if (add_workout(s,dir,e->workout))
+      goto err;
+  }
+
+  if (archive_start(s,1))
+    goto err;
+
+  LOGI("Sync from %llu to %llu%s", *cursor, j.last, full ? ", everything" : "");
+  *cursor = j.last;
+  free_journal(&j);
+  free_journal(&all);
+  return s;
+err:
+  archive_close(s);
+  free_journal(&j);
+  free_journal(&all);
+  return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "archive.h"
+
+/*
+  Change journal behind /sync. Every save of a workout appends its name to
+  SYNC_JOURNAL_FILE under the next sequence number. A client keeps the last sequence it
+  was handed and asks for what changed after it, and gets the timer, meta and GPS data of
+  those workouts as one gzipped tar, packed workouts included. Cursor 0, or one the
+  phone never handed out, gets everything.
+*/
+
+#define SYNC_JOURNAL_FILE ".sync_journal"
+#define SYNC_MAX_JOURNAL 4096 /* lines before it is rewritten with one per workout */
+#define SYNC_BASE "-" /* first line of a new journal, so that a cursor is never 0 */
+
+typedef unsigned long long Sync_seq;
+
+int sync_note_change(const char* dir, const char* workout);
+/* *cursor is the one the client sent, replaced with the one to send next time */
+Archive_stream* sync_open(const char* dir, Sync_seq* cursor);
+
+#endif
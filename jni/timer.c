@@ -1,10 +1,15 @@
 #include "timer.h"
 #include "log.h"
+#include "metrics.h"
+#include "url.h"
+#include "pack.h"
+#include "sync.h"
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <time.h>
+#include <math.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
@@ -213,21 +218,44 @@ void run_timer_deinit(Run_timer* t)
   }
 
   mem_pool_free(&t->mem_pool);
+  free(t->post.buf);
+  bzero(&t->post,sizeof(t->post));
+}
+
+/* the name of the workout the timer writes, buf has room for TRACK_TS_LEN + 1 bytes */
+static int get_workout_ts(Run_timer* t, char* buf)
+{
+  time_t t_start = t->t_start / 1000LL;
+  struct tm tm;
 
-  //no need to iterate through post hash, as it is from mem_pool, so just set to to 0
-  t->post_h = 0;
+  if (t->workout_ts)
+  {
+    snprintf(buf,TRACK_TS_LEN + 1,"%s",t->workout_ts);
+    return 0;
+  }
+
+  if (!t->t_start || !localtime_r(&t_start,&tm) ||
+      strftime(buf,TRACK_TS_LEN + 1,TIMER_DATA_FMT,&tm) != TRACK_TS_LEN)
+    return 1;
+
+  return 0;
 }
 
 int run_timer_reset(Run_timer* t)
 {
   int res;
   const char* tmp = 0;
+  char workout[TRACK_TS_LEN+1];
+  int ended = (t->fp && !get_workout_ts(t,workout));
 
   if (t->fp)
     fputc('\n', t->fp);
 
   run_timer_deinit(t);
 
+  if (ended)
+    sync_note_change(t->file_prefix,workout);
+
   if (!t->file_prefix)
     return 1;
 
@@ -238,7 +266,6 @@ int run_timer_reset(Run_timer* t)
   t->file_prefix = 0;
   res = run_timer_init(t, tmp);
   free((void*)tmp);
-  t->post_h = 0;
   return res;
 }
 
@@ -246,7 +273,7 @@ static int start_split(Run_timer* t, ulonglong ts, double d)
 {
   Run_leg* cur_leg = t->cur_leg;
   Run_split* cur_split = (Run_split*)mem_pool_alloc(&t->mem_pool,sizeof(Run_split));
-  LOGE("start_split(%llu,%.3f)",ts,d);
+  LOGD("start_split(%llu,%.3f)",ts,d);
 
   if (!cur_split)
     return 1;
@@ -258,6 +285,7 @@ static int start_split(Run_timer* t, ulonglong ts, double d)
   // those are initialized and used later in processing POST
   cur_split->d_d = 0.0;
   cur_split->d_t = 0;
+  cur_split->gps = 0;
 
   if (t->fp)
   {
@@ -278,7 +306,7 @@ static int start_split(Run_timer* t, ulonglong ts, double d)
 static int start_leg(Run_timer* t, ulonglong ts, double d)
 {
   Run_leg* cur_leg;
-  LOGE("start_leg(%llu,%.3f)",ts,d);
+  LOGD("start_leg(%llu,%.3f)",ts,d);
   if (!(cur_leg = (Run_leg*)mem_pool_alloc(&t->mem_pool,sizeof(Run_leg))))
     return 1;
 
@@ -311,6 +339,35 @@ int run_timer_split(Run_timer* t, double d)
   return start_split(t,run_timer_now() - t->t_delay - t->t_start,d);
 }
 
+int run_timer_push_dist(Run_timer* t, ulonglong ts, double d, double every_d,
+                        ulonglong every_t)
+{
+  Autolap* a = &t->autolap;
+  Run_split* sp;
+  ulonglong lap_t;
+  double lap_d;
+  uint n = 0;
+
+  if (!t->t_start || t->t_pause || !t->cur_leg || !(sp = t->cur_leg->cur_split))
+    goto done;
+
+  while (n < AUTOLAP_MAX_PER_SAMPLE &&
+         autolap_crossing(a,every_d,every_t,sp->t,sp->d,ts,d,&lap_t,&lap_d))
+  {
+    if (start_split(t,lap_t,lap_d))
+      return 1;
+
+    sp = t->cur_leg->cur_split;
+    a->n_laps++;
+    n++;
+    LOGI("Auto-lap %u at %llu ms, %.3f mi, sample at %llu ms", a->n_laps, lap_t, lap_d, ts);
+  }
+
+done:
+  autolap_note(a,ts,d);
+  return 0;
+}
+
 ulonglong run_timer_now()
 {
   struct timeval t;
@@ -344,7 +401,7 @@ char* run_timer_review_info(Run_timer* t, Run_timer_review_mode mode)
 
   LL_FOREACH(t->first_leg,cur_leg)
   {
-    LOGE("leg split in review:(%llu,%.3f)", cur_leg->first_split->t,cur_leg->first_split->d);
+    LOGD("leg split in review:(%llu,%.3f)", cur_leg->first_split->t,cur_leg->first_split->d);
     if (!cur_leg->next)
       continue;
 
@@ -403,7 +460,8 @@ char** run_timer_run_list(Run_timer* t, Mem_pool* pool,uint* num_entries)
   struct dirent* d_ent;
   RUN_LIST* rl_head = 0,*rl_tmp;
   DIR* d = 0;
-  char** res = 0,**res_p;
+  char** res = 0,**res_p,**packed;
+  uint num_packed,i;
 
   if (!dir_name)
     return 0;
@@ -450,6 +508,23 @@ char** run_timer_run_list(Run_timer* t, Mem_pool* pool,uint* num_entries)
     (*num_entries)++;
   }
 
+  if ((packed = pack_list_workouts(dir_name,pool,&num_packed)))
+  {
+    for (i = 0; i < num_packed; i++)
+    {
+      if (!(rl_tmp = (RUN_LIST*)mem_pool_alloc(pool,sizeof(*rl_tmp))))
+      {
+        LOGE("Error allocating memory");
+        goto err;
+      }
+
+      rl_tmp->name = packed[i];
+      rl_tmp->next = 0;
+      LL_APPEND(rl_head,rl_tmp);
+      (*num_entries)++;
+    }
+  }
+
   LL_SORT(rl_head, rl_compare);
 
   if (!(res = (char**)mem_pool_alloc(pool,sizeof(char*) * (*num_entries+1))))
@@ -459,19 +534,25 @@ char** run_timer_run_list(Run_timer* t, Mem_pool* pool,uint* num_entries)
   }
 
   res_p = res;
-  LOGE("Copying names");
+  LOGD("Copying names");
 
   if (rl_head)
   {
     LL_FOREACH(rl_head,rl_tmp)
     {
-      LOGE("rl_tmp = %p",rl_tmp);
+      LOGD("rl_tmp = %p",rl_tmp);
+
+      // restored from the pack to be edited, it is in both places
+      if (res_p > res && !strcmp(res_p[-1],rl_tmp->name))
+        continue;
+
       *res_p++ = rl_tmp->name;
-      LOGE("Copied %s ", rl_tmp->name);
+      LOGD("Copied %s ", rl_tmp->name);
     }
   }
 
   *res_p = 0;
+  *num_entries = res_p - res;
 
 err:
   if (d)
@@ -577,70 +658,23 @@ err:
   return res;
 }
 
-static int init_meta_file(Run_timer* t, const char* fname)
+/* comments and zones in the format run_timer_save() writes them */
+static void parse_meta(Run_timer* t, char* buf, char* buf_end)
 {
-  FILE* fp;
-  int file_empty = 0;
-  long file_size;
-  char* buf, *p, *buf_end;
+  char* p = buf;
   Run_leg* l;
   Run_split* sp;
 
-  LOGE("Initializing meta file %s", fname);
-
-  if (!(fp = fopen(fname,"r+")))
-  {
-    if (!(fp = fopen(fname,"w+")))
-    {
-      LOGE("Error opening meta file %s", fname);
-      return 1;
-    }
-
-    file_empty = 1;
-  }
-
-  t->meta_fp = fp;
-
-  if (file_empty)
-    return 0;
-
-  fseek(fp,0L,SEEK_END);
-
-  if ((file_size = ftell(fp)) <= 0)
-  {
-    LOGE("Nothing to read from meta file");
-    return 0;
-  }
-
-  rewind(fp);
-
-  // Read errors are not fatal, do not report error - partially read meta file is still usefull
-
-  if (!(buf = (char*)mem_pool_alloc(&t->mem_pool,file_size)))
-  {
-    LOGE("Could not allocate memory buffer to read meta file but can live with it");
-    return 0;
-  }
-
-  if (fread(buf,file_size,1,fp) != 1)
-  {
-    LOGE("Error reading from meta file, but can live with it");
-    return 0;
-  }
-
-  p = buf;
-  buf_end = buf + file_size;
-
   if (read_str(t,&p,buf_end,&t->comment))
   {
     LOGE("Parse error reading workout comment");
-    return 0;
+    return;
   }
 
   if (*p++ != '\n')
   {
     LOGE("No newline after workout comment");
-    return 0;
+    return;
   }
 
   LL_FOREACH(t->first_leg,l)
@@ -648,13 +682,13 @@ static int init_meta_file(Run_timer* t, const char* fname)
     if (read_str(t,&p,buf_end,&l->comment))
     {
       LOGE("Error reading leg comment");
-      return 0;
+      return;
     }
 
     if (*p++ != '\n')
     {
       LOGE("No newline after leg comment");
-      return 0;
+      return;
     }
 
     LL_FOREACH(l->first_split,sp)
@@ -662,28 +696,80 @@ static int init_meta_file(Run_timer* t, const char* fname)
       if (read_uint(&p,buf_end,&sp->zone))
       {
         LOGE("Error reading split zone");
-        return 0;
+        return;
       }
 
       if (*p++ != ',')
       {
         LOGE("Missing comma after split zone");
-        return 0;
+        return;
       }
 
       if (read_str(t,&p,buf_end,&sp->comment))
       {
         LOGE("Error parsing split comment");
-        return 0;
+        return;
       }
 
       if (*p++ != '\n')
       {
         LOGE("Missing newline after split comment");
-        return 0;
+        return;
       }
     }
   }
+}
+
+static int init_meta_file(Run_timer* t, const char* fname)
+{
+  FILE* fp;
+  int file_empty = 0;
+  long file_size;
+  char* buf;
+
+  LOGD("Initializing meta file %s", fname);
+
+  if (!(fp = fopen(fname,"r+")))
+  {
+    if (!(fp = fopen(fname,"w+")))
+    {
+      LOGE("Error opening meta file %s", fname);
+      return 1;
+    }
+
+    file_empty = 1;
+  }
+
+  t->meta_fp = fp;
+
+  if (file_empty)
+    return 0;
+
+  fseek(fp,0L,SEEK_END);
+
+  if ((file_size = ftell(fp)) <= 0)
+  {
+    LOGE("Nothing to read from meta file");
+    return 0;
+  }
+
+  rewind(fp);
+
+  // Read errors are not fatal, do not report error - partially read meta file is still usefull
+
+  if (!(buf = (char*)mem_pool_alloc(&t->mem_pool,file_size)))
+  {
+    LOGE("Could not allocate memory buffer to read meta file but can live with it");
+    return 0;
+  }
+
+  if (fread(buf,file_size,1,fp) != 1)
+  {
+    LOGE("Error reading from meta file, but can live with it");
+    return 0;
+  }
+
+  parse_meta(t,buf,buf + file_size);
   return 0;
 }
 
@@ -696,6 +782,8 @@ int run_timer_init_from_workout(Run_timer* t, const char* file_prefix, const cha
   uint len = strlen(file_prefix);
   uint workout_len = strlen(workout);
   FILE* fp = 0, *save_fp = 0,*meta_fp = 0;
+  char* pack_buf = 0, *in = 0, *in_end = 0;
+  uint timer_size, meta_size;
   ulonglong cur_t = 0;
   double cur_d = 0.0, cur_pow_10 = 0.1;
   int need_start_leg = 1, line_not_empty = 0;
@@ -735,15 +823,30 @@ int run_timer_init_from_workout(Run_timer* t, const char* file_prefix, const cha
 
   if (!(fp = fopen(fname,"r+")))
   {
-    LOGE("Could not open %s for reading", fname);
-    return 1;
+    int missing = (errno == ENOENT);
+
+    // archived workouts are read straight from the pack, and go back on the card to be edited
+    if (missing && init_fp && !pack_restore_workout(file_prefix,workout))
+      fp = fopen(fname,"r+");
+    else if (missing && !init_fp &&
+             !pack_read_workout(file_prefix,workout,&pack_buf,&timer_size,&meta_size))
+    {
+      in = pack_buf;
+      in_end = pack_buf + timer_size;
+    }
+
+    if (!fp && !pack_buf)
+    {
+      LOGE("Could not open %s for reading", fname);
+      return 1;
+    }
   }
 
   for (;;)
   {
-    int c = fgetc(fp);
+    int c = fp ? fgetc(fp) : (in < in_end ? (unsigned char)*in++ : EOF);
 
-    if (feof(fp))
+    if (c == EOF)
     {
       if (need_start_leg && line_not_empty)
       {
@@ -822,6 +925,14 @@ int run_timer_init_from_workout(Run_timer* t, const char* file_prefix, const cha
     }
   }
 
+  if (pack_buf)
+  {
+    parse_meta(t,pack_buf + timer_size,pack_buf + timer_size + meta_size);
+    free(pack_buf);
+    t->fp = save_fp;
+    return 0;
+  }
+
   if (init_meta_file(t,meta_fname))
   {
     LOGE("Error initializing from meta file");
@@ -988,7 +1099,7 @@ static void csv_print(FILE* fp, const char* s)
   fputc('"',fp);
 }
 
-int run_timer_save(Run_timer* t)
+static int run_timer_save_low(Run_timer* t)
 {
   Run_leg* cur_leg;
   Run_split* cur_split;
@@ -1049,172 +1160,453 @@ int run_timer_save(Run_timer* t)
   return 0;
 }
 
-int run_timer_add_key_to_hash(Run_timer* t, const char* key, const char* data, uint size)
+int run_timer_save(Run_timer* t)
 {
-  Url_hash_entry* e = 0;
-  size_t key_len = strlen(key);
+  unsigned long long start_us = metrics_now_us();
+  int res = run_timer_save_low(t);
+  char workout[TRACK_TS_LEN+1];
 
-  HASH_FIND_STR(t->post_h,key,e);
+  metric_record(METRIC_RUN_TIMER_SAVE,start_us,res);
 
-  // append if the entry is present
-  if (e)
-  {
-    uint new_val_len = size + e->val_len;
-    char* new_val;
+  if (!res && !get_workout_ts(t,workout))
+    sync_note_change(t->file_prefix,workout);
 
-    LOGE("Found entry with key '%s' for key '%s'", e->key, key);
+  return res;
+}
 
-    if (!(new_val = (char*)mem_pool_alloc(&t->mem_pool,new_val_len)))
+/* d_t/d_d of each split from the stored cumulative values, as the review form would post them */
+int run_timer_init_deltas(Run_timer* t)
+{
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+
+  LL_FOREACH(t->first_leg,cur_leg)
+  {
+    LL_FOREACH(cur_leg->first_split,cur_split)
     {
-      LOGE("OOM allocating additional space for value");
-      return 1;
-    }
+      Run_split* next = cur_split->next;
 
-    memcpy(new_val,e->val,e->val_len);
-    memcpy(new_val + e->val_len, data, size);
-    new_val[new_val_len] = 0;
-    e->val = new_val;
-    e->val_len = new_val_len;
-    return 0;
-  }
+      if (!next && cur_leg->next)
+        next = cur_leg->next->first_split;
 
-  // if the entry is not present we get here
-  if (!(e = (Url_hash_entry*)mem_pool_alloc(&t->mem_pool,sizeof(*e) + key_len + size + 2)))
-  {
-    LOGE("Out of memory in add_key_to_hash()");
-    return 1;
+      if (next)
+      {
+        cur_split->d_t = next->t - cur_split->t;
+        cur_split->d_d = next->d - cur_split->d;
+      }
+      else
+      {
+        cur_split->d_t = 0;
+        cur_split->d_d = 0.0;
+      }
+    }
   }
 
-  e->key = (char*)(e + 1);
-  e->val = e->key + key_len + 1;
-  memcpy(e->key, key, key_len + 1);
-  memcpy(e->val, data, size);
-  e->val[size] = 0;
-  e->key_len = key_len;
-  e->val_len = size;
-
-  HASH_ADD_KEYPTR(hh,t->post_h,e->key,key_len,e);
   return 0;
 }
 
-int run_timer_parse_keys(Run_timer* t)
+/* replace d_d of every split with the distance the smoothed track covered in its d_t */
+int run_timer_apply_track(Run_timer* t, Track* tr)
 {
-  Url_hash_entry* he;
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+  ulonglong cur_t = 0;
 
-  for (he = t->post_h; he; he = he->hh.next)
+  LL_FOREACH(t->first_leg,cur_leg)
   {
-    if (run_timer_parse_key(t,he))
+    LL_FOREACH(cur_leg->first_split,cur_split)
     {
-      LOGE("Error parsing key %s but we can live with it", he->key);
+      if (cur_split->d_t)
+        cur_split->d_d = track_dist_at(tr,cur_t + cur_split->d_t) - track_dist_at(tr,cur_t);
+
+      cur_t += cur_split->d_t;
     }
   }
 
   return 0;
 }
 
-int run_timer_parse_key(Run_timer* t, Url_hash_entry* he)
+static void split_gps_stats(Run_split_gps* g, Track* tr, ulonglong t_start, ulonglong t_end)
 {
-  char* key = he->key;
-  size_t size = he->val_len;
-  char* data = he->val;
+  uint i, end = g->first + g->n, n_moving = 0;
+  double acc_sum = 0.0, pace_sum = 0.0, pace_sq_sum = 0.0;
+  ulonglong prev_ts = t_start;
+
+  g->n_outliers = 0;
+  g->max_gap = 0;
 
-  if (*key == 't' || *key == 'd' || *key == 'z'|| *key == 'c')
+  for (i = g->first; i < end; i++)
   {
-    uint leg_num = 0,split_num = 0;
-    const char*p = key + 1;
-    Run_split* sp;
+    if (tr->ts[i] - prev_ts > g->max_gap)
+      g->max_gap = tr->ts[i] - prev_ts;
 
-    if (*p++ != '_')
-      goto done;
+    prev_ts = tr->ts[i];
 
-    for (;isdigit(*p);p++)
+    if (tr->outlier[i])
     {
-      leg_num = leg_num*10 + (*p - '0');
+      g->n_outliers++;
+      continue;
     }
 
-    if (*p++ != '_')
-      goto done;
+    acc_sum += tr->accuracy[i];
 
-    for (;isdigit(*p);p++)
+    if (tr->v[i] >= KF_STATIONARY_SPEED)
     {
-      split_num = split_num*10 + (*p - '0');
+      double pace = 1.0 / tr->v[i];
+      pace_sum += pace;
+      pace_sq_sum += pace * pace;
+      n_moving++;
     }
+  }
+
+  if (t_end - prev_ts > g->max_gap)
+    g->max_gap = t_end - prev_ts;
+
+  g->accuracy = (g->n > g->n_outliers) ? acc_sum / (g->n - g->n_outliers) : 0.0;
+  g->pace = (g->d > 0.0) ? (ulonglong)((t_end - t_start) / g->d) : 0;
+  g->pace_cv = 0.0;
+
+  if (n_moving > 1)
+  {
+    double mean = pace_sum / n_moving;
+    double var = pace_sq_sum / n_moving - mean * mean;
+    g->pace_cv = (var > 0.0) ? sqrt(var) / mean : 0.0;
+  }
+
+  if (!g->n || g->max_gap > RUN_SPLIT_GPS_MAX_GAP)
+    g->conf = CONF_SIGNAL_LOST;
+  else if (g->n_outliers > g->n * RUN_SPLIT_GPS_MAX_OUTLIERS)
+    g->conf = CONF_SUSPECT_SIGNAL;
+  else if (g->accuracy > KF_BAD_SIGMA)
+    g->conf = CONF_BAD_SIGNAL;
+  else
+    g->conf = CONF_NORMAL;
+}
 
-    if (split_num == 0 && *key == 'c')
+/*
+  Merge join of the splits with the fixes, both sorted by running time, in one pass.
+  Each split gets the fixes in [t, t of the next split), the end marker split gets none.
+*/
+int run_timer_join_track(Run_timer* t, Track* tr)
+{
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+  uint i = 0, hint = 0;
+
+  LL_FOREACH(t->first_leg,cur_leg)
+  {
+    LL_FOREACH(cur_leg->first_split,cur_split)
     {
-      if (leg_num == 0)
+      Run_split* next = cur_split->next;
+      Run_split_gps* g;
+      ulonglong t_end;
+
+      if (!next && cur_leg->next)
+        next = cur_leg->next->first_split;
+
+      if (!next)
+        continue;
+
+      if (!(g = (Run_split_gps*)mem_pool_alloc(&t->mem_pool,sizeof(*g))))
       {
-        t->comment = (char*)mem_pool_cdup(&t->mem_pool,data,size);
-        goto done;
+        LOGE("OOM joining GPS track");
+        return 1;
       }
-      else
-      {
-        Run_leg* l = run_timer_get_leg(t,leg_num);
 
-        if (!l)
-        {
-          LOGE("Leg %d not found for comment field", leg_num);
-          goto done;
-        }
+      t_end = next->t;
 
-        l->comment = (char*)mem_pool_cdup(&t->mem_pool,data,size);
-        goto done;
-      }
-    }
+      while (i < tr->n && tr->ts[i] < cur_split->t)
+        i++;
 
-    if (!(sp = run_timer_get_split(t,leg_num,split_num)))
-    {
-      LOGE("Split %d for leg %d not found", split_num,leg_num);
-      goto done;
+      g->first = i;
+
+      while (i < tr->n && tr->ts[i] < t_end)
+        i++;
+
+      g->n = i - g->first;
+      g->d = -track_dist_at_hint(tr,&hint,cur_split->t);
+      g->d += track_dist_at_hint(tr,&hint,t_end);
+      split_gps_stats(g,tr,cur_split->t,t_end);
+      cur_split->gps = g;
     }
+  }
+
+  return 0;
+}
 
-    switch (*key)
+int run_timer_load_track(Run_timer* t, const char* gps_dir, Track* tr)
+{
+  char fname[PATH_MAX+1];
+
+  track_init(tr);
+
+  if (!t->workout_ts || track_find_gps_file(gps_dir,t->workout_ts,fname,sizeof(fname)))
+  {
+    LOGW("No GPS track for workout %s", t->workout_ts ? t->workout_ts : "(none)");
+    return 1;
+  }
+
+  if (track_load(tr,fname) || track_smooth(tr))
+  {
+    LOGE("Could not smooth GPS track %s", fname);
+    track_free(tr);
+    return 1;
+  }
+
+  LOGI("Smoothed %u fixes of %s, %.3f miles", tr->n, fname,
+       track_dist_at(tr,tr->ts[tr->n - 1]));
+  return 0;
+}
+
+int run_timer_smooth_workout(const char* file_prefix, const char* gps_dir, const char* workout)
+{
+  Run_timer w;
+  Track tr;
+  int res = 1;
+
+  bzero(&w,sizeof(w));
+
+  if (run_timer_init_from_workout(&w,file_prefix,workout,1))
+  {
+    LOGE("Could not load workout %s to smooth it", workout);
+    goto err;
+  }
+
+  if (run_timer_init_deltas(&w) || run_timer_load_track(&w,gps_dir,&tr))
+    goto err;
+
+  run_timer_apply_track(&w,&tr);
+  track_free(&tr);
+  res = run_timer_save(&w);
+err:
+  run_timer_deinit(&w);
+  return res;
+}
+
+/* where the value of key goes, leaving p->type 0 if it is not a workout field */
+static void post_field_start(Run_timer* t, Run_timer_post* p, const char* key)
+{
+  uint leg_num = 0,split_num = 0;
+  const char* k = key + 1;
+
+  p->type = 0;
+  p->sp = 0;
+  p->comment = 0;
+  p->len = 0;
+
+  if (*key != 't' && *key != 'd' && *key != 'z' && *key != 'c')
+    return;
+
+  if (*k++ != '_')
+    return;
+
+  for (;isdigit(*k);k++)
+  {
+    leg_num = leg_num*10 + (*k - '0');
+  }
+
+  if (*k++ != '_')
+    return;
+
+  for (;isdigit(*k);k++)
+  {
+    split_num = split_num*10 + (*k - '0');
+  }
+
+  if (*k)
+    return;
+
+  if (split_num == 0 && *key == 'c')
+  {
+    if (leg_num == 0)
+      p->comment = &t->comment;
+    else
     {
-      case 't':
-        sp->d_t = run_timer_parse_time(data,size);
-        LOGE("Parsed time %-.*s into %llu ms", size, data, sp->d_t);
-        break;
-      case 'd':
+      Run_leg* l;
+
+      if (!(l = run_timer_get_leg(t,leg_num)))
       {
-        char buf[32];
+        LOGE("Leg %d not found for comment field", leg_num);
+        return;
+      }
 
-        if (size + 1 > sizeof(buf))
-          goto done;
+      p->comment = &l->comment;
+    }
 
-        memcpy(buf,data,size);
-        buf[size] = 0;
-        sp->d_d = atof(buf);
-        break;
+    p->type = 'c';
+    return;
+  }
+
+  if (!leg_num || !split_num || !(p->sp = run_timer_get_split(t,leg_num,split_num)))
+  {
+    LOGE("Split %d for leg %d not found", split_num,leg_num);
+    return;
+  }
+
+  if (*key == 'c')
+    p->comment = &p->sp->comment;
+
+  p->type = *key;
+}
+
+static int post_field_end(Run_timer* t, Run_timer_post* p)
+{
+  Run_split* sp = p->sp;
+
+  if (!p->type)
+    return 0;
+
+  p->buf[p->len] = 0;
+
+  switch (p->type)
+  {
+    case 't':
+      sp->d_t = run_timer_parse_time(p->buf,p->len);
+      LOGD("Parsed time %s into %llu ms", p->buf, sp->d_t);
+      break;
+    case 'd':
+      sp->d_d = atof(p->buf);
+      break;
+    case 'z':
+    {
+      const char* s = p->buf;
+      uint z = 0;
+
+      for (;*s;s++)
+      {
+        z = z * 10 + *s - '0';
       }
-      case 'z':
+
+      sp->zone = z;
+      break;
+    }
+    case 'c':
+      if (!(*p->comment = (char*)mem_pool_cdup(&t->mem_pool,p->buf,p->len)))
       {
-        const char* p = data, *p_end = data + size;
-        uint z = 0;
+        LOGE("OOM saving comment");
+        return 1;
+      }
+      break;
+    default: /* impossible */
+      break;
+  }
 
-        for (;p < p_end;p++)
-        {
-          z = z * 10 + *p - '0';
-        }
+  p->type = 0;
+  return 0;
+}
 
-        sp->zone = z;
-        break;
+/*
+  One chunk of a POST field of the workout form, as the post processor hands them to us.
+  A chunk at offset 0 starts a new field and ends the one before it.
+*/
+int run_timer_post_field(Run_timer* t, const char* key, const char* data, uint64_t off,
+                         size_t size)
+{
+  Run_timer_post* p = &t->post;
+
+  if (!off)
+  {
+    if (post_field_end(t,p))
+      return 1;
+
+    post_field_start(t,p,key);
+  }
+
+  if (!p->type)
+    return 0;
+
+  if (p->type != 'c' && p->len + size > RUN_TIMER_POST_MAX_NUM)
+  {
+    LOGE("Value of %s is too long, ignoring it", key);
+    p->type = 0;
+    return 0;
+  }
+
+  if (p->len + size + 1 > p->size)
+  {
+    uint new_size = p->size ? p->size : 256;
+    char* new_buf;
+
+    while (new_size < p->len + size + 1)
+      new_size *= 2;
+
+    if (!(new_buf = (char*)realloc(p->buf,new_size)))
+    {
+      LOGE("OOM growing POST field buffer");
+      return 1;
+    }
+
+    p->buf = new_buf;
+    p->size = new_size;
+  }
+
+  memcpy(p->buf + p->len,data,size);
+  p->len += size;
+  return 0;
+}
+
+/* the last field has no field after it to end it */
+int run_timer_post_end(Run_timer* t)
+{
+  return post_field_end(t,&t->post);
+}
+
+/* the edited workout as the review form would post it, for Fast Running Blog */
+int run_timer_form_fields(Run_timer* t, UT_string* form)
+{
+  Run_leg* cur_leg;
+  Run_split* cur_split;
+  uint leg_num = 1;
+  char key[32],val[64];
+
+  if (t->comment && *t->comment)
+    url_form_add(form,"c_0_0",t->comment,strlen(t->comment));
+
+  LL_FOREACH(t->first_leg,cur_leg)
+  {
+    uint split_num = 1;
+
+    // the end marker is not in the form
+    if (!cur_leg->next)
+      break;
+
+    if (cur_leg->comment && *cur_leg->comment)
+    {
+      snprintf(key,sizeof(key),"c_%u_0",leg_num);
+      url_form_add(form,key,cur_leg->comment,strlen(cur_leg->comment));
+    }
+
+    LL_FOREACH(cur_leg->first_split,cur_split)
+    {
+      snprintf(key,sizeof(key),"t_%u_%u",leg_num,split_num);
+      url_form_add(form,key,val,print_time(val,sizeof(val),cur_split->d_t));
+      snprintf(key,sizeof(key),"d_%u_%u",leg_num,split_num);
+      url_form_add(form,key,val,snprintf(val,sizeof(val),"%.3f",cur_split->d_d));
+
+      if (cur_split->zone)
+      {
+        snprintf(key,sizeof(key),"z_%u_%u",leg_num,split_num);
+        url_form_add(form,key,val,snprintf(val,sizeof(val),"%u",cur_split->zone));
       }
-      case 'c':
+
+      if (cur_split->comment && *cur_split->comment)
       {
-        sp->comment = (char*)mem_pool_cdup(&t->mem_pool,data,size);
-        break;
+        snprintf(key,sizeof(key),"c_%u_%u",leg_num,split_num);
+        url_form_add(form,key,cur_split->comment,strlen(cur_split->comment));
       }
-      default: /* impossible */
-        break;
+
+      split_num++;
     }
+
+    leg_num++;
   }
-done:
- return 0;
+
+  return 0;
 }
 
 void run_timer_stop_sirf_gps(Run_timer* t)
 {
-  t->sirf.done = 1;
+  gps_sirf_stop(&t->sirf);
 }
 
 void run_timer_run_sirf_gps(Run_timer* t)
@@ -3,14 +3,29 @@
 
 #include "utlist.h"
 #include "utstring.h"
-#include "url.h"
 #include "mem_pool.h"
 #include "sirf_gps.h"
+#include "track.h"
+#include "kalman.h"
+#include "autolap.h"
 #include <stdio.h>
 #include <sys/types.h>
+#include <stdint.h>
 
 typedef unsigned long long ulonglong;
 
+/* what the GPS track says about a split, filled in by run_timer_join_track() */
+typedef struct
+{
+  uint first,n,n_outliers; /* fixes of the split in the track */
+  double d; /* miles */
+  ulonglong pace; /* ms per mile, 0 if it did not move */
+  float pace_cv; /* standard deviation of the pace over its mean, moving fixes only */
+  float accuracy; /* mean, meters */
+  ulonglong max_gap; /* ms without a fix, including the split boundaries */
+  Dist_conf_level conf;
+} Run_split_gps;
+
 typedef struct st_run_split
 {
   ulonglong t,d_t;
@@ -18,6 +33,7 @@ typedef struct st_run_split
   struct st_run_split *next;
   char* comment;
   uint zone;
+  Run_split_gps* gps;
 } Run_split;
 
 typedef struct st_run_leg
@@ -43,6 +59,23 @@ typedef struct st_run_leg
 #define META_DATA_EXT_LEN (strlen(META_DATA_EXT))
 #define META_DATA_FMT "%Y_%m_%d-%H_%M_%S"
 
+#define RUN_SPLIT_GPS_MAX_GAP 10000 /* ms, a longer gap means the signal was lost */
+#define RUN_SPLIT_GPS_MAX_OUTLIERS 0.1 /* fraction of the fixes */
+#define RUN_TIMER_POST_MAX_NUM 32 /* longest t, d or z value we take */
+
+/*
+  The workout form field being decoded. Its target is looked up once when the field
+  starts, the value is collected as it arrives and written there when the field ends.
+*/
+typedef struct
+{
+  char type; /* t, d, z or c, 0 for a field we skip */
+  Run_split* sp;
+  char** comment;
+  char* buf;
+  uint len,size;
+} Run_timer_post;
+
 
 typedef struct st_run_timer
 {
@@ -61,7 +94,8 @@ typedef struct st_run_timer
   char* workout_ts;
   uint workout_ts_len;
   Gps_sirf_session sirf;
-  Url_hash* post_h;
+  Run_timer_post post;
+  Autolap autolap;
 } Run_timer;
 
 extern Run_timer run_timer;
@@ -75,6 +109,12 @@ int run_timer_resume(Run_timer* t);
 int run_timer_reset(Run_timer* t);
 int run_timer_start_leg(Run_timer* t, double d);
 int run_timer_split(Run_timer* t, double d);
+/*
+  Distance sample from the thread the fixes come in on, ts in ms of running time, d in
+  miles. Starts a split at each auto-lap boundary crossed since the previous sample.
+*/
+int run_timer_push_dist(Run_timer* t, ulonglong ts, double d, double every_d,
+                        ulonglong every_t);
 int run_timer_init_from_workout(Run_timer* t, const char* file_prefix, const char* workout, int init_fp);
 char* run_timer_review_info(Run_timer* t, Run_timer_review_mode mode);
 char** run_timer_run_list(Run_timer* t, Mem_pool* pool,uint* num_entries);
@@ -85,8 +125,10 @@ Run_leg* run_timer_get_leg(Run_timer* t, int leg_num);
 
 ulonglong run_timer_parse_time(const char* s, uint len);
 void run_timer_deinit(Run_timer* t);
-int run_timer_parse_key(Run_timer* t, Url_hash_entry* he);
-int run_timer_parse_keys(Run_timer* t);
+int run_timer_post_field(Run_timer* t, const char* key, const char* data, uint64_t off,
+                         size_t size);
+int run_timer_post_end(Run_timer* t);
+int run_timer_form_fields(Run_timer* t, UT_string* form);
 
 typedef struct
 {
@@ -99,7 +141,11 @@ int run_timer_info(Run_timer* t, Run_info* info);
 ulonglong run_timer_now(); 
 ulonglong run_timer_running_time(Run_timer* t);
 int run_timer_save(Run_timer* t);
-int run_timer_add_key_to_hash(Run_timer* t, const char* key, const char* data, uint size);
+int run_timer_init_deltas(Run_timer* t);
+int run_timer_apply_track(Run_timer* t, Track* tr);
+int run_timer_join_track(Run_timer* t, Track* tr);
+int run_timer_load_track(Run_timer* t, const char* gps_dir, Track* tr);
+int run_timer_smooth_workout(const char* file_prefix, const char* gps_dir, const char* workout);
 void run_timer_run_sirf_gps(Run_timer* t);
 void run_timer_stop_sirf_gps(Run_timer* t);
 
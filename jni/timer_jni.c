@@ -2,6 +2,7 @@
 #include <jni.h>
 #include "timer_jni.h"
 #include "log.h"
+#include "live.h"
 
 static Run_timer timer;
 
@@ -122,6 +123,20 @@ JNIEXPORT jboolean JNICALL Java_com_fastrunningblog_FastRunningFriend_RunTimer_s
   return run_timer_split(&timer,d) == 0;
 }
 
+/*
+ * Class:     com_fastrunningblog_FastRunningFriend_RunTimer
+ * Method:    push_dist
+ * Signature: (JDDJ)V
+ */
+JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_RunTimer_push_1dist
+  (JNIEnv *env, jclass cls, jlong ts, jdouble d, jdouble every_d, jlong every_t)
+{
+  if (ts < 0 || every_t < 0)
+    return;
+
+  run_timer_push_dist(&timer,(ulonglong)ts,d,every_d,(ulonglong)every_t);
+}
+
 JNIEXPORT jstring JNICALL Java_com_fastrunningblog_FastRunningFriend_RunTimer_get_1review_1info
   (JNIEnv *env, jclass cls, jstring file_prefix, jstring workout)
 {
@@ -212,6 +227,24 @@ err:
   return res;
 }
 
+/*
+ * Class:     com_fastrunningblog_FastRunningFriend_RunTimer
+ * Method:    publish_live
+ * Signature: (DDI)V
+ */
+JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_RunTimer_publish_1live
+  (JNIEnv *env, jclass cls, jdouble dist, jdouble pace_t, jint conf)
+{
+  Run_info info;
+  
+  // nobody is watching, not worth formatting
+  if (!live_has_subscribers())
+    return;
+  
+  run_timer_info(&timer,&info);
+  live_publish_run(&info,dist,pace_t,conf);
+}
+
 JNIEXPORT void JNICALL Java_com_fastrunningblog_FastRunningFriend_RunTimer_sirf_1gps_1test_1start
 (JNIEnv *env, jclass cls)
 {
@@ -0,0 +1,259 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "log.h"
+
+typedef struct
+{
+  char magic[TRACE_MAGIC_LEN];
+  unsigned int rec_size;
+  unsigned int reserved;
+} Trace_file_header;
+
+/*
+  Records go into the current block of a small ring. A full block is handed to the
+  writer thread, so the threads being traced never wait for the card. Blocks
+  w_next .. w_next + n_full - 1 are full or being written, cur_block follows them. When
+  the writer is a whole ring behind, the block being filled is dropped and counted.
+*/
+static Trace_rec trace_blocks[TRACE_N_BLOCKS][TRACE_BLOCK_RECS];
+static unsigned int trace_n_recs = 0;
+static unsigned int cur_block = 0, w_next = 0, n_full = 0;
+static unsigned int dropped_blocks = 0;
+static int writer_stop = 0;
+static pthread_t writer_th;
+static int trace_fd = -1;
+static int writer_fd = -1; /* trace_fd goes to -1 before the writer is done with it */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+
+static int write_all(int fd, const char* buf, size_t len)
+{
+  while (len)
+  {
+    ssize_t n = write(fd,buf,len);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return 1;
+    }
+
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static void* writer_thread(void* arg)
+{
+  pthread_mutex_lock(&trace_lock);
+
+  for (;;)
+  {
+    Trace_rec* block;
+
+    while (!n_full && !writer_stop)
+      pthread_cond_wait(&trace_cond,&trace_lock);
+
+    if (!n_full)
+      break;
+
+    // the block stays counted in n_full until it is written so nobody refills it
+    block = trace_blocks[w_next];
+    pthread_mutex_unlock(&trace_lock);
+
+    if (write_all(writer_fd,(char*)block,TRACE_BLOCK_RECS * sizeof(Trace_rec)))
+      LOGE_RL(5000,"Error writing trace block (%d)", errno);
+
+    pthread_mutex_lock(&trace_lock);
+    w_next = (w_next + 1) % TRACE_N_BLOCKS;
+    n_full--;
+  }
+
+  pthread_mutex_unlock(&trace_lock);
+  return 0;
+}
+
+// called with trace_lock held when the current block is full
+static void trace_queue_block()
+{
+  trace_n_recs = 0;
+
+  if (n_full == TRACE_N_BLOCKS - 1)
+  {
+    dropped_blocks++;
+    return;
+  }
+
+  n_full++;
+  cur_block = (w_next + n_full) % TRACE_N_BLOCKS;
+  pthread_cond_signal(&trace_cond);
+}
+
+// called with trace_lock held, returns a zeroed record with a timestamp
+static Trace_rec* trace_next_rec(unsigned int id)
+{
+  Trace_rec* rec;
+  struct timeval t;
+
+  if (trace_n_recs == TRACE_BLOCK_RECS)
+    trace_queue_block();
+
+  rec = trace_blocks[cur_block] + trace_n_recs++;
+  memset(rec,0,sizeof(*rec));
+  gettimeofday(&t,0);
+  rec->ts = (unsigned long long)t.tv_sec * 1000LL + t.tv_usec / 1000;
+  rec->id = id;
+  return rec;
+}
+
+int trace_open(const char* fname)
+{
+  Trace_file_header h;
+  int res = 1;
+
+  pthread_mutex_lock(&trace_lock);
+
+  if (trace_fd >= 0)
+  {
+    LOGE("Trace file already open, not opening %s", fname);
+    goto err;
+  }
+
+  if ((trace_fd = open(fname,O_WRONLY|O_CREAT|O_TRUNC,0644)) < 0)
+  {
+    LOGE("Could not open trace file %s (%d)", fname, errno);
+    goto err;
+  }
+
+  memcpy(h.magic,TRACE_MAGIC,TRACE_MAGIC_LEN);
+  h.rec_size = sizeof(Trace_rec);
+  h.reserved = 0;
+
+  if (write_all(trace_fd,(char*)&h,sizeof(h)))
+  {
+    LOGE("Error writing trace file header to %s (%d)", fname, errno);
+    close(trace_fd);
+    trace_fd = -1;
+    goto err;
+  }
+
+  trace_n_recs = cur_block = w_next = n_full = dropped_blocks = 0;
+  writer_fd = trace_fd;
+  writer_stop = 0;
+
+  if (pthread_create(&writer_th,0,writer_thread,0))
+  {
+    LOGE("Could not start the trace writer thread");
+    close(trace_fd);
+    trace_fd = -1;
+    goto err;
+  }
+
+  res = 0;
+err:
+  pthread_mutex_unlock(&trace_lock);
+  return res;
+}
+
+int trace_close()
+{
+  int res = 0;
+
+  int fd;
+
+  pthread_mutex_lock(&trace_lock);
+
+  if ((fd = trace_fd) < 0)
+  {
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+  }
+
+  // no more records, then let the writer finish the full blocks
+  trace_fd = -1;
+  writer_stop = 1;
+  pthread_cond_signal(&trace_cond);
+  pthread_mutex_unlock(&trace_lock);
+  pthread_join(writer_th,0);
+
+  if (trace_n_recs &&
+      write_all(fd,(char*)trace_blocks[cur_block],trace_n_recs * sizeof(Trace_rec)))
+    LOGE("Error writing the last trace block (%d)", errno);
+
+  if (dropped_blocks)
+    LOGW("Trace writer fell behind, %u blocks of %u records dropped", dropped_blocks,
+         TRACE_BLOCK_RECS);
+
+  trace_n_recs = 0;
+  writer_fd = -1;
+  res = close(fd);
+  return res;
+}
+
+int trace_active()
+{
+  return trace_fd >= 0;
+}
+
+void trace_event(unsigned int id, int i0, int i1, int i2, double d0, double d1, double d2)
+{
+  Trace_rec* rec;
+
+  if (trace_fd < 0)
+    return;
+
+  pthread_mutex_lock(&trace_lock);
+
+  if (trace_fd >= 0)
+  {
+    rec = trace_next_rec(id);
+    rec->i[0] = i0;
+    rec->i[1] = i1;
+    rec->i[2] = i2;
+    rec->d[0] = d0;
+    rec->d[1] = d1;
+    rec->d[2] = d2;
+  }
+
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_msg(const char* msg)
+{
+  size_t len = strlen(msg);
+  unsigned int id = TRACE_MSG;
+
+  if (trace_fd < 0)
+    return;
+
+  pthread_mutex_lock(&trace_lock);
+
+  if (trace_fd < 0)
+    goto done;
+
+  // text is not NUL terminated when it fills the whole chunk
+  do
+  {
+    size_t chunk_len = (len > TRACE_MSG_CHUNK) ? TRACE_MSG_CHUNK : len;
+
+    memcpy(TRACE_TEXT(trace_next_rec(id)),msg,chunk_len);
+    msg += chunk_len;
+    len -= chunk_len;
+    id = TRACE_MSG_CONT;
+  } while (len);
+
+done:
+  pthread_mutex_unlock(&trace_lock);
+}
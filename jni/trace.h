@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+  Binary debug trace. Each event is a fixed size record with a wall clock timestamp in ms,
+  an event id and a few numeric arguments, and is kept in memory until a whole block can
+  be handed to the writer thread. scripts/frf-trace-decode turns a trace file back into
+  the text log.
+  Event ids are shared with GPSCoordBuffer.TRACE_* in FastRunningFriend.java and with the
+  decoder, keep the three in sync.
+*/
+
+#define TRACE_FILE_PREFIX "gps_debug_"
+#define TRACE_MAGIC "FRFTRC01"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_BLOCK_RECS 128
+#define TRACE_N_BLOCKS 4 /* blocks in the ring the writer thread drains */
+#define TRACE_N_INT 3
+#define TRACE_N_DOUBLE 3
+#define TRACE_MSG_CHUNK (TRACE_N_INT * sizeof(int) + TRACE_N_DOUBLE * sizeof(double))
+#define TRACE_TEXT(rec) ((char*)(rec)->i)
+
+typedef enum
+{
+  TRACE_DIST_UPDATE = 1,
+  TRACE_POINT,
+  TRACE_TRUSTED_D,
+  TRACE_GOOD_PACE,
+  TRACE_BAD_SIGNAL,
+  TRACE_SUSPECT_SIGNAL,
+  TRACE_SIGNAL_LOST,
+  TRACE_MSG = 100,
+  TRACE_MSG_CONT
+} Trace_event;
+
+/*
+  48 bytes with no padding on either ARM or x86. TRACE_MSG records reuse the argument area
+  from i[] onwards for text, TRACE_MSG_CONT records carry the rest of a long message.
+*/
+typedef struct
+{
+  unsigned long long ts;
+  unsigned int id;
+  int i[TRACE_N_INT];
+  double d[TRACE_N_DOUBLE];
+} Trace_rec;
+
+int trace_open(const char* fname);
+int trace_close();
+int trace_active();
+void trace_event(unsigned int id, int i0, int i1, int i2, double d0, double d1, double d2);
+void trace_msg(const char* msg);
+
+#endif
@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "track.h"
+#include "kalman.h"
+#include "geodesy.h"
+#include "log.h"
+
+#define TRACK_INIT_SIZE 4096
+#define DEG_TO_RAD (M_PI/180.0)
+
+void track_init(Track* tr)
+{
+  memset(tr,0,sizeof(*tr));
+}
+
+void track_free(Track* tr)
+{
+  free(tr->lat);
+  free(tr->lon);
+  free(tr->ts);
+  free(tr->accuracy);
+  free(tr->speed);
+  free(tr->bearing);
+  free(tr->x);
+  free(tr->y);
+  free(tr->d);
+  free(tr->v);
+  free(tr->restart);
+  free(tr->outlier);
+  track_init(tr);
+}
+
+#define TRACK_REALLOC(member) \
+  if (!(p = realloc(tr->member,new_size * sizeof(*tr->member)))) \
+    return 1; \
+  tr->member = p;
+
+static int track_grow(Track* tr)
+{
+  uint new_size = tr->size ? tr->size * 2 : TRACK_INIT_SIZE;
+  void* p;
+
+  TRACK_REALLOC(lat)
+  TRACK_REALLOC(lon)
+  TRACK_REALLOC(ts)
+  TRACK_REALLOC(accuracy)
+  TRACK_REALLOC(speed)
+  TRACK_REALLOC(bearing)
+  tr->size = new_size;
+  return 0;
+}
+
+#undef TRACK_REALLOC
+
+/* one line of gps_data_*.csv: lat,lon,ts,dist_to_prev,bearing,accuracy,speed */
+int track_parse_line(const char* line, double* lat, double* lon, long long* ts,
+                     double* bearing, double* accuracy, double* speed)
+{
+  double dist_to_prev;
+
+  return sscanf(line,"%lf,%lf,%lld,%lf,%lf,%lf,%lf",lat,lon,ts,&dist_to_prev,bearing,
+                accuracy,speed) != 7;
+}
+
+int track_load(Track* tr, const char* fname)
+{
+  FILE* fp;
+  char line[TRACK_MAX_LINE];
+
+  if (!(fp = fopen(fname,"r")))
+  {
+    LOGE("Could not open GPS track %s (%d)", fname, errno);
+    return 1;
+  }
+
+  while (fgets(line,sizeof(line),fp))
+  {
+    double lat,lon,bearing,accuracy,speed;
+    long long ts;
+
+    if (track_parse_line(line,&lat,&lon,&ts,&bearing,&accuracy,&speed))
+      continue;
+
+    if (tr->n == tr->size && track_grow(tr))
+    {
+      LOGE("OOM loading GPS track %s", fname);
+      fclose(fp);
+      return 1;
+    }
+
+    tr->lat[tr->n] = lat;
+    tr->lon[tr->n] = lon;
+    tr->ts[tr->n] = ts;
+    tr->bearing[tr->n] = bearing;
+    tr->accuracy[tr->n] = accuracy;
+    tr->speed[tr->n] = speed;
+    tr->n++;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+static void axis_predict(Track_axis_state* prev, Track_axis_state* cur, double dt)
+{
+  double q = KF_ACCEL_NOISE, dt2 = dt * dt;
+  double pp = prev->Pf[0], pv = prev->Pf[1], vv = prev->Pf[2];
+
+  cur->xp[0] = prev->xf[0] + dt * prev->xf[1];
+  cur->xp[1] = prev->xf[1];
+  cur->Pp[0] = pp + 2.0 * dt * pv + dt2 * vv + q * dt2 * dt / 3.0;
+  cur->Pp[1] = pv + dt * vv + q * dt2 / 2.0;
+  cur->Pp[2] = vv + q * dt;
+}
+
+// scalar update of component k (0 - position, 1 - velocity) from the current xf/Pf
+static void axis_update(Track_axis_state* s, int k, double z, double r)
+{
+  double pp = s->Pf[0], pv = s->Pf[1], vv = s->Pf[2];
+  double y = z - s->xf[k], sk = (k ? vv : pp) + r;
+  double k0 = (k ? pv : pp) / sk, k1 = (k ? vv : pv) / sk;
+
+  s->xf[0] += k0 * y;
+  s->xf[1] += k1 * y;
+
+  if (k)
+  {
+    s->Pf[0] = pp - k0 * pv;
+    s->Pf[1] = pv - k0 * vv;
+    s->Pf[2] = vv - k1 * vv;
+  }
+  else
+  {
+    s->Pf[0] = pp - k0 * pp;
+    s->Pf[1] = pv - k0 * pv;
+    s->Pf[2] = vv - k1 * pv;
+  }
+}
+
+static void axis_start(Track_axis_state* s, double pos, double r)
+{
+  s->xp[0] = s->xf[0] = pos;
+  s->xp[1] = s->xf[1] = 0.0;
+  s->Pp[0] = s->Pf[0] = r;
+  s->Pp[1] = s->Pf[1] = 0.0;
+  s->Pp[2] = s->Pf[2] = KF_INIT_VEL_VAR;
+}
+
+// x_s[i] = x_f[i] + Pf[i] F^T Pp[i+1]^-1 (x_s[i+1] - x_p[i+1])
+static void axis_rts(Track_axis_state* s, Track_axis_state* next, double dt, double* xs,
+                     double* xs_next)
+{
+  double pp = s->Pf[0], pv = s->Pf[1], vv = s->Pf[2];
+  double a = next->Pp[0], b = next->Pp[1], c = next->Pp[2];
+  double det = a * c - b * b;
+  /* G = Pf F^T, rows (pp + dt pv, pv) and (pv + dt vv, vv) */
+  double g00 = pp + dt * pv, g01 = pv, g10 = pv + dt * vv, g11 = vv;
+  double d0 = xs_next[0] - next->xp[0], d1 = xs_next[1] - next->xp[1];
+  double i0,i1;
+
+  if (det <= 0.0)
+  {
+    xs[0] = s->xf[0];
+    xs[1] = s->xf[1];
+    return;
+  }
+
+  /* Pp^-1 d */
+  i0 = (c * d0 - b * d1) / det;
+  i1 = (a * d1 - b * d0) / det;
+  xs[0] = s->xf[0] + g00 * i0 + g01 * i1;
+  xs[1] = s->xf[1] + g10 * i0 + g11 * i1;
+}
+
+int track_smooth(Track* tr)
+{
+  Geo_frame f;
+  Track_axis_state* st;
+  float* seg = 0,*vs;
+  uint i,n = tr->n,n_rejects = 0;
+  int have_doppler = 0,res = 1;
+
+  if (n < 2)
+    return 1;
+
+  st = (Track_axis_state*)malloc(2 * n * sizeof(*st));
+  tr->x = (float*)malloc(n * sizeof(float));
+  tr->y = (float*)malloc(n * sizeof(float));
+  tr->d = (double*)malloc(n * sizeof(double));
+  tr->v = vs = (float*)malloc(n * sizeof(float));
+  tr->restart = (unsigned char*)calloc(n,1);
+  tr->outlier = (unsigned char*)calloc(n,1);
+  seg = (float*)malloc(n * sizeof(float));
+
+  if (!st || !tr->x || !tr->y || !tr->d || !vs || !tr->restart || !tr->outlier || !seg)
+  {
+    LOGE("OOM smoothing GPS track of %u points", n);
+    goto err;
+  }
+
+  geo_frame_init(&f,tr->lat[0],tr->lon[0]);
+  geo_project(&f,tr->lat,tr->lon,tr->x,tr->y,n);
+
+  // forward pass, st[2i] is east, st[2i+1] is north
+  for (i = 0; i < n; i++)
+  {
+    Track_axis_state* e = st + 2 * i, *no = e + 1;
+    double acc = tr->accuracy[i], r, dt;
+    int rejected = 0;
+
+    if (acc <= 0.0)
+      acc = KF_DEFAULT_ACCURACY;
+    else if (acc < KF_MIN_ACCURACY)
+      acc = KF_MIN_ACCURACY;
+
+    r = acc * acc;
+
+    if (!i)
+    {
+      axis_start(e,tr->x[0],r);
+      axis_start(no,tr->y[0],r);
+      tr->restart[0] = 1;
+      continue;
+    }
+
+    dt = (tr->ts[i] - tr->ts[i - 1]) / 1000.0;
+
+    if (dt < 0.0)
+      dt = 0.0;
+
+    axis_predict(e - 2,e,dt);
+    axis_predict(no - 2,no,dt);
+    memcpy(e->xf,e->xp,sizeof(e->xf));
+    memcpy(e->Pf,e->Pp,sizeof(e->Pf));
+    memcpy(no->xf,no->xp,sizeof(no->xf));
+    memcpy(no->Pf,no->Pp,sizeof(no->Pf));
+
+    {
+      double ye = tr->x[i] - e->xp[0], yn = tr->y[i] - no->xp[0];
+
+      if (ye * ye / (e->Pp[0] + r) + yn * yn / (no->Pp[0] + r) > KF_GATE)
+        rejected = 1;
+    }
+
+    if (rejected)
+    {
+      tr->outlier[i] = 1;
+
+      if (++n_rejects > KF_MAX_REJECTS)
+      {
+        axis_start(e,tr->x[i],r);
+        axis_start(no,tr->y[i],r);
+        tr->restart[i] = 1;
+        tr->outlier[i] = 0;
+        n_rejects = 0;
+      }
+
+      continue;
+    }
+
+    n_rejects = 0;
+    axis_update(e,0,tr->x[i],r);
+    axis_update(no,0,tr->y[i],r);
+
+    if (tr->speed[i] > KF_MIN_DOPPLER_SPEED)
+    {
+      double v_r = KF_SPEED_SIGMA * KF_SPEED_SIGMA, b = tr->bearing[i] * DEG_TO_RAD;
+      axis_update(e,1,tr->speed[i] * sin(b),v_r);
+      axis_update(no,1,tr->speed[i] * cos(b),v_r);
+      have_doppler = 1;
+    }
+    else if (have_doppler)
+    {
+      double v_r = KF_MIN_DOPPLER_SPEED * KF_MIN_DOPPLER_SPEED;
+      axis_update(e,1,0.0,v_r);
+      axis_update(no,1,0.0,v_r);
+    }
+  }
+
+  // backward pass, reuse x/y for the smoothed positions
+  {
+    double xs_e[2],xs_n[2],xs_e_next[2],xs_n_next[2];
+    Track_axis_state* last = st + 2 * (n - 1);
+
+    xs_e_next[0] = last[0].xf[0];
+    xs_e_next[1] = last[0].xf[1];
+    xs_n_next[0] = last[1].xf[0];
+    xs_n_next[1] = last[1].xf[1];
+    tr->x[n - 1] = xs_e_next[0];
+    tr->y[n - 1] = xs_n_next[0];
+    vs[n - 1] = sqrt(xs_e_next[1] * xs_e_next[1] + xs_n_next[1] * xs_n_next[1]);
+
+    for (i = n - 1; i-- > 0; )
+    {
+      Track_axis_state* e = st + 2 * i;
+
+      if (tr->restart[i + 1])
+      {
+        xs_e[0] = e[0].xf[0];
+        xs_e[1] = e[0].xf[1];
+        xs_n[0] = e[1].xf[0];
+        xs_n[1] = e[1].xf[1];
+      }
+      else
+      {
+        double dt = (tr->ts[i + 1] - tr->ts[i]) / 1000.0;
+
+        if (dt < 0.0)
+          dt = 0.0;
+
+        axis_rts(e,e + 2,dt,xs_e,xs_e_next);
+        axis_rts(e + 1,e + 3,dt,xs_n,xs_n_next);
+      }
+
+      tr->x[i] = xs_e[0];
+      tr->y[i] = xs_n[0];
+      vs[i] = sqrt(xs_e[1] * xs_e[1] + xs_n[1] * xs_n[1]);
+      memcpy(xs_e_next,xs_e,sizeof(xs_e));
+      memcpy(xs_n_next,xs_n,sizeof(xs_n));
+    }
+  }
+
+  geo_seg_dist(tr->x,tr->y,seg,n);
+  tr->d[0] = 0.0;
+
+  // standing still only adds the residual wobble of the smoothed track, leave it out
+  for (i = 1; i < n; i++)
+  {
+    int moving = vs[i - 1] >= KF_STATIONARY_SPEED || vs[i] >= KF_STATIONARY_SPEED;
+    tr->d[i] = tr->d[i - 1] + (moving ? seg[i - 1] : 0.0);
+  }
+
+  res = 0;
+err:
+  free(st);
+  free(seg);
+  return res;
+}
+
+static double dist_before(Track* tr, uint i, long long ts)
+{
+  long long t0 = tr->ts[i - 1], t1 = tr->ts[i];
+  double d0 = tr->d[i - 1], d1 = tr->d[i];
+
+  if (t1 == t0)
+    return d1 / METERS_PER_MILE;
+
+  return (d0 + (d1 - d0) * (double)(ts - t0) / (double)(t1 - t0)) / METERS_PER_MILE;
+}
+
+/* miles covered by running time ts, interpolated between fixes */
+double track_dist_at(Track* tr, long long ts)
+{
+  uint lo = 0, hi = tr->n;
+
+  if (!tr->n || !tr->d || ts <= tr->ts[0])
+    return 0.0;
+
+  if (ts >= tr->ts[tr->n - 1])
+    return tr->d[tr->n - 1] / METERS_PER_MILE;
+
+  // first fix at or after ts
+  while (lo < hi)
+  {
+    uint mid = (lo + hi) / 2;
+
+    if (tr->ts[mid] < ts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return dist_before(tr,lo,ts);
+}
+
+/*
+  Same as track_dist_at() for non-decreasing ts, walking forward from *hint instead of
+  searching, so a pass over all splits touches every fix once.
+*/
+double track_dist_at_hint(Track* tr, uint* hint, long long ts)
+{
+  uint i = *hint;
+
+  if (!tr->n || !tr->d || ts <= tr->ts[0])
+    return 0.0;
+
+  while (i < tr->n && tr->ts[i] < ts)
+    i++;
+
+  *hint = i;
+
+  if (i == tr->n)
+    return tr->d[tr->n - 1] / METERS_PER_MILE;
+
+  return dist_before(tr,i,ts);
+}
+
+/* the local time a file name timestamp stands for */
+int track_parse_ts(const char* ts, time_t* res)
+{
+  struct tm tm;
+
+  memset(&tm,0,sizeof(tm));
+
+  if (sscanf(ts,"%d_%d_%d-%d_%d_%d",&tm.tm_year,&tm.tm_mon,&tm.tm_mday,&tm.tm_hour,
+             &tm.tm_min,&tm.tm_sec) != 6)
+    return 1;
+
+  tm.tm_year -= 1900;
+  tm.tm_mon--;
+  tm.tm_isdst = -1;
+
+  if ((*res = mktime(&tm)) == (time_t)-1)
+    return 1;
+
+  return 0;
+}
+
+static int shift_ts(const char* ts, int delta, char* out)
+{
+  struct tm tm;
+  time_t t;
+
+  if (track_parse_ts(ts,&t))
+    return 1;
+
+  t += delta;
+
+  if (!localtime_r(&t,&tm) || strftime(out,TRACK_TS_LEN + 1,TRACK_TS_FMT,&tm) != TRACK_TS_LEN)
+    return 1;
+
+  return 0;
+}
+
+int track_find_gps_file(const char* dir, const char* workout_ts, char* fname, size_t fname_size)
+{
+  int delta;
+  char ts[TRACK_TS_LEN + 1];
+  struct stat s;
+
+  for (delta = 0; delta <= TRACK_MAX_TS_SKEW; delta++)
+  {
+    if (shift_ts(workout_ts,delta,ts))
+      return 1;
+
+    snprintf(fname,fname_size,"%s/" GPS_DATA_PREFIX "%s." GPS_DATA_EXT, dir, ts);
+
+    if (!stat(fname,&s))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* workout_ts must have room for TRACK_TS_LEN + 1 bytes */
+int track_find_workout(const char* dir, const char* gps_ts, char* workout_ts)
+{
+  int delta;
+  char fname[PATH_MAX+1];
+  struct stat s;
+
+  for (delta = 0; delta <= TRACK_MAX_TS_SKEW; delta++)
+  {
+    if (shift_ts(gps_ts,-delta,workout_ts))
+      return 1;
+
+    snprintf(fname,sizeof(fname),"%s/timer_data_%s.csv", dir, workout_ts);
+
+    if (!stat(fname,&s))
+      return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/*
+  Post-run processing of a whole gps_data_*.csv track. track_smooth() runs the same
+  constant velocity model as the live Kalman engine forward over the track, rejecting
+  outliers with the same gate, then a Rauch-Tung-Striebel pass backward, so every point
+  is estimated from the fixes both before and after it. East and north are independent
+  in that model, which keeps the stored state at two 2x2 filters per point.
+*/
+
+#define GPS_DATA_PREFIX "gps_data_"
+#define GPS_DATA_EXT "csv"
+#define TRACK_TS_FMT "%Y_%m_%d-%H_%M_%S"
+#define TRACK_TS_LEN 19
+/* the GPS file is opened right after the timer starts, allow for a slow second or two */
+#define TRACK_MAX_TS_SKEW 3
+#define TRACK_MAX_LINE 256
+
+typedef struct
+{
+  float xp[2],Pp[3]; /* predicted position/velocity, covariance as p-p, p-v, v-v */
+  float xf[2],Pf[3]; /* filtered */
+} Track_axis_state;
+
+typedef struct
+{
+  uint n,size;
+  double* lat,*lon;
+  long long* ts;
+  float* accuracy,*speed,*bearing;
+  float* x,*y; /* smoothed position in the run start frame, meters */
+  double* d; /* cumulative smoothed distance, meters */
+  float* v; /* smoothed speed, m/s */
+  unsigned char* restart; /* filter restarted at this point, do not smooth across it */
+  unsigned char* outlier; /* rejected by the gate */
+} Track;
+
+void track_init(Track* tr);
+void track_free(Track* tr);
+int track_parse_line(const char* line, double* lat, double* lon, long long* ts,
+                     double* bearing, double* accuracy, double* speed);
+int track_load(Track* tr, const char* fname);
+int track_smooth(Track* tr);
+double track_dist_at(Track* tr, long long ts);
+double track_dist_at_hint(Track* tr, uint* hint, long long ts);
+int track_parse_ts(const char* ts, time_t* res);
+int track_find_gps_file(const char* dir, const char* workout_ts, char* fname, size_t fname_size);
+int track_find_workout(const char* dir, const char* gps_ts, char* workout_ts);
+
+#endif
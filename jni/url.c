@@ -3,6 +3,7 @@
 #include "curl/curl.h"
 #include "log.h"
 #include "utstring.h"
+#include <ctype.h>
 
 #define PRE_ALLOC_SIZE 16384*8
 
@@ -98,7 +99,7 @@ size_t url_fetch(const char* url, char* buf, size_t buf_size, const char* post_f
     {
       goto err;
     }
-    LOGE("Sending post_fields %s", utstring_body(esc_post_fields));
+    LOGD("Sending post_fields %s", utstring_body(esc_post_fields));
   }
 
   if (curl_easy_setopt(ch,CURLOPT_WRITEFUNCTION,process_data) || 
@@ -123,14 +124,40 @@ err:
     return data.data_size;
 }
 
-size_t url_fetch_with_hash(const char* url, char* buf, size_t buf_size, Url_hash* h)
+/* key=val with val escaped the way curl_easy_escape() does it, & before all but the first */
+void url_form_add(UT_string* form, const char* key, const char* val, size_t val_len)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  const char* p, *p_end = val + val_len;
+
+  if (utstring_len(form))
+    utstring_bincpy(form,"&",1);
+
+  utstring_bincpy(form,key,strlen(key));
+  utstring_bincpy(form,"=",1);
+
+  for (p = val; p < p_end; p++)
+  {
+    unsigned char c = (unsigned char)*p;
+
+    if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+      utstring_bincpy(form,p,1);
+    else
+    {
+      char esc[3];
+
+      esc[0] = '%';
+      esc[1] = hex[c >> 4];
+      esc[2] = hex[c & 15];
+      utstring_bincpy(form,esc,3);
+    }
+  }
+}
+
+size_t url_post_form(const char* url, char* buf, size_t buf_size, UT_string* form)
 {
   CURL *ch;
-  CURLcode res;
   struct Curl_data data;
-  char* content = 0;
-  UT_string* esc_post_fields = 0;
-  Url_hash_entry* cur_he;
   
   data.buf = buf;
   data.buf_size = buf_size;
@@ -148,53 +175,25 @@ size_t url_fetch_with_hash(const char* url, char* buf, size_t buf_size, Url_hash
   if (curl_easy_setopt(ch,CURLOPT_URL,url))
     goto err;
 
-  utstring_new(esc_post_fields);
-
-  for(cur_he = h; cur_he; cur_he = cur_he->hh.next)
-  {
-    char* f;
-    utstring_bincpy(esc_post_fields,cur_he->key,cur_he->key_len);
-    utstring_bincpy(esc_post_fields,"=",1);
-
-    if (!(f = curl_easy_escape(ch,cur_he->val,cur_he->val_len)))
-    {
-      LOGE("Error in curl_easy_escape()");
-      goto err;
-    }
-
-    utstring_bincpy(esc_post_fields,f,strlen(f));
-
-    if (cur_he->hh.next)
-      utstring_bincpy(esc_post_fields,"&",1);
-
-    curl_free(f);
-  }
-
-  if (curl_easy_setopt(ch,CURLOPT_POSTFIELDS,utstring_body(esc_post_fields)))
+  if (curl_easy_setopt(ch,CURLOPT_POSTFIELDS,utstring_body(form)))
   {
     goto err;
   }
 
-  LOGE("Sending post_fields %s", utstring_body(esc_post_fields));
+  LOGD("Sending post_fields %s", utstring_body(form));
 
   if (curl_easy_setopt(ch,CURLOPT_WRITEFUNCTION,process_data) ||
     curl_easy_setopt(ch,CURLOPT_WRITEDATA,&data))
-    return 0;
+    goto err;
   
   curl_easy_setopt(ch, CURLOPT_USERAGENT, "Fast Running Friend/1.0");
   
   if (curl_easy_perform(ch))
     goto err;
   
-  //LOGE("curl_easy_perform(), got %d bytes ", data.data_size);
-  
   err:
   
   curl_easy_cleanup(ch);
   curl_global_cleanup();
-  
-  if (esc_post_fields)
-    utstring_free(esc_post_fields);
-  
   return data.data_size;
-}
\ No newline at end of file
+}
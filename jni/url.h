@@ -2,18 +2,10 @@
 #define URL_H
 
 #include <stdlib.h>
-#include "uthash.h"
-
-typedef struct
-{
-  char* key;
-  char* val;
-  size_t key_len,val_len;
-  UT_hash_handle hh;
-} Url_hash_entry;
-
-typedef Url_hash_entry Url_hash;
+#include "utstring.h"
 
 size_t url_fetch(const char* url, char* buf, size_t buf_size, const char* post_fields,...);
-size_t url_fetch_with_hash(const char* url, char* buf, size_t buf_size, Url_hash* h);
-#endif
\ No newline at end of file
+/* form is built with url_form_add() */
+size_t url_post_form(const char* url, char* buf, size_t buf_size, UT_string* form);
+void url_form_add(UT_string* form, const char* key, const char* val, size_t val_len);
+#endif
@@ -5,31 +5,20 @@ import android.app.Activity;
 import android.os.Bundle;
 
 
-class ConfigState
+// the configurable fields come from ConfigVars, generated from jni/config_vars.spec
+class ConfigState extends ConfigVars
 {
     long max_dist_delay = 3000; 
     boolean gps_guess_mode = true;
     int min_running_pace = 16*60;
     int http_port = 8000;
-    public double min_cos = Math.cos(10.0 * Math.PI/180.0);
-    public double min_neighbor_cos = Math.cos(5.0 * Math.PI/180.0);
-    public double min_d_last_trusted = 0.08, max_d_last_trusted = 0.15,
-      max_pace_diff = 0.07, top_pace_t = 300000.0 /* 5:00 */, start_pace_t = 480000.0 /* 8:00 */;
-    public long max_t_no_signal = 120000;  
-    public long dist_update_interval = 500;
-    public long gps_update_interval = 1000;
-    public int expire_files_days = 7;
-    public long gps_disconnect_interval = 0;
-    public long split_display_pause = 10000;
-    
-    public String wifi_ssid = "";
-    public String wifi_key = "";
-    public String kill_bad_guys = "";
-    public String frb_login = "";
-    public String frb_pw = "";
     
     String data_dir = "/mnt/sdcard/FastRunningFriend";
     
+    public static final int DIST_ENGINE_CLASSIC = 0;
+    public static final int DIST_ENGINE_KALMAN = 1;
+    public static final int DIST_ENGINE_FUSION = 2;
+    
     public native boolean read_config(String profile_name);
     public native boolean write_config(String profile_name);
     
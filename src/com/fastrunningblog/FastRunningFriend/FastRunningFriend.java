@@ -48,6 +48,7 @@ import java.util.List;
 class GPSCoord
 {
   public double lon,lat,dist_to_prev;
+  public double x,y; // meters east and north of the run start, see jni/geodesy.h
   public float speed,bearing,accuracy;
   public long ts;
   public double angle_cos;
@@ -74,7 +75,20 @@ class GPSCoord
     good = false;
   }
   
+  public void project(double lat0, double lon0, double x0, double y0, double m_per_deg_lat,
+                      double m_per_deg_lon)
+  {
+    x = x0 + (lon - lon0) * m_per_deg_lon;
+    y = y0 + (lat - lat0) * m_per_deg_lat;
+  }
+  
   public double get_dist(GPSCoord other)
+  {
+    double dx = x - other.x, dy = y - other.y;
+    return Math.sqrt(dx*dx + dy*dy)/1609.34;
+  }
+  
+  public double get_dist_vincenty(GPSCoord other)
   {
     Location.distanceBetween(lat,lon,other.lat,other.lon,results);
     return (double)results[0]/1609.34;
@@ -111,13 +125,13 @@ class GPSCoord
     good = false;
   }
 
-  public void set_angle(GPSCoord prev, GPSCoord next, double lat_cos)
+  public void set_angle(GPSCoord prev, GPSCoord next)
   {
     double dx_prev,dy_prev,dx_next,dy_next,dot_p,sq_prod;
-    dx_next = (next.lat - lat) * 1000.0;
-    dx_prev = (lat - prev.lat) * 1000.0;
-    dy_next = (next.lon - lon) * 1000.0 * lat_cos;
-    dy_prev = (lon - prev.lon) * 1000.0 * lat_cos;
+    dx_next = next.y - y;
+    dx_prev = y - prev.y;
+    dy_next = next.x - x;
+    dy_prev = x - prev.x;
     dot_p = dx_next*dx_prev + dy_next * dy_prev;
     sq_prod = (dx_next*dx_next+dy_next*dy_next)*(dx_prev*dx_prev + dy_prev*dy_prev);
     
@@ -140,8 +154,7 @@ class GPSCoord
 
   public void set_dist_to_prev(GPSCoord prev)
   {
-    Location.distanceBetween(lat,lon,prev.lat,prev.lon,results);
-    dist_to_prev = (double)results[0];
+    dist_to_prev = get_dist(prev) * 1609.34;
   }
 
   public void reset()
@@ -248,8 +261,11 @@ class GPSCoordBuffer
     protected int last_trusted_ind = 0;
     protected long last_trusted_ts = 0;
     protected double last_trusted_d = 0.0;
-    protected double lat_cos = 0.0;
-    protected boolean lat_cos_inited = false;
+    // frame anchor, moved along with the runner the same way as geo_project_point()
+    protected double lat0 = 0.0, lon0 = 0.0, m_per_deg_lat = 0.0, m_per_deg_lon = 0.0;
+    protected double x0 = 0.0, y0 = 0.0;
+    public static final double GEO_REANCHOR_M = 2000.0; // same as jni/geodesy.h
+    protected boolean frame_inited = false;
     protected int last_processed_ind = 0, last_good_ind = 0;
     protected double last_pace_t = 0.0;
     protected double pause_pace_t = 0.0;
@@ -264,6 +280,30 @@ class GPSCoordBuffer
     public native boolean close_data_file();
     public native boolean flush();
     public native void debug_log(String msg);
+    public native void trace(int id, int i0, int i1, int i2, double d0, double d1, double d2);
+    public native void kf_reset();
+    public native double kf_push(double lat, double lon, long ts, float accuracy, float speed,
+                                 float bearing);
+    public native int kf_conf();
+    public native double kf_pace_t();
+    public native double[] geo_scales(double lat0);
+    public native void fusion_reset(double cal);
+    public native double fusion_push_gps(double lat, double lon, long ts, float accuracy,
+                                         float speed, float bearing);
+    public native double fusion_push_pod(long ts, double speed, double dist);
+    public native int fusion_conf();
+    public native boolean fusion_bridging();
+    public native double fusion_pace_t();
+    public native double fusion_cal();
+    
+    // must match Trace_event in jni/trace.h
+    public static final int TRACE_DIST_UPDATE = 1;
+    public static final int TRACE_POINT = 2;
+    public static final int TRACE_TRUSTED_D = 3;
+    public static final int TRACE_GOOD_PACE = 4;
+    public static final int TRACE_BAD_SIGNAL = 5;
+    public static final int TRACE_SUSPECT_SIGNAL = 6;
+    public static final int TRACE_SIGNAL_LOST = 7;
     
     public GPSCoordBuffer(ConfigState cfg,RunInfo run_info)
     {
@@ -285,9 +325,21 @@ class GPSCoordBuffer
       last_good_ind = 0;
       
       if (reset_dist)
+      {
        total_dist = 0.0;
+       frame_inited = false;
+      }
       
       points_since_signal = points = 0;
+      kf_reset();
+      
+      // keep what the footpod has learned for the rest of the run and the next one
+      double cal = fusion_cal();
+      
+      if (cal > 0.0)
+        cfg.footpod_cal = cal;
+      
+      fusion_reset(cfg.footpod_cal);
     }
     
     public GPSCoord get_prev()
@@ -307,8 +359,10 @@ class GPSCoordBuffer
     {
       int i,update_end = buf_end - 2, start_ind = last_good_ind + 1;
       
-      debug_log(String.format("total_dist=%f last_trusted_d=%f, start_ind=%d,update_end=%d",
-                              total_dist, last_trusted_d, start_ind, update_end));
+      if (cfg.dist_engine != ConfigState.DIST_ENGINE_CLASSIC)
+        return;
+      
+      trace(TRACE_DIST_UPDATE, start_ind, update_end, 0, total_dist, last_trusted_d, 0.0);
       
       if (final_update)
         update_end++;
@@ -324,13 +378,13 @@ class GPSCoordBuffer
       
       for (i = start_ind; i != update_end; )
       {
-        debug_log(String.format("Point %d at %d is %s", points, i, buf[i].good ? "good" : "bad"));
+        trace(TRACE_POINT, points, i, buf[i].good ? 1 : 0, 0.0, 0.0, 0.0);
         
         if (buf[i].good)
         {
           last_trusted_d += buf[i].get_dist(buf[last_good_ind]);
           last_good_ind = i;
-          debug_log(String.format("i=%d last_trusted_d=%f",i,last_trusted_d));
+          trace(TRACE_TRUSTED_D, i, 0, 0, last_trusted_d, 0.0, 0.0);
           
           if (last_trusted_d < cfg.min_d_last_trusted)
             return;
@@ -356,7 +410,7 @@ class GPSCoordBuffer
               last_pace_t = pace_t;
               last_trusted_ind = i;
               conf_level = DistInfo.ConfidenceLevel.NORMAL;
-              debug_log("Trusted point at index " + i + ", good pace " + pace_t);
+              trace(TRACE_GOOD_PACE, i, 0, 0, pace_t, 0.0, 0.0);
               return;
             }
             
@@ -385,16 +439,14 @@ class GPSCoordBuffer
               total_dist += dx_direct;
               last_pace_t = direct_pace_t;
               conf_level = DistInfo.ConfidenceLevel.BAD_SIGNAL;
-              debug_log("BAD_SIGNAL: Trusted point at index " + i 
-                + ", direct pace " + direct_pace_t + ", dx_direct=" + dx_direct );
+              trace(TRACE_BAD_SIGNAL, i, 0, 0, direct_pace_t, dx_direct, 0.0);
             }  
             else
             {  
               total_dist += last_trusted_d;
               last_pace_t = pace_t;
               conf_level = DistInfo.ConfidenceLevel.SUSPECT_SIGNAL;
-              debug_log("SUSPECT_SIGNAL: Trusted point at index " + i 
-                + ", integrated pace " + pace_t );
+              trace(TRACE_SUSPECT_SIGNAL, i, 0, 0, pace_t, 0.0, 0.0);
             }  
             
             last_trusted_ind = i;
@@ -430,10 +482,33 @@ class GPSCoordBuffer
         if (buf_start == COORD_BUF_SIZE)
             buf_start = 0;
 
-        if (!lat_cos_inited)
+        if (!frame_inited)
         {  
-          lat_cos = Math.cos(buf[save_buf_end].lat*Math.PI/180.0);
-          lat_cos_inited = true;
+          x0 = y0 = 0.0;
+          set_anchor(buf[save_buf_end]);
+          frame_inited = true;
+        }
+        
+        buf[save_buf_end].project(lat0,lon0,x0,y0,m_per_deg_lat,m_per_deg_lon);
+        
+        // keep the east scale true where the runner is, see jni/geodesy.h
+        if (Math.hypot(buf[save_buf_end].x - x0,buf[save_buf_end].y - y0) > GEO_REANCHOR_M)
+        {
+          x0 = buf[save_buf_end].x;
+          y0 = buf[save_buf_end].y;
+          set_anchor(buf[save_buf_end]);
+        }
+        
+        if (cfg.dist_engine == ConfigState.DIST_ENGINE_KALMAN)
+        {
+          push_kalman(buf[save_buf_end]);
+          return;
+        }
+        
+        if (cfg.dist_engine == ConfigState.DIST_ENGINE_FUSION)
+        {
+          push_fusion(buf[save_buf_end]);
+          return;
         }
           
         if (points > 0)
@@ -451,7 +526,7 @@ class GPSCoordBuffer
             if (p_prev_ind < 0)
               p_prev_ind += COORD_BUF_SIZE;
             
-            buf[prev_ind].set_angle(buf[p_prev_ind],buf[save_buf_end],lat_cos);
+            buf[prev_ind].set_angle(buf[p_prev_ind],buf[save_buf_end]);
             
             if (points > 2)
             {
@@ -486,11 +561,91 @@ class GPSCoordBuffer
         }
         
         if (points_since_signal >= 3)
+        {  
           update_dist(false);
+          auto_lap(last_trusted_ts);
+        }  
       }  
     }
+    
+    /* lap boundaries crossed since the last sample become splits, timed to the ms natively */
+    protected void auto_lap(long ts)
+    {
+      if (cfg.auto_lap_dist > 0.0 || cfg.auto_lap_time > 0)
+        RunTimer.push_dist(ts,total_dist,cfg.auto_lap_dist,cfg.auto_lap_time);
+    }
  
   
+    protected void set_anchor(GPSCoord c)
+    {
+      double[] scales = geo_scales(c.lat);
+      lat0 = c.lat;
+      lon0 = c.lon;
+      m_per_deg_lat = scales[0];
+      m_per_deg_lon = scales[1];
+    }
+    
+    protected void push_kalman(GPSCoord c)
+    {
+      total_dist += kf_push(c.lat,c.lon,c.ts,c.accuracy,c.speed,c.bearing);
+      conf_level = DistInfo.ConfidenceLevel.values()[kf_conf()];
+      
+      double pace_t = kf_pace_t();
+      
+      if (pace_t > 0.0)
+        last_pace_t = pace_t;
+      
+      last_trusted_ts = c.ts;
+      auto_lap(c.ts);
+      points++;
+      points_since_signal++;
+      flush();
+    }
+    
+    protected void push_fusion(GPSCoord c)
+    {
+      total_dist += fusion_push_gps(c.lat,c.lon,c.ts,c.accuracy,c.speed,c.bearing);
+      conf_level = DistInfo.ConfidenceLevel.values()[fusion_conf()];
+      
+      double pace_t = fusion_pace_t();
+      
+      if (pace_t > 0.0)
+        last_pace_t = pace_t;
+      
+      last_trusted_ts = c.ts;
+      auto_lap(c.ts);
+      points++;
+      points_since_signal++;
+      flush();
+    }
+    
+    /*
+      Footpod sample, on the thread the fixes come in on. ts is running time like
+      GPSCoord.ts, speed in m/s, dist the cumulative footpod distance in meters or
+      negative if the pod only reports speed.
+    */
+    public void push_footpod(long ts, double speed, double dist)
+    {
+      if (cfg.dist_engine != ConfigState.DIST_ENGINE_FUSION)
+        return;
+      
+      total_dist += fusion_push_pod(ts,speed,dist);
+      
+      if (!fusion_bridging())
+        return;
+      
+      conf_level = DistInfo.ConfidenceLevel.values()[fusion_conf()];
+      
+      double pace_t = fusion_pace_t();
+      
+      if (pace_t > 0.0)
+        last_pace_t = pace_t;
+      
+      // the footpod is what we trust now, do not extrapolate past it
+      last_trusted_ts = ts;
+      auto_lap(ts);
+    }
+    
     public long get_last_ts()
     {
       if (points == 0)
@@ -635,7 +790,7 @@ class GPSCoordBuffer
       if (dt > cfg.max_t_no_signal && points_since_signal > 0)
       {
         di.conf_level = conf_level = DistInfo.ConfidenceLevel.SIGNAL_LOST;
-        debug_log("Signal lost");
+        trace(TRACE_SIGNAL_LOST, 0, 0, 0, 0.0, 0.0, 0.0);
       }
       
       if (dt > 0 && di.pace_t > 0.0)
@@ -835,6 +990,7 @@ public class FastRunningFriend extends Activity implements LocationListener
          {
            coord_buf.get_dist_info(dist_info,run_info.t_total);
            show_dist_info(dist_info);
+           RunTimer.publish_live(dist_info.dist,dist_info.pace_t,dist_info.conf_level.ordinal());
            dist_update_ts = now;
          }
        }
@@ -1278,8 +1434,8 @@ public class FastRunningFriend extends Activity implements LocationListener
       p1.lon = -111.655104;
       p2.lat = 40.314385;
       p2.lon = -111.655104;
-      double d1 = p1.get_dist(p2);
-      double d2 = p2.get_dist(p1);
+      double d1 = p1.get_dist_vincenty(p2);
+      double d2 = p2.get_dist_vincenty(p1);
       update_status(String.format("Bug test: d1=%f,d2=%f",d1,d2));
     }
     
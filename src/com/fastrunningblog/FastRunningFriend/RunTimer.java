@@ -10,9 +10,11 @@ public class RunTimer
   public static native boolean reset();
   public static native boolean start_leg(double d);
   public static native boolean split(double d);
+  public static native void push_dist(long ts, double d, double every_d, long every_t);
   public static native boolean get_run_info(RunInfo i);
   public static native String get_review_info(String file_prefix, String workout);
   public static native String[] get_run_list();
+  public static native void publish_live(double dist, double pace_t, int conf);
   public static native void sirf_gps_test_start();
   public static native void sirf_gps_test_stop();
 };
\ No newline at end of file
@@ -0,0 +1,774 @@
+/*
+  Host side stand-in for the MotoACTV SiRF receiver. Creates a pty and fake pin files in a
+  directory, waits for the app to send its first message, then feeds the pty either a
+  captured binary SiRF stream or MID 2, 4 and 41 messages synthesized from a
+  gps_data_*.csv track, optionally corrupted. What the app writes back is decoded and
+  logged.
+
+  Build:  cc -O2 -o sirf_sim tools/sirf_sim.c -lm -lutil
+  Bench:  cc -O2 -DSIRF_SIM_BENCH -o sirf_bench tools/sirf_sim.c -lm -lutil -lpthread
+          runs jni/sirf_gps.c in process against the pty and reports parser throughput,
+          latency and how many damaged frames it resynced past.
+
+  Point the app at it with sirf_tty=<dir>/ttyS0, sirf_standby=<dir>/gps_standby,
+  sirf_reset=<dir>/gps_reset and sirf_sleep_file=<dir>/uart0_sleep_timeout.
+
+  Usage: sirf_sim [-d dir] (-t gps_data.csv | -c capture.bin) [-r rate] [-x speedup]
+                  [-e damage_prob] [-g garbage_prob] [-n loops] [-s seed] [-a]
+    -r  fixes (track) or frames (capture) per second, 0 - as fast as the pty takes them,
+        default the track timestamps or 10 frames/s for a capture
+    -x  speed up track time by this factor
+    -e  chance of each frame getting a flipped bit, a dropped byte or being cut short
+    -g  chance of random bytes between frames
+    -n  play the input this many times
+    -a  bench only, leave the message rates at the receiver default
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SIM_MAX_FRAME (2047 + 8)
+#define SIM_MAX_LINE 256
+#define SIM_MAX_GARBAGE 16
+#define SIM_SEND_RING 65536
+#define SIM_DEFAULT_DIR "/tmp/frf_sirf"
+#define SIM_CAPTURE_RATE 10.0
+#define SIM_SETUP_US 100000
+#define SIM_SETTLE_US 300000 /* after the last frame, for the reader to catch up */
+
+#define MID_OK_TO_SEND 0x12
+#define MID_NAV 0x02
+#define MID_TRACKER 0x04
+#define MID_GEODETIC 0x29
+#define MID_SET_MSG_RATE 0xa6
+
+#define WGS84_A 6378137.0
+#define WGS84_E2 6.69437999014e-3
+#define DEG_TO_RAD (M_PI/180.0)
+
+typedef unsigned char byte;
+
+typedef struct
+{
+  const char* dir;
+  const char* track,*capture;
+  double rate,speedup,damage_p,garbage_p;
+  uint loops;
+  int master;
+  FILE* fp;
+  byte* cap,*cap_p,*cap_end;
+  uint n_frames,n_damaged,n_garbage,n_bursts;
+  byte every[256]; /* fixes between messages of an ID as MID 166 set it, 0 - off */
+  unsigned long long n_bytes;
+} Sim;
+
+static unsigned long long now_us()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static double rnd()
+{
+  return rand() / (RAND_MAX + 1.0);
+}
+
+#ifdef SIRF_SIM_BENCH
+/*
+  jni/sirf_gps.c built in with just enough of log.h, metrics.h and config_vars.h around it.
+  The parser reports every frame it skips through LOGW_RL, which is what we count.
+*/
+static const char* bench_dir;
+static volatile uint bench_resyncs;
+static int bench_rate_control = 1;
+
+#define LOG_H
+#define FRF_LOG_DEBUG 0
+#define FRF_LOG_INFO 1
+#define FRF_LOG_LEVEL FRF_LOG_INFO
+#define LOGD(...) do {} while (0)
+#define LOGI(...) do { fprintf(stderr,__VA_ARGS__); fputc('\n',stderr); } while (0)
+#define LOGW LOGI
+#define LOGE LOGI
+#define LOGW_RL(interval_ms,...) (bench_resyncs++)
+#define LOGE_RL(interval_ms,...) LOGE(__VA_ARGS__)
+
+#define METRICS_H
+typedef enum {METRIC_GPS_SIRF_READ,METRIC_FIX_WRITE} Metric_id;
+#define metrics_now_us now_us
+#define metric_record(id,start_us,failed) do {} while (0)
+
+#define CONFIG_VARS_H
+#define CONFIG_STR_SIZE 128
+#define BENCH_PATH(var,name) static void config_get_##var(char* buf) \
+  { snprintf(buf,CONFIG_STR_SIZE,"%s/" name,bench_dir); }
+BENCH_PATH(sirf_tty,"ttyS0")
+BENCH_PATH(sirf_standby,"gps_standby")
+BENCH_PATH(sirf_reset,"gps_reset")
+BENCH_PATH(sirf_sleep_file,"uart0_sleep_timeout")
+static int config_get_sirf_vmin() { return 255; }
+static int config_get_sirf_vtime() { return 1; }
+static int config_get_sirf_measure() { return 1; }
+static int config_get_sirf_rate_control() { return bench_rate_control; }
+static long config_get_gps_update_interval() { return 1000; }
+
+#include <pthread.h>
+#include "../jni/sirf_gps.c"
+
+typedef struct
+{
+  Gps_sirf_session s;
+  pthread_t th;
+  uint n_msgs,n_timed;
+  unsigned long long first_us,last_us;
+  double lat_sum,lat_max,lat_min;
+} Bench;
+
+static Bench bench;
+static unsigned long long send_us[SIM_SEND_RING];
+
+static uint be32(byte* p)
+{
+  return ((uint)p[0] << 24) | ((uint)p[1] << 16) | ((uint)p[2] << 8) | p[3];
+}
+
+/* the synthesized messages carry the burst number in their time of week */
+static void bench_on_msg(void* arg, Gps_sirf_msg* msg)
+{
+  Bench* b = (Bench*)arg;
+  unsigned long long now = now_us();
+  long long sent = -1;
+
+  if (!b->n_msgs++)
+    b->first_us = now;
+
+  b->last_us = now;
+
+  if (msg->id == MID_NAV && msg->len == 41)
+    sent = send_us[(be32(msg->data + 23) / 100) % SIM_SEND_RING];
+  else if (msg->id == MID_GEODETIC && msg->len == 91)
+    sent = send_us[(be32(msg->data + 6) / 1000) % SIM_SEND_RING];
+
+  if (sent > 0)
+  {
+    double lat = (now - sent) / 1000.0;
+
+    if (!b->n_timed++ || lat < b->lat_min)
+      b->lat_min = lat;
+
+    if (lat > b->lat_max)
+      b->lat_max = lat;
+
+    b->lat_sum += lat;
+  }
+}
+
+static void* bench_thread(void* arg)
+{
+  Bench* b = (Bench*)arg;
+
+  if (gps_sirf_init(&b->s) == 0)
+    gps_sirf_loop(&b->s);
+
+  gps_sirf_end(&b->s);
+  return 0;
+}
+
+static int bench_start(Sim* sim)
+{
+  memset(&bench,0,sizeof(bench));
+  bench_dir = sim->dir;
+  bench.s.on_msg = bench_on_msg;
+  bench.s.on_msg_arg = &bench;
+  return pthread_create(&bench.th,0,bench_thread,&bench) != 0;
+}
+
+static void bench_sent(uint burst)
+{
+  send_us[burst % SIM_SEND_RING] = now_us();
+}
+
+static void bench_end(Sim* sim, unsigned long long start_us)
+{
+  double secs;
+
+  usleep(SIM_SETTLE_US);
+  gps_sirf_stop(&bench.s);
+  pthread_join(bench.th,0);
+  secs = (bench.last_us - start_us) / 1e6;
+
+  printf("parsed %u of %u frames, %u sent damaged, %u resyncs\n", bench.n_msgs,
+         sim->n_frames, sim->n_damaged, bench_resyncs);
+
+  if (secs > 0.0)
+    printf("%.0f frames/s, %.0f bytes/s\n", bench.n_msgs / secs, sim->n_bytes / secs);
+
+  if (bench.n_timed)
+    printf("latency ms min %.3f avg %.3f max %.3f over %u frames\n", bench.lat_min,
+           bench.lat_sum / bench.n_timed, bench.lat_max, bench.n_timed);
+
+  if (secs > 0.0)
+    log_mid_stats(&bench.s.measure,bench.last_us - start_us);
+}
+#else
+#define bench_start(sim) 0
+#define bench_sent(burst) do {} while (0)
+#define bench_end(sim,start_us) do {} while (0)
+#endif
+
+static byte* put16(byte* p, int v)
+{
+  *p++ = (byte)(v >> 8);
+  *p++ = (byte)v;
+  return p;
+}
+
+static byte* put32(byte* p, long v)
+{
+  p = put16(p,(int)(v >> 16));
+  return put16(p,(int)v);
+}
+
+/* header, length, payload, 15 bit checksum, trailer */
+static uint frame(byte* out, byte* payload, uint len)
+{
+  uint i,crc = 0;
+
+  out[0] = 0xa0;
+  out[1] = 0xa2;
+  put16(out + 2,len);
+
+  for (i = 0; i < len; i++)
+    crc += (out[4 + i] = payload[i]);
+
+  put16(out + 4 + len,crc & 0x7fff);
+  out[len + 6] = 0xb0;
+  out[len + 7] = 0xb3;
+  return len + 8;
+}
+
+static uint nav_msg(byte* out, uint burst, double lat, double lon, double speed, double bearing)
+{
+  byte b[41],*p = b;
+  double sl = sin(lat * DEG_TO_RAD), cl = cos(lat * DEG_TO_RAD);
+  double so = sin(lon * DEG_TO_RAD), co = cos(lon * DEG_TO_RAD);
+  double n = WGS84_A / sqrt(1.0 - WGS84_E2 * sl * sl);
+  double ve = speed * sin(bearing * DEG_TO_RAD), vn = speed * cos(bearing * DEG_TO_RAD);
+  int i;
+
+  *p++ = MID_NAV;
+  p = put32(p,lrint(n * cl * co));
+  p = put32(p,lrint(n * cl * so));
+  p = put32(p,lrint(n * (1.0 - WGS84_E2) * sl));
+  // east/north to ECEF, 1/8 m/s
+  p = put16(p,lrint(8.0 * (-so * ve - sl * co * vn)));
+  p = put16(p,lrint(8.0 * (co * ve - sl * so * vn)));
+  p = put16(p,lrint(8.0 * (cl * vn)));
+  *p++ = 4; // 3D fix
+  *p++ = 5; // HDOP 1.0
+  *p++ = 0;
+  p = put16(p,1024);
+  p = put32(p,burst * 100L);
+  *p++ = 8;
+
+  for (i = 0; i < 12; i++)
+    *p++ = (i < 8) ? i + 1 : 0;
+
+  return frame(out,b,p - b);
+}
+
+/* twelve channels of tracking the first eight satellites */
+static uint tracker_msg(byte* out, uint burst)
+{
+  byte b[188],*p = b;
+  int i,j;
+
+  *p++ = MID_TRACKER;
+  p = put16(p,1024);
+  p = put32(p,burst * 100L);
+  *p++ = 12;
+
+  for (i = 0; i < 12; i++)
+  {
+    *p++ = (i < 8) ? i + 1 : 0;
+    *p++ = (byte)(i * 20); // azimuth and elevation, 1.5 and 0.5 degree units
+    *p++ = (byte)(40 + i * 10);
+    p = put16(p,(i < 8) ? 0xbf : 0);
+
+    for (j = 0; j < 10; j++)
+      *p++ = (i < 8) ? 40 : 0;
+  }
+
+  return frame(out,b,sizeof(b));
+}
+
+static uint geodetic_msg(byte* out, uint burst, double lat, double lon, double speed,
+                         double bearing, double accuracy)
+{
+  byte b[91],*p = b;
+
+  memset(b,0,sizeof(b));
+  *p++ = MID_GEODETIC;
+  p = put16(p,0); // valid
+  p = put16(p,4); // 3D fix
+  p = put16(p,2048);
+  p = put32(p,burst * 1000L);
+  p += 2 + 1 + 1 + 1 + 1 + 2 + 4; // UTC and satellite list
+  p = put32(p,lrint(lat * 1e7));
+  p = put32(p,lrint(lon * 1e7));
+  p += 4 + 4 + 1; // altitudes, datum
+  p = put16(p,lrint(speed * 100.0));
+  p = put16(p,lrint(bearing * 100.0));
+  p += 2 + 2 + 2; // magnetic variation, climb and heading rate
+  p = put32(p,lrint(accuracy * 100.0));
+  return frame(out,b,sizeof(b));
+}
+
+static int due(Sim* sim, byte mid)
+{
+  return sim->every[mid] && sim->n_bursts % sim->every[mid] == 0;
+}
+
+/* MID 2, 4 and 41 for the next fix of the track that has any, 0 at the end */
+static uint next_fix(Sim* sim, byte* out, long long* ts)
+{
+  char line[SIM_MAX_LINE];
+  double lat,lon,dist,bearing,accuracy,speed;
+  uint len;
+
+  while (fgets(line,sizeof(line),sim->fp))
+  {
+    if (sscanf(line,"%lf,%lf,%lld,%lf,%lf,%lf,%lf",&lat,&lon,ts,&dist,&bearing,&accuracy,
+               &speed) != 7)
+      continue;
+
+    len = due(sim,MID_NAV) ? nav_msg(out,sim->n_bursts,lat,lon,speed,bearing) : 0;
+
+    if (due(sim,MID_TRACKER))
+      len += tracker_msg(out + len,sim->n_bursts);
+
+    if (due(sim,MID_GEODETIC))
+      len += geodetic_msg(out + len,sim->n_bursts,lat,lon,speed,bearing,accuracy);
+
+    if (len)
+      return len;
+
+    sim->n_bursts++;
+  }
+
+  return 0;
+}
+
+/* the next frame of the capture, or the bytes up to it if they are not one */
+static uint next_capture_frame(Sim* sim, byte* out)
+{
+  byte* p = sim->cap_p,*end = sim->cap_end;
+  uint len;
+
+  if (p == end)
+    return 0;
+
+  if (end - p >= 8 && p[0] == 0xa0 && p[1] == 0xa2 &&
+      (len = ((uint)p[2] << 8 | p[3]) + 8) <= SIM_MAX_FRAME && len <= (uint)(end - p))
+    ;
+  else
+  {
+    byte* q = p + 1;
+
+    for (; q + 1 < end && (q[0] != 0xa0 || q[1] != 0xa2); q++) /* empty */;
+
+    len = (q + 1 < end ? q : end) - p;
+  }
+
+  if (len > SIM_MAX_FRAME)
+    len = SIM_MAX_FRAME;
+
+  memcpy(out,p,len);
+  sim->cap_p += len;
+  return len;
+}
+
+/* one of a flipped bit, a dropped byte or a frame cut short */
+static uint damage(byte* buf, uint len)
+{
+  uint i = rand() % len;
+
+  switch (rand() % 3)
+  {
+    case 0:
+      buf[i] ^= 1 << (rand() % 8);
+      return len;
+    case 1:
+      memmove(buf + i,buf + i + 1,len - i - 1);
+      return len - 1;
+    default:
+      return i ? i : 1;
+  }
+}
+
+static void log_host_msgs(Sim* sim)
+{
+  static byte in[4096];
+  static uint in_len;
+  ssize_t n;
+  byte* p;
+
+  if ((n = read(sim->master,in + in_len,sizeof(in) - in_len)) <= 0)
+    return;
+
+  in_len += n;
+
+  for (p = in; p + 8 <= in + in_len;)
+  {
+    uint len = ((uint)p[2] << 8) | p[3];
+
+    if (p[0] != 0xa0 || p[1] != 0xa2)
+    {
+      p++;
+      continue;
+    }
+
+    if (p + len + 8 > in + in_len)
+      break;
+
+    if (p[4] == MID_SET_MSG_RATE && len >= 4 && p[5] == 0)
+    {
+      sim->every[p[6]] = p[7];
+      fprintf(stderr,"host set MID %u every %u s\n", p[6], p[7]);
+    }
+    else
+      fprintf(stderr,"host sent MID 0x%02x, %u bytes\n", p[4], len);
+
+    p += len + 8;
+  }
+
+  in_len -= p - in;
+  memmove(in,p,in_len);
+}
+
+/* handles what the app sends while waiting, at least once even when already late */
+static void wait_until(Sim* sim, unsigned long long t_us)
+{
+  for (;;)
+  {
+    unsigned long long now = now_us();
+    struct pollfd pfd;
+
+    pfd.fd = sim->master;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd,1,(now < t_us) ? (int)((t_us - now + 999) / 1000) : 0) > 0 &&
+        (pfd.revents & POLLIN))
+      log_host_msgs(sim);
+
+    if (now_us() >= t_us)
+      return;
+  }
+}
+
+static int send_bytes(Sim* sim, byte* buf, uint len)
+{
+  while (len)
+  {
+    ssize_t n = write(sim->master,buf,len);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr,"Error writing to the pty (%d)\n", errno);
+      return 1;
+    }
+
+    buf += n;
+    len -= n;
+    sim->n_bytes += n;
+  }
+
+  return 0;
+}
+
+static int send_burst(Sim* sim, byte* buf, uint len)
+{
+  byte* p = buf,*end = buf + len;
+
+  // one frame at a time so each can be damaged on its own
+  while (p < end)
+  {
+    uint frame_len = (p[0] == 0xa0 && p[1] == 0xa2) ? ((uint)p[2] << 8 | p[3]) + 8 : end - p;
+    uint send_len = frame_len;
+
+    if (frame_len > (uint)(end - p))
+      send_len = frame_len = end - p;
+
+    if (sim->garbage_p > 0.0 && rnd() < sim->garbage_p)
+    {
+      byte junk[SIM_MAX_GARBAGE];
+      uint i,n = 1 + rand() % SIM_MAX_GARBAGE;
+
+      for (i = 0; i < n; i++)
+        junk[i] = rand();
+
+      sim->n_garbage++;
+
+      if (send_bytes(sim,junk,n))
+        return 1;
+    }
+
+    if (sim->damage_p > 0.0 && rnd() < sim->damage_p)
+    {
+      send_len = damage(p,frame_len);
+      sim->n_damaged++;
+    }
+
+    sim->n_frames++;
+
+    if (send_bytes(sim,p,send_len))
+      return 1;
+
+    p += frame_len;
+  }
+
+  return 0;
+}
+
+static int play(Sim* sim)
+{
+  static byte buf[3 * SIM_MAX_FRAME];
+  unsigned long long next_us = now_us();
+  long long ts,first_ts = -1;
+  unsigned long long start_us = next_us;
+  uint len;
+
+  for (;;)
+  {
+    if (sim->fp)
+    {
+      if (!(len = next_fix(sim,buf,&ts)))
+        break;
+
+      if (first_ts < 0)
+        first_ts = ts;
+
+      // the track keeps its own time unless a rate is given
+      if (sim->rate < 0.0)
+        next_us = start_us + (unsigned long long)((ts - first_ts) * 1000.0 / sim->speedup);
+    }
+    else if (!(len = next_capture_frame(sim,buf)))
+      break;
+
+    wait_until(sim,next_us);
+    bench_sent(sim->n_bursts);
+
+    if (send_burst(sim,buf,len))
+      return 1;
+
+    sim->n_bursts++;
+
+    if (sim->rate > 0.0)
+      next_us += (unsigned long long)(1e6 / sim->rate);
+  }
+
+  return 0;
+}
+
+static int make_pin(const char* dir, const char* name)
+{
+  char path[PATH_MAX];
+  int fd;
+
+  snprintf(path,sizeof(path),"%s/%s",dir,name);
+
+  if ((fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0644)) < 0)
+  {
+    fprintf(stderr,"Could not create %s (%d)\n", path, errno);
+    return 1;
+  }
+
+  close(fd);
+  return 0;
+}
+
+static int open_pty(Sim* sim)
+{
+  char link[PATH_MAX];
+  const char* slave;
+  struct termios t;
+
+  mkdir(sim->dir,0755);
+
+  if ((sim->master = posix_openpt(O_RDWR|O_NOCTTY)) < 0 || grantpt(sim->master) ||
+      unlockpt(sim->master) || !(slave = ptsname(sim->master)))
+  {
+    fprintf(stderr,"Could not create a pty (%d)\n", errno);
+    return 1;
+  }
+
+  // the receiver side talks binary too
+  if (!tcgetattr(sim->master,&t))
+  {
+    cfmakeraw(&t);
+    tcsetattr(sim->master,TCSANOW,&t);
+  }
+
+  snprintf(link,sizeof(link),"%s/ttyS0",sim->dir);
+  unlink(link);
+
+  if (symlink(slave,link))
+  {
+    fprintf(stderr,"Could not link %s to %s (%d)\n", link, slave, errno);
+    return 1;
+  }
+
+  if (make_pin(sim->dir,"gps_standby") || make_pin(sim->dir,"gps_reset") ||
+      make_pin(sim->dir,"uart0_sleep_timeout"))
+    return 1;
+
+  fprintf(stderr,"SiRF receiver on %s, pins in %s\n", link, sim->dir);
+  return 0;
+}
+
+/* the real receiver says nothing until the app has reset it and sent something */
+static int wait_for_host(Sim* sim)
+{
+  struct pollfd pfd;
+  byte ok[8 + 1];
+  byte mid = MID_OK_TO_SEND;
+
+  pfd.fd = sim->master;
+  pfd.events = POLLIN;
+
+  while (poll(&pfd,1,-1) < 0 || !(pfd.revents & POLLIN))
+  {
+    // nobody has the slave open yet
+    if (pfd.revents & POLLHUP)
+      usleep(10000);
+  }
+
+  log_host_msgs(sim);
+  sim->n_frames++;
+
+  if (send_bytes(sim,ok,frame(ok,&mid,1)))
+    return 1;
+
+  // the setup the app sends before its first fix
+  wait_until(sim,now_us() + SIM_SETUP_US);
+  return 0;
+}
+
+static int load_capture(Sim* sim)
+{
+  FILE* fp;
+  struct stat st;
+
+  if (!(fp = fopen(sim->capture,"rb")) || fstat(fileno(fp),&st) ||
+      !(sim->cap = (byte*)malloc(st.st_size ? st.st_size : 1)) ||
+      fread(sim->cap,1,st.st_size,fp) != (size_t)st.st_size)
+  {
+    fprintf(stderr,"Could not read capture %s (%d)\n", sim->capture, errno);
+
+    if (fp)
+      fclose(fp);
+
+    return 1;
+  }
+
+  fclose(fp);
+  sim->cap_end = sim->cap + st.st_size;
+  return 0;
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr,"Usage: %s [-d dir] (-t gps_data.csv | -c capture.bin) [-r rate] "
+                 "[-x speedup] [-e damage_prob] [-g garbage_prob] [-n loops] [-s seed] [-a]\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  Sim sim;
+  unsigned long long start_us;
+  uint loop;
+  int c;
+
+  memset(&sim,0,sizeof(sim));
+  sim.dir = SIM_DEFAULT_DIR;
+  sim.rate = -1.0;
+  sim.speedup = 1.0;
+  sim.loops = 1;
+  memset(sim.every,1,sizeof(sim.every));
+
+  while ((c = getopt(argc,argv,"d:t:c:r:x:e:g:n:s:a")) != -1)
+  {
+    switch (c)
+    {
+      case 'd': sim.dir = optarg; break;
+      case 't': sim.track = optarg; break;
+      case 'c': sim.capture = optarg; break;
+      case 'r': sim.rate = atof(optarg); break;
+      case 'x': sim.speedup = atof(optarg); break;
+      case 'e': sim.damage_p = atof(optarg); break;
+      case 'g': sim.garbage_p = atof(optarg); break;
+      case 'n': sim.loops = atoi(optarg); break;
+      case 's': srand(atoi(optarg)); break;
+#ifdef SIRF_SIM_BENCH
+      case 'a': bench_rate_control = 0; break;
+#endif
+      default: usage(argv[0]);
+    }
+  }
+
+  if (!sim.track == !sim.capture || sim.speedup <= 0.0)
+    usage(argv[0]);
+
+  if (sim.capture && sim.rate < 0.0)
+    sim.rate = SIM_CAPTURE_RATE;
+
+  if ((sim.capture && load_capture(&sim)) || open_pty(&sim) || bench_start(&sim) ||
+      wait_for_host(&sim))
+    return 1;
+
+  start_us = now_us();
+
+  for (loop = 0; loop < sim.loops; loop++)
+  {
+    if (sim.track && !(sim.fp = fopen(sim.track,"r")))
+    {
+      fprintf(stderr,"Could not open track %s (%d)\n", sim.track, errno);
+      return 1;
+    }
+
+    sim.cap_p = sim.cap;
+
+    if (play(&sim))
+      return 1;
+
+    if (sim.fp)
+    {
+      fclose(sim.fp);
+      sim.fp = 0;
+    }
+  }
+
+  fprintf(stderr,"Sent %u frames, %llu bytes, %u damaged, %u garbage runs in %.2f s\n",
+          sim.n_frames, sim.n_bytes, sim.n_damaged, sim.n_garbage,
+          (now_us() - start_us) / 1e6);
+  bench_end(&sim,start_us);
+  return 0;
+}